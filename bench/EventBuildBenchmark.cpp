@@ -0,0 +1,225 @@
+// Measures the cost of building events from parsed frames, with and without the EventPool.
+//
+// usage: EventBuildBenchmark [--events N] [--asads N] [--hits N] [--in-flight N]
+//
+// Each event is built from one synthetic partial-readout frame per AsAd (--asads, 40 for a full detector), each with
+// the four FPN channels and --hits other channels per AGET, all 512 time buckets long, and hit patterns that list
+// exactly those channels. The program fails if any frame's hit patterns don't match its data, since that would time
+// the mismatch handling instead of the normal path. The frames are parsed once up front, so only event building and
+// FPN subtraction are timed. To mimic the merger, --in-flight events are kept alive at once (pending in the builder,
+// queued, or being written) before each one is discarded or released.
+//
+// Allocations (number and bytes) are counted by replacing the global operator new in this program.
+
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <boost/filesystem.hpp>
+
+#include "Event.h"
+#include "EventPool.h"
+#include "GRAWFrame.h"
+#include "PadLookupTable.h"
+#include "SyntheticFrames.h"
+
+static std::atomic<uint64_t> allocCount {0};
+static std::atomic<uint64_t> allocBytes {0};
+
+void* operator new(std::size_t size)
+{
+    allocCount++;
+    allocBytes += size;
+    if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+static double CurrentRssMB()
+{
+    std::ifstream statm ("/proc/self/statm");
+    long pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+static double PeakRssMB()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;  // ru_maxrss is in kB on Linux
+}
+
+static RawFrame MakeAsadFrame(const uint8_t cobo, const uint8_t asad, const int hitsPerAget, std::mt19937& rng)
+{
+    std::vector<uint8_t> items;
+    std::vector<std::bitset<72>> hitPatterns (Constants::num_agets);
+    std::uniform_int_distribution<int> chanDist (0, Constants::num_channels - 1);
+    std::uniform_int_distribution<int> sampleDist (0, 4095);
+
+    for (uint32_t aget = 0; aget < Constants::num_agets; aget++) {
+        std::vector<bool> used (Constants::num_channels, false);
+        for (int ch : {11, 22, 45, 56}) used[ch] = true;
+        for (int i = 0; i < hitsPerAget; i++) used[chanDist(rng)] = true;
+
+        for (uint32_t ch = 0; ch < Constants::num_channels; ch++) {
+            if (!used[ch]) continue;
+            MarkHit(hitPatterns, aget, ch);
+            for (uint32_t tb = 0; tb < Constants::num_tbs; tb++) {
+                PutPartialReadoutItem(items, aget, ch, tb, uint32_t(sampleDist(rng)));
+            }
+        }
+    }
+
+    return MakeFrame(cobo, asad, GRAWFrame::Expected_frameTypePartialReadout,
+                     GRAWFrame::Expected_itemSizePartialReadout, items, hitPatterns);
+}
+
+struct Result
+{
+    double seconds = 0;
+    uint64_t allocs = 0;
+    uint64_t bytes = 0;
+    double rssMB = 0;
+    uint64_t mismatchedFrames = 0;  // frames whose hit patterns don't match their data
+};
+
+template <typename MakeEvent, typename DropEvent>
+static Result Run(const std::vector<GRAWFrame>& frames, const std::shared_ptr<PadLookupTable>& lookupTable,
+                  const int nEvents, const size_t inFlight, MakeEvent makeEvent, DropEvent dropEvent)
+{
+    std::vector<Event> ring (inFlight);
+
+    uint64_t allocsBefore = allocCount.load();
+    uint64_t bytesBefore = allocBytes.load();
+    uint64_t mismatchedFrames = 0;
+    auto begin = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < nEvents; i++) {
+        Event evt = makeEvent();
+        evt.SetLookupTable(lookupTable);
+        evt.Reserve(frames.size());
+        for (const auto& frame : frames) {
+            if (evt.AppendFrame(frame).any()) mismatchedFrames++;
+        }
+        evt.SubtractFPN();
+
+        Event& slot = ring[static_cast<size_t>(i) % inFlight];
+        dropEvent(slot);
+        slot = std::move(evt);
+    }
+
+    Result res;
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    res.allocs = allocCount.load() - allocsBefore;
+    res.bytes = allocBytes.load() - bytesBefore;
+    res.rssMB = CurrentRssMB();
+    res.mismatchedFrames = mismatchedFrames;
+
+    for (auto& evt : ring) dropEvent(evt);
+    return res;
+}
+
+static void Report(const std::string& name, const int nEvents, const Result& res)
+{
+    std::cout << std::left << std::setw(8) << name
+              << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << nEvents / res.seconds << " events/s"
+              << std::setw(12) << double(res.allocs) / nEvents << " allocs/event"
+              << std::setw(10) << res.bytes / (1024.0 * 1024.0) / nEvents << " MB allocated/event"
+              << std::setw(10) << res.rssMB << " MB RSS" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    int nEvents = 500;
+    int nAsads = 40;
+    int hitsPerAget = 8;
+    size_t inFlight = 34;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg {argv[i]};
+        if (arg == "--events" && i + 1 < argc) {
+            nEvents = std::stoi(argv[++i]);
+        }
+        else if (arg == "--asads" && i + 1 < argc) {
+            nAsads = std::stoi(argv[++i]);
+        }
+        else if (arg == "--hits" && i + 1 < argc) {
+            hitsPerAget = std::stoi(argv[++i]);
+        }
+        else if (arg == "--in-flight" && i + 1 < argc) {
+            inFlight = std::max(1ul, std::stoul(argv[++i]));
+        }
+        else {
+            std::cerr << "usage: EventBuildBenchmark [--events N] [--asads N] [--hits N] [--in-flight N]" << std::endl;
+            return 1;
+        }
+    }
+
+    // A lookup table covering every channel, in a temporary file
+    auto lookupPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+    {
+        std::ofstream csv (lookupPath.string());
+        int pad = 0;
+        for (int cobo = 0; cobo < Constants::num_cobos; cobo++)
+            for (int asad = 0; asad < Constants::num_asads; asad++)
+                for (int aget = 0; aget < Constants::num_agets; aget++)
+                    for (int ch = 0; ch < Constants::num_channels; ch++)
+                        csv << cobo << "," << asad << "," << aget << "," << ch << "," << pad++ << "\n";
+    }
+    auto lookupTable = std::make_shared<PadLookupTable>(lookupPath.string());
+    boost::filesystem::remove(lookupPath);
+
+    std::mt19937 rng (42);
+    std::vector<GRAWFrame> frames;
+    for (int i = 0; i < nAsads; i++) {
+        auto cobo = static_cast<uint8_t>(i / Constants::num_asads);
+        auto asad = static_cast<uint8_t>(i % Constants::num_asads);
+        frames.emplace_back(MakeAsadFrame(cobo, asad, hitsPerAget, rng));
+    }
+
+    std::cout << nAsads << " AsAds, " << hitsPerAget << " hits per AGET, " << inFlight << " events in flight"
+              << ", startup RSS " << CurrentRssMB() << " MB" << std::endl;
+
+    Result fresh = Run(frames, lookupTable, nEvents, inFlight,
+                       [] { return Event(); },
+                       [] (Event& evt) { evt = Event(); });
+    Report("new", nEvents, fresh);
+
+    EventPool pool (inFlight);
+    Result pooled = Run(frames, lookupTable, nEvents, inFlight,
+                        [&pool] { return pool.acquire(); },
+                        [&pool] (Event& evt) { pool.release(std::move(evt)); });
+    Report("pool", nEvents, pooled);
+
+    std::cout << "pool created " << pool.numCreated() << " events and reused " << pool.numReused() << std::endl;
+    std::cout << "peak RSS " << PeakRssMB() << " MB" << std::endl;
+
+    // The frames are consistent, so a mismatch means the benchmark timed the slow path by mistake
+    if (fresh.mismatchedFrames + pooled.mismatchedFrames != 0) {
+        std::cerr << "error: " << fresh.mismatchedFrames + pooled.mismatchedFrames
+                  << " frames had hit patterns that didn't match their data" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
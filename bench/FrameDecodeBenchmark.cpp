@@ -0,0 +1,205 @@
+// Measures how fast frames are decoded and appended to events.
+//
+// usage: FrameDecodeBenchmark [--frames N] [--hits N] [--repeat N]
+//
+// Two synthetic frames are used: a full-readout frame (4 AGETs x 68 channels x 512 time buckets, with the AGETs
+// interleaved) and a partial-readout frame with the FPN channels and --hits other channels per AGET. Each one is
+// decoded --frames times:
+//
+//   legacy    the full-readout decoder GRAWFrame used to have, which filled temporary per-AGET arrays and
+//             then expanded them into one GRAWDataItem per sample (full readout only)
+//   view      construct a GRAWFrameView and read the hit patterns, without decoding any items
+//   frame     construct a GRAWFrame
+//   append    construct a GRAWFrame and append it to an Event
+//   fused     append the frame to an Event with Event::AppendRawFrame, reusing one DecodedItems buffer like the
+//             EventBuilder does
+
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "Event.h"
+#include "GRAWFrame.h"
+#include "GRAWFrameView.h"
+#include "GRAWDataItem.h"
+#include "PadLookupTable.h"
+#include "SyntheticFrames.h"
+#include "Utilities.h"
+
+static RawFrame MakeFullReadoutFrame(std::mt19937& rng)
+{
+    std::uniform_int_distribution<int> sampleDist (0, 4095);
+    std::vector<uint8_t> items;
+    for (int tb = 0; tb < Constants::num_tbs; tb++) {
+        for (int ch = 0; ch < Constants::num_channels; ch++) {
+            for (uint32_t aget = 0; aget < Constants::num_agets; aget++) {
+                PutBE(items, (aget << 14) | uint32_t(sampleDist(rng)), 2);
+            }
+        }
+    }
+    return MakeFrame(0, 0, GRAWFrame::Expected_frameTypeFullReadout, GRAWFrame::Expected_itemSizeFullReadout, items);
+}
+
+static RawFrame MakePartialReadoutFrame(const int hitsPerAget, std::mt19937& rng)
+{
+    std::uniform_int_distribution<int> chanDist (0, Constants::num_channels - 1);
+    std::uniform_int_distribution<int> sampleDist (0, 4095);
+    std::vector<uint8_t> items;
+    std::vector<std::bitset<72>> hitPatterns (Constants::num_agets);
+    for (uint32_t aget = 0; aget < Constants::num_agets; aget++) {
+        std::vector<bool> used (Constants::num_channels, false);
+        for (int ch : {11, 22, 45, 56}) used[ch] = true;
+        for (int i = 0; i < hitsPerAget; i++) used[chanDist(rng)] = true;
+
+        for (uint32_t ch = 0; ch < Constants::num_channels; ch++) {
+            if (!used[ch]) continue;
+            MarkHit(hitPatterns, aget, ch);
+            for (uint32_t tb = 0; tb < Constants::num_tbs; tb++) {
+                PutPartialReadoutItem(items, aget, ch, tb, uint32_t(sampleDist(rng)));
+            }
+        }
+    }
+    return MakeFrame(0, 0, GRAWFrame::Expected_frameTypePartialReadout, GRAWFrame::Expected_itemSizePartialReadout,
+                     items, hitPatterns);
+}
+
+//! \brief The full-readout decoder from before samples were written straight into a trace block.
+static std::vector<GRAWDataItem> LegacyFullReadoutDecode(const RawFrame& raw)
+{
+    std::vector<GRAWDataItem> data;
+    const uint8_t* begin = raw.begin() + GRAWFrame::sizeUnit;
+    const uint8_t* end = raw.end();
+
+    std::vector<std::array<int16_t,34816>> dataArrays (4);
+    uint16_t i[4]={0,0,0,0};
+
+    for (auto rawFrameIter = begin; rawFrameIter != end; rawFrameIter += 2) {
+        uint16_t item = Utilities::ExtractByteSwappedInt<uint16_t>(rawFrameIter, rawFrameIter+2);
+        addr_t aget = GRAWFrame::ExtractAgetIdFullReadout(item);
+        sample_t sample = GRAWFrame::ExtractSampleFullReadout(item);
+        dataArrays.at(aget).at(i[aget]) = sample;
+        i[aget]++;
+    }
+
+    i[0]=0;i[1]=0;i[2]=0;i[3]=0;
+    for (addr_t aget = 0; aget < 4; aget++) {
+        for (tb_t tbid = 0; tbid < 512; tbid ++) {
+            for (addr_t channel = 0; channel < 68; channel++) {
+                auto sample = dataArrays.at(aget).at(i[aget]);
+                i[aget]++;
+                data.push_back(GRAWDataItem(aget,channel,tbid,sample));
+            }
+        }
+    }
+    return data;
+}
+
+template <typename Func>
+static void Time(const std::string& name, const RawFrame& raw, const int nFrames, Func decode)
+{
+    uint64_t checksum = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < nFrames; i++) {
+        checksum += decode(raw);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    double mb = double(raw.size()) * nFrames / (1024.0 * 1024.0);
+    std::cout << std::left << std::setw(10) << name
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << nFrames / seconds << " frames/s"
+              << std::setw(10) << mb / seconds << " MB/s"
+              << "   (checksum " << checksum << ")" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    int nFrames = 500;
+    int hitsPerAget = 8;
+    int repeat = 2;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg {argv[i]};
+        if (arg == "--frames" && i + 1 < argc) {
+            nFrames = std::stoi(argv[++i]);
+        }
+        else if (arg == "--hits" && i + 1 < argc) {
+            hitsPerAget = std::stoi(argv[++i]);
+        }
+        else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::stoi(argv[++i]);
+        }
+        else {
+            std::cerr << "usage: FrameDecodeBenchmark [--frames N] [--hits N] [--repeat N]" << std::endl;
+            return 1;
+        }
+    }
+
+    // A lookup table for the one AsAd the frames come from, in a temporary file
+    auto lookupPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+    {
+        std::ofstream csv (lookupPath.string());
+        for (int aget = 0; aget < Constants::num_agets; aget++)
+            for (int ch = 0; ch < Constants::num_channels; ch++)
+                csv << 0 << "," << 0 << "," << aget << "," << ch << "," << aget * Constants::num_channels + ch << "\n";
+    }
+    auto lookupTable = std::make_shared<PadLookupTable>(lookupPath.string());
+    boost::filesystem::remove(lookupPath);
+
+    std::mt19937 rng (42);
+    RawFrame fullFrame = MakeFullReadoutFrame(rng);
+    RawFrame partialFrame = MakePartialReadoutFrame(hitsPerAget, rng);
+
+    auto viewFrame = [] (const RawFrame& raw) {
+        GRAWFrameView view (raw);
+        size_t nHits = 0;
+        for (addr_t aget = 0; aget < Constants::num_agets; aget++) {
+            nHits += view.GetHitPattern(aget).count();
+        }
+        return nHits + view.eventId();
+    };
+    auto decodeFrame = [] (const RawFrame& raw) {
+        GRAWFrame frame (raw);
+        return frame.numItems();
+    };
+
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+    auto decodeAndAppend = [&evt] (const RawFrame& raw) {
+        evt.Clear();
+        GRAWFrame frame (raw);
+        evt.AppendFrame(frame);
+        return evt.numTraces();
+    };
+    DecodedItems scratch;
+    auto decodeFused = [&evt, &scratch] (const RawFrame& raw) {
+        evt.Clear();
+        evt.AppendRawFrame(GRAWFrameView(raw), scratch);
+        return evt.numTraces();
+    };
+
+    for (int pass = 0; pass < repeat; pass++) {
+        std::cout << "Full readout (" << fullFrame.size() << " bytes), pass " << pass << std::endl;
+        Time("legacy", fullFrame, nFrames, [] (const RawFrame& raw) { return LegacyFullReadoutDecode(raw).size(); });
+        Time("view", fullFrame, nFrames, viewFrame);
+        Time("frame", fullFrame, nFrames, decodeFrame);
+        Time("append", fullFrame, nFrames, decodeAndAppend);
+        Time("fused", fullFrame, nFrames, decodeFused);
+
+        std::cout << "Partial readout (" << partialFrame.size() << " bytes), pass " << pass << std::endl;
+        Time("view", partialFrame, nFrames, viewFrame);
+        Time("frame", partialFrame, nFrames, decodeFrame);
+        Time("append", partialFrame, nFrames, decodeAndAppend);
+        Time("fused", partialFrame, nFrames, decodeFused);
+    }
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Compares the filestream and memory-mapped GRAW readers.
+//
+// usage: GRAWReaderBenchmark [--repeat N] <file.graw> [<file.graw> ...]
+//
+// Each pass opens every file, reads all of its frames, and sums the bytes of each frame so that the
+// mapped reader actually has to touch the data it hands out. The first pass of each reader may be
+// dominated by the page cache being filled, so run with --repeat > 1 to see warm-cache numbers.
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "GRAWFile.h"
+#include "MappedGRAWFile.h"
+#include "GMExceptions.h"
+
+struct PassResult
+{
+    uint64_t nFrames = 0;
+    uint64_t nBytes = 0;
+    uint64_t checksum = 0;
+    double seconds = 0;
+};
+
+template <typename FileType>
+static PassResult ReadAllFrames(const std::vector<std::string>& paths)
+{
+    PassResult res;
+    auto begin = std::chrono::steady_clock::now();
+
+    for (const auto& path : paths) {
+        std::unique_ptr<GRAWFile> file (new FileType(path));
+        while (true) {
+            RawFrame frame;
+            try {
+                frame = file->ReadRawFrame();
+            }
+            catch (const std::exception&) {
+                break;
+            }
+
+            for (auto b : frame) res.checksum += b;
+            res.nFrames++;
+            res.nBytes += frame.size();
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    res.seconds = std::chrono::duration<double>(end - begin).count();
+    return res;
+}
+
+// The stream reader has a two-argument constructor, so wrap it to match the mapped one.
+class StreamGRAWFile : public GRAWFile
+{
+public:
+    StreamGRAWFile(const std::string& path) : GRAWFile(path, std::ios::in) {}
+};
+
+static void Report(const std::string& name, int pass, const PassResult& res)
+{
+    double mb = res.nBytes / (1024.0 * 1024.0);
+    std::cout << std::left << std::setw(8) << name
+              << " pass " << pass
+              << std::right << std::fixed << std::setprecision(3)
+              << std::setw(12) << res.nFrames << " frames"
+              << std::setw(12) << mb << " MB"
+              << std::setw(10) << res.seconds << " s"
+              << std::setw(12) << mb / res.seconds << " MB/s"
+              << std::setw(12) << res.nFrames / res.seconds << " frames/s"
+              << "   (checksum " << res.checksum << ")" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    int repeat = 3;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg {argv[i]};
+        if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::stoi(argv[++i]);
+        }
+        else {
+            paths.push_back(arg);
+        }
+    }
+
+    if (paths.empty()) {
+        std::cerr << "usage: GRAWReaderBenchmark [--repeat N] <file.graw> [<file.graw> ...]" << std::endl;
+        return 1;
+    }
+
+    for (int pass = 0; pass < repeat; pass++) {
+        Report("stream", pass, ReadAllFrames<StreamGRAWFile>(paths));
+        Report("mmap", pass, ReadAllFrames<MappedGRAWFile>(paths));
+    }
+
+    return 0;
+}
@@ -0,0 +1,339 @@
+// Measures how the HDF5 compression filters trade write throughput for file size.
+//
+// usage: HDFWriteBenchmark [--events N] [--asads N] [--hits N] [--chunk-traces N] [--threshold N]
+//                          [--layout per-event|table|sparse]
+//
+// Events are built from synthetic partial-readout frames, one per AsAd (--asads), each with the four FPN channels and
+// --hits other channels per AGET. Two kinds of samples are used:
+//
+//   uniform    every sample is uniformly random in 12 bits, which is about as incompressible as the data can be
+//   realistic  each channel has its own baseline plus a noise pattern shared by its AGET, and the hit channels have a
+//              pulse on top. The FPN is subtracted, as in the merger, which leaves most samples near zero.
+//              With --threshold, each channel's baseline is then subtracted as a pedestal and the samples below the
+//              threshold are zeroed, as graw2hdf --pedestals --threshold does. This is what the sparse layout is for.
+//
+// The pad numbers go up to about 11000, so n-bit packing is done with 15 bits to keep them intact.
+//
+// Before writing anything, the time taken just to serialize the events into rows is measured two ways:
+//
+//   arma + transpose  the way the writer used to do it: fill a column-major arma::Mat, then transpose it in place to
+//                     get HDF5's row-major order (a new matrix for every event)
+//   row-major         HDFDataStore::EventBatch, which writes each row in its final place, into a reused buffer
+//
+// For each set of filters, --events events are written to a temporary file. The throughput counts the bytes of the
+// uncompressed datasets in the dense layouts, and the ratio is that size divided by the size of the file.
+
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "Event.h"
+#include "GRAWFrame.h"
+#include "HDFDataStore.h"
+#include "PadLookupTable.h"
+#include "SyntheticFrames.h"
+
+//! \brief The parameters of the synthetic samples of one AsAd.
+struct SampleModel
+{
+    bool realistic;
+    std::vector<bool> hit;                   // [aget][channel]
+    std::vector<std::vector<double>> fpn;    // [aget][tb], the noise shared by every channel of the AGET
+    std::vector<double> baseline;            // [aget][channel]
+    std::vector<double> pulseTB;             // [aget][channel]
+    std::vector<double> pulseHeight;         // [aget][channel]
+};
+
+static SampleModel MakeModel(const bool realistic, const int hitsPerAget, std::mt19937& rng)
+{
+    const size_t numTraces = Constants::num_agets * Constants::num_channels;
+    std::uniform_int_distribution<int> chanDist (0, Constants::num_channels - 1);
+    std::uniform_real_distribution<double> baselineDist (200, 300);
+    std::uniform_real_distribution<double> tbDist (50, 450);
+    std::uniform_real_distribution<double> heightDist (100, 2000);
+    std::normal_distribution<double> fpnNoise (0, 8);
+
+    SampleModel model;
+    model.realistic = realistic;
+    model.hit.assign(numTraces, false);
+    model.baseline.resize(numTraces);
+    model.pulseTB.resize(numTraces);
+    model.pulseHeight.resize(numTraces);
+    model.fpn.assign(Constants::num_agets, std::vector<double>(Constants::num_tbs));
+
+    for (addr_t aget = 0; aget < Constants::num_agets; aget++) {
+        for (int ch : {11, 22, 45, 56}) model.hit[aget * Constants::num_channels + ch] = true;
+        for (int i = 0; i < hitsPerAget; i++) model.hit[aget * Constants::num_channels + chanDist(rng)] = true;
+        for (auto& val : model.fpn[aget]) val = fpnNoise(rng);
+    }
+    for (size_t i = 0; i < numTraces; i++) {
+        model.baseline[i] = baselineDist(rng);
+        model.pulseTB[i] = tbDist(rng);
+        model.pulseHeight[i] = heightDist(rng);
+    }
+    return model;
+}
+
+static uint32_t Sample(const SampleModel& model, const addr_t aget, const addr_t ch, const tb_t tb,
+                       std::mt19937& rng)
+{
+    if (!model.realistic) {
+        return std::uniform_int_distribution<uint32_t>(0, 4095)(rng);
+    }
+
+    const size_t idx = aget * Constants::num_channels + ch;
+    const bool isFpn = (ch == 11 || ch == 22 || ch == 45 || ch == 56);
+    double val = model.baseline[idx] + model.fpn[aget][tb] + std::normal_distribution<double>(0, 2)(rng);
+    if (!isFpn) {
+        const double dt = (tb - model.pulseTB[idx]) / 10.0;
+        val += model.pulseHeight[idx] * std::exp(-dt*dt);
+    }
+    return static_cast<uint32_t>(std::max(0.0, std::min(4095.0, val)));
+}
+
+static RawFrame MakeAsadFrame(const uint8_t cobo, const uint8_t asad, const SampleModel& model, std::mt19937& rng)
+{
+    std::vector<uint8_t> items;
+    std::vector<std::bitset<72>> hitPatterns (Constants::num_agets);
+    for (uint32_t aget = 0; aget < Constants::num_agets; aget++) {
+        for (uint32_t ch = 0; ch < Constants::num_channels; ch++) {
+            if (!model.hit[aget * Constants::num_channels + ch]) continue;
+            MarkHit(hitPatterns, aget, ch);
+            for (uint32_t tb = 0; tb < Constants::num_tbs; tb++) {
+                PutPartialReadoutItem(items, aget, ch, tb,
+                                      Sample(model, static_cast<addr_t>(aget), static_cast<addr_t>(ch),
+                                             static_cast<tb_t>(tb), rng));
+            }
+        }
+    }
+
+    return MakeFrame(cobo, asad, GRAWFrame::Expected_frameTypePartialReadout,
+                     GRAWFrame::Expected_itemSizePartialReadout, items, hitPatterns);
+}
+
+//! \brief Build a few distinct events of the given kind. The benchmark cycles through them.
+static std::vector<Event> MakeEvents(const bool realistic, const int nAsads, const int hitsPerAget,
+                                     const int threshold, const std::shared_ptr<PadLookupTable>& lookupTable,
+                                     std::mt19937& rng)
+{
+    const bool suppress = realistic && threshold > 0;
+
+    // Pedestals only make sense if each channel keeps its baseline from one event to the next
+    std::vector<std::vector<double>> baselines;
+    std::shared_ptr<LookupTable<sample_t>> pedestals;
+    if (suppress) {
+        auto pedsPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+        {
+            std::ofstream csv (pedsPath.string());
+            for (int i = 0; i < nAsads; i++) {
+                baselines.push_back(MakeModel(true, 0, rng).baseline);
+                for (addr_t aget = 0; aget < Constants::num_agets; aget++) {
+                    for (addr_t ch = 0; ch < Constants::num_channels; ch++) {
+                        csv << i / Constants::num_asads << "," << i % Constants::num_asads << "," << int(aget) << ","
+                            << int(ch) << "," << std::lround(baselines[i][aget * Constants::num_channels + ch])
+                            << "\n";
+                    }
+                }
+            }
+        }
+        pedestals = std::make_shared<LookupTable<sample_t>>(pedsPath.string());
+        boost::filesystem::remove(pedsPath);
+    }
+
+    std::vector<Event> events (8);
+    for (auto& evt : events) {
+        evt.SetLookupTable(lookupTable);
+        for (int i = 0; i < nAsads; i++) {
+            auto model = MakeModel(realistic, hitsPerAget, rng);
+            if (suppress) model.baseline = baselines[i];
+            auto cobo = static_cast<uint8_t>(i / Constants::num_asads);
+            auto asad = static_cast<uint8_t>(i % Constants::num_asads);
+            evt.AppendRawFrame(MakeAsadFrame(cobo, asad, model, rng));
+        }
+        if (realistic) evt.SubtractFPN();
+        if (suppress) {
+            evt.SubtractPedestals(*pedestals);
+            evt.ApplyThreshold(static_cast<sample_t>(threshold));
+        }
+    }
+    return events;
+}
+
+//! \brief The serialization HDFDataStore used before EventBatch.
+static size_t LegacySerialize(const Event& evt)
+{
+    const arma::uword nTraces = evt.numTraces();
+    const arma::uword nColumns = HDFDataStore::traceColumns;
+    arma::Mat<sample_t> dataMat (nTraces, nColumns);
+
+    arma::uword rowNumber = 0;
+    for (const auto& trace : evt) {
+        const HardwareAddress& addr = trace.first;
+        const arma::Col<sample_t>& tr = trace.second;
+
+        dataMat(rowNumber, 0) = addr.cobo;
+        dataMat(rowNumber, 1) = addr.asad;
+        dataMat(rowNumber, 2) = addr.aget;
+        dataMat(rowNumber, 3) = addr.channel;
+        dataMat(rowNumber, 4) = static_cast<sample_t>(addr.pad);
+
+        dataMat(rowNumber, arma::span(5, nColumns-1)) = tr.t();
+
+        rowNumber++;
+    }
+
+    arma::inplace_trans(dataMat);
+    return static_cast<size_t>(dataMat(0, 0)) + dataMat.n_elem;
+}
+
+template <typename Func>
+static void TimeSerialize(const std::string& name, const std::vector<Event>& events, const int nEvents, Func serialize)
+{
+    size_t checksum = 0;
+    double rawBytes = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < nEvents; i++) {
+        const Event& evt = events[static_cast<size_t>(i) % events.size()];
+        checksum += serialize(evt);
+        rawBytes += double(evt.numTraces()) * HDFDataStore::traceColumns * sizeof(sample_t);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::cout << std::left << std::setw(24) << name
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << rawBytes / (1024.0 * 1024.0) / seconds << " MB/s"
+              << std::setw(10) << nEvents / seconds << " events/s"
+              << "   (checksum " << checksum << ")" << std::endl;
+}
+
+static void Time(const std::string& name, const HDFWriteOptions& opts, std::vector<Event>& events, const int nEvents)
+{
+    auto path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.h5");
+
+    double rawBytes = 0;
+    auto begin = std::chrono::steady_clock::now();
+    {
+        HDFDataStore store (path.string(), true, opts);
+        for (int i = 0; i < nEvents; i++) {
+            Event& evt = events[static_cast<size_t>(i) % events.size()];
+            evt.eventId = static_cast<evtid_t>(i);
+            store.writeEvent(evt);
+            rawBytes += double(evt.numTraces()) * (Constants::num_tbs + 5) * sizeof(sample_t);
+        }
+    }  // the file is flushed and closed here
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    double fileBytes = static_cast<double>(boost::filesystem::file_size(path));
+    boost::filesystem::remove(path);
+
+    std::cout << std::left << std::setw(24) << name
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << rawBytes / (1024.0 * 1024.0) / seconds << " MB/s"
+              << std::setw(10) << fileBytes / (1024.0 * 1024.0) << " MB"
+              << std::setprecision(2) << std::setw(8) << rawBytes / fileBytes << "x" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    int nEvents = 200;
+    int nAsads = 10;
+    int hitsPerAget = 8;
+    hsize_t chunkTraces = HDFWriteOptions().chunkTraces;
+    int threshold = 0;
+    HDFLayout layout = HDFLayout::PerEvent;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg {argv[i]};
+        if (arg == "--events" && i + 1 < argc) {
+            nEvents = std::stoi(argv[++i]);
+        }
+        else if (arg == "--asads" && i + 1 < argc) {
+            nAsads = std::stoi(argv[++i]);
+        }
+        else if (arg == "--hits" && i + 1 < argc) {
+            hitsPerAget = std::stoi(argv[++i]);
+        }
+        else if (arg == "--chunk-traces" && i + 1 < argc) {
+            chunkTraces = std::stoull(argv[++i]);
+        }
+        else if (arg == "--threshold" && i + 1 < argc) {
+            threshold = std::stoi(argv[++i]);
+        }
+        else if (arg == "--layout" && i + 1 < argc) {
+            std::string name {argv[++i]};
+            layout = name == "table" ? HDFLayout::Table : name == "sparse" ? HDFLayout::Sparse : HDFLayout::PerEvent;
+        }
+        else {
+            std::cerr << "usage: HDFWriteBenchmark [--events N] [--asads N] [--hits N] [--chunk-traces N]"
+                      << " [--threshold N] [--layout per-event|table|sparse]" << std::endl;
+            return 1;
+        }
+    }
+
+    // A lookup table covering every channel, in a temporary file
+    auto lookupPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+    {
+        std::ofstream csv (lookupPath.string());
+        int pad = 0;
+        for (int cobo = 0; cobo < Constants::num_cobos; cobo++)
+            for (int asad = 0; asad < Constants::num_asads; asad++)
+                for (int aget = 0; aget < Constants::num_agets; aget++)
+                    for (int ch = 0; ch < Constants::num_channels; ch++)
+                        csv << cobo << "," << asad << "," << aget << "," << ch << "," << pad++ << "\n";
+    }
+    auto lookupTable = std::make_shared<PadLookupTable>(lookupPath.string());
+    boost::filesystem::remove(lookupPath);
+
+    std::vector<std::pair<std::string, HDFWriteOptions>> configs;
+    auto addConfig = [&configs, chunkTraces, layout] (const std::string& name, bool shuffle, unsigned deflate,
+                                               bool scaleOffset, unsigned nbit) {
+        HDFWriteOptions opts;
+        opts.layout = layout;
+        opts.chunkTraces = chunkTraces;
+        opts.shuffle = shuffle;
+        opts.deflateLevel = deflate;
+        opts.scaleOffset = scaleOffset;
+        opts.nbitPrecision = nbit;
+        configs.emplace_back(name, opts);
+    };
+    addConfig("none", false, 0, false, 0);
+    addConfig("deflate 1", false, 1, false, 0);
+    addConfig("shuffle + deflate 1", true, 1, false, 0);
+    addConfig("shuffle + deflate 6", true, 6, false, 0);
+    addConfig("scale-offset", false, 0, true, 0);
+    addConfig("scale-offset + deflate 1", false, 1, true, 0);
+    if (layout == HDFLayout::Sparse) {
+        // The dense layouts need all 16 bits for the pad numbers, so n-bit packing does nothing there
+        addConfig("nbit 13", false, 0, false, 13);
+        addConfig("nbit 13 + deflate 1", false, 1, false, 13);
+    }
+
+    std::mt19937 rng (42);
+    for (bool realistic : {false, true}) {
+        auto events = MakeEvents(realistic, nAsads, hitsPerAget, threshold, lookupTable, rng);
+        std::cout << (realistic ? "Realistic" : "Uniform") << " samples, " << events.front().numTraces()
+                  << " traces per event" << std::endl;
+
+        HDFDataStore::EventBatch batch;
+        TimeSerialize("arma + transpose", events, nEvents, LegacySerialize);
+        TimeSerialize("row-major", events, nEvents, [&batch] (const Event& evt) {
+            batch.clear();
+            batch.add(evt);
+            return static_cast<size_t>(batch.rows[0]) + batch.rows.size();
+        });
+
+        for (const auto& config : configs) {
+            Time(config.first, config.second, events, nEvents);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+// Compares pad lookups in the dense LookupTable with the hash table it replaced.
+//
+// usage: LookupTableBenchmark [--lookups N] [--loads N] [--repeat N]
+//
+// First, a lookup file covering every channel of the full detector is loaded --loads times each way:
+//
+//   legacy      the old parser, which reads each line with getline and converts each field with stoi
+//   csv         LookupTable's CSV parser
+//   cached      LookupTable with its binary cache, which is written by the first load
+//
+// Then the legacy table and a LookupTable loaded from the file each do --lookups lookups of addresses taken from one
+// of three lists:
+//
+//   sequential  every address in order, as the traces of a full-readout frame arrive
+//   random      every address in a random order
+//   missing     random addresses, a quarter of which aren't in the table or are out of range
+//
+//   legacy      std::unordered_map keyed by channel + aget*100 + asad*10000 + cobo*1000000
+//   dense       LookupTable, a flat array indexed by the packed address
+//
+// The checksums differ for the missing addresses: the legacy hash maps channels of 100 and up onto the next AGET's
+// channels, so some invalid addresses find a pad there.
+
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "PadLookupTable.h"
+
+//! \brief The hash-table lookup that LookupTable used to do, with the same file format.
+class LegacyLookupTable
+{
+public:
+    explicit LegacyLookupTable(const std::string& path)
+    {
+        std::ifstream file (path);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::stringstream lineStream (line);
+            std::string element;
+            std::array<int, 5> fields;
+            for (auto& field : fields) {
+                std::getline(lineStream, element, ',');
+                field = std::stoi(element);
+            }
+            table.emplace(CalculateHash(addr_t(fields[0]), addr_t(fields[1]), addr_t(fields[2]), addr_t(fields[3])),
+                          pad_t(fields[4]));
+        }
+    }
+
+    pad_t Find(addr_t cobo, addr_t asad, addr_t aget, addr_t channel) const
+    {
+        auto foundItem = table.find(CalculateHash(cobo, asad, aget, channel));
+        return foundItem != table.end() ? foundItem->second : missingValue;
+    }
+
+private:
+    static hash_t CalculateHash(addr_t cobo, addr_t asad, addr_t aget, addr_t channel)
+    {
+        return hash_t(channel) + hash_t(aget)*100 + hash_t(asad)*10000 + hash_t(cobo)*1000000;
+    }
+
+    std::unordered_map<hash_t, pad_t> table;
+    pad_t missingValue = 20000;
+};
+
+struct Address
+{
+    addr_t cobo, asad, aget, channel;
+};
+
+template <typename Func>
+static void TimeLoad(const std::string& name, const int nLoads, Func load)
+{
+    uint64_t checksum = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < nLoads; i++) {
+        checksum += load();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::cout << std::left << std::setw(10) << name
+              << std::right << std::fixed << std::setprecision(3)
+              << std::setw(10) << seconds * 1e3 / nLoads << " ms per load"
+              << "   (checksum " << checksum << ")" << std::endl;
+}
+
+template <typename Table>
+static void Time(const std::string& name, const Table& table, const std::vector<Address>& addrs, const size_t nLookups)
+{
+    uint64_t checksum = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nLookups; i++) {
+        const Address& addr = addrs[i % addrs.size()];
+        checksum += table.Find(addr.cobo, addr.asad, addr.aget, addr.channel);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::cout << std::left << std::setw(10) << name
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << nLookups / seconds / 1e6 << " M lookups/s"
+              << std::setw(8) << seconds * 1e9 / nLookups << " ns each"
+              << "   (checksum " << checksum << ")" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    size_t nLookups = 50000000;
+    int nLoads = 100;
+    int repeat = 2;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg {argv[i]};
+        if (arg == "--lookups" && i + 1 < argc) {
+            nLookups = std::stoull(argv[++i]);
+        }
+        else if (arg == "--loads" && i + 1 < argc) {
+            nLoads = std::stoi(argv[++i]);
+        }
+        else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::stoi(argv[++i]);
+        }
+        else {
+            std::cerr << "usage: LookupTableBenchmark [--lookups N] [--loads N] [--repeat N]" << std::endl;
+            return 1;
+        }
+    }
+
+    // A lookup table covering every channel, in a temporary file
+    std::vector<Address> sequential;
+    auto lookupPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+    {
+        std::ofstream csv (lookupPath.string());
+        int pad = 0;
+        for (int cobo = 0; cobo < Constants::num_cobos; cobo++)
+            for (int asad = 0; asad < Constants::num_asads; asad++)
+                for (int aget = 0; aget < Constants::num_agets; aget++)
+                    for (int ch = 0; ch < Constants::num_channels; ch++) {
+                        csv << cobo << "," << asad << "," << aget << "," << ch << "," << pad++ << "\n";
+                        sequential.push_back({addr_t(cobo), addr_t(asad), addr_t(aget), addr_t(ch)});
+                    }
+    }
+    const std::string lookupFile = lookupPath.string();
+
+    std::cout << "Loading the lookup table" << std::endl;
+    TimeLoad("legacy", nLoads, [&lookupFile] { return LegacyLookupTable(lookupFile).Find(9, 3, 3, 67); });
+    TimeLoad("csv", nLoads, [&lookupFile] { return PadLookupTable(lookupFile).Find(9, 3, 3, 67); });
+    TimeLoad("cached", nLoads, [&lookupFile] {
+        return PadLookupTable(lookupFile, LookupTableGeometry(), true).Find(9, 3, 3, 67);
+    });
+
+    PadLookupTable dense (lookupFile);
+    LegacyLookupTable legacy (lookupFile);
+    boost::filesystem::remove(lookupPath);
+    boost::filesystem::remove(LookupTableFile::CachePath(lookupFile));
+
+    std::mt19937 rng (42);
+    std::vector<Address> random = sequential;
+    std::shuffle(random.begin(), random.end(), rng);
+
+    std::vector<Address> missing = random;
+    std::uniform_int_distribution<int> byteDist (0, 255);
+    for (size_t i = 0; i < missing.size(); i += 4) {
+        missing[i].channel = addr_t(Constants::num_channels + byteDist(rng) % 60);
+        if (i % 8 == 0) missing[i].cobo = addr_t(byteDist(rng));
+    }
+
+    for (int pass = 0; pass < repeat; pass++) {
+        for (const auto& pattern : {std::make_pair("sequential", &sequential), std::make_pair("random", &random),
+                                    std::make_pair("missing", &missing)}) {
+            std::cout << pattern.first << " addresses, pass " << pass << std::endl;
+            Time("legacy", legacy, *pattern.second, nLookups);
+            Time("dense", dense, *pattern.second, nLookups);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+// Compares the lock-free SyncQueue with the list-based queue it replaced.
+//
+// usage: QueueBenchmark [--items N] [--capacity N] [--batch N] [--repeat N]
+//
+// For each combination of producer and consumer counts, the producers push N items in total through the queue and
+// the consumers pull them out until the queue is finished. Two payloads are used: a plain integer, which measures the
+// queue overhead alone, and a RawFrame wrapping a 1 kB buffer, which is closer to what the merger actually moves.
+//
+// The "batch" rows use the same ring queue, but move items with putBatch and getBatch in groups of --batch items.
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <list>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include "SyncQueue.h"
+#include "RawFrame.h"
+
+// The previous implementation of SyncQueue, kept here as the baseline.
+template<typename T>
+class ListSyncQueue {
+public:
+    explicit ListSyncQueue(const size_t capacity) : capacity(capacity), finished(false) {}
+
+    void put(T&& task)
+    {
+        std::unique_lock<std::mutex> lock(qmtx);
+        cond.wait(lock, [this]{ return q.size() < capacity; });
+        q.push_back(std::move(task));
+        cond.notify_all();
+    }
+
+    void get(T& dest)
+    {
+        std::unique_lock<std::mutex> lock(qmtx);
+        cond.wait(lock, [this]{ return !q.empty() || finished; });
+        if (finished) throw NoMoreTasks();
+        dest = std::move(q.front());
+        q.pop_front();
+        cond.notify_all();
+    }
+
+    void finish()
+    {
+        std::unique_lock<std::mutex> lock {qmtx};
+        cond.wait(lock, [this]{ return q.empty(); });
+        finished = true;
+        cond.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::mutex qmtx;
+    std::condition_variable cond;
+    std::list<T> q;
+    bool finished;
+};
+
+struct IntPayload
+{
+    static int64_t Make(const uint64_t i) { return static_cast<int64_t>(i); }
+    static uint64_t Check(const int64_t& v) { return static_cast<uint64_t>(v); }
+};
+
+struct FramePayload
+{
+    static const size_t frameSize = 1024;
+
+    static RawFrame Make(const uint64_t i)
+    {
+        RawFrame fr (frameSize);
+        *fr.getWritablePointer() = static_cast<uint8_t>(i);
+        return fr;
+    }
+
+    static uint64_t Check(const RawFrame& fr) { return fr.size() ? *fr.begin() : 0; }
+};
+
+struct RunResult
+{
+    double seconds = 0;
+    uint64_t received = 0;
+};
+
+template <template <typename> class Queue, typename Payload>
+static RunResult Run(const unsigned nProducers, const unsigned nConsumers, const uint64_t nItems, const size_t capacity)
+{
+    using T = decltype(Payload::Make(0));
+    Queue<T> queue (capacity);
+    std::atomic<uint64_t> received {0};
+
+    auto begin = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> consumers;
+    for (unsigned c = 0; c < nConsumers; c++) {
+        consumers.emplace_back([&] {
+            uint64_t count = 0;
+            T item;
+            while (true) {
+                try {
+                    queue.get(item);
+                }
+                catch (const NoMoreTasks&) {
+                    break;
+                }
+                Payload::Check(item);
+                count++;
+            }
+            received += count;
+        });
+    }
+
+    std::vector<std::thread> producers;
+    for (unsigned p = 0; p < nProducers; p++) {
+        producers.emplace_back([&, p] {
+            for (uint64_t i = p; i < nItems; i += nProducers) {
+                queue.put(Payload::Make(i));
+            }
+        });
+    }
+
+    for (auto& thr : producers) thr.join();
+    queue.finish();
+    for (auto& thr : consumers) thr.join();
+
+    auto end = std::chrono::steady_clock::now();
+
+    RunResult res;
+    res.seconds = std::chrono::duration<double>(end - begin).count();
+    res.received = received;
+    return res;
+}
+
+template <typename Payload>
+static RunResult RunBatched(const unsigned nProducers, const unsigned nConsumers, const uint64_t nItems,
+                            const size_t capacity, const size_t batchSize)
+{
+    using T = decltype(Payload::Make(0));
+    SyncQueue<T> queue (capacity);
+    std::atomic<uint64_t> received {0};
+
+    auto begin = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> consumers;
+    for (unsigned c = 0; c < nConsumers; c++) {
+        consumers.emplace_back([&] {
+            uint64_t count = 0;
+            std::vector<T> items;
+            while (true) {
+                try {
+                    queue.getBatch(items, batchSize);
+                }
+                catch (const NoMoreTasks&) {
+                    break;
+                }
+                for (const auto& item : items) {
+                    Payload::Check(item);
+                }
+                count += items.size();
+            }
+            received += count;
+        });
+    }
+
+    std::vector<std::thread> producers;
+    for (unsigned p = 0; p < nProducers; p++) {
+        producers.emplace_back([&, p] {
+            std::vector<T> items;
+            for (uint64_t i = p; i < nItems; i += nProducers) {
+                items.push_back(Payload::Make(i));
+                if (items.size() == batchSize) {
+                    queue.putBatch(items);
+                }
+            }
+            queue.putBatch(items);
+        });
+    }
+
+    for (auto& thr : producers) thr.join();
+    queue.finish();
+    for (auto& thr : consumers) thr.join();
+
+    auto end = std::chrono::steady_clock::now();
+
+    RunResult res;
+    res.seconds = std::chrono::duration<double>(end - begin).count();
+    res.received = received;
+    return res;
+}
+
+static void Report(const std::string& queueName, const std::string& payloadName, const unsigned nProducers,
+                   const unsigned nConsumers, const uint64_t nItems, const RunResult& res)
+{
+    std::cout << std::left << std::setw(8) << queueName << std::setw(8) << payloadName
+              << std::right << nProducers << "P/" << nConsumers << "C"
+              << std::fixed << std::setprecision(3)
+              << std::setw(10) << res.seconds << " s"
+              << std::setw(12) << res.received / res.seconds / 1e6 << " Mitems/s";
+    if (res.received != nItems) {
+        std::cout << "   LOST " << nItems - res.received << " ITEMS";
+    }
+    std::cout << std::endl;
+}
+
+template <typename Payload>
+static void RunAll(const std::string& payloadName, const uint64_t nItems, const size_t capacity, const size_t batchSize,
+                   const int repeat)
+{
+    const std::vector<std::pair<unsigned, unsigned>> configs {{1, 1}, {4, 1}, {1, 4}, {4, 4}, {10, 1}};
+
+    for (const auto& cfg : configs) {
+        for (int pass = 0; pass < repeat; pass++) {
+            Report("list", payloadName, cfg.first, cfg.second, nItems,
+                   Run<ListSyncQueue, Payload>(cfg.first, cfg.second, nItems, capacity));
+            Report("ring", payloadName, cfg.first, cfg.second, nItems,
+                   Run<SyncQueue, Payload>(cfg.first, cfg.second, nItems, capacity));
+            Report("batch", payloadName, cfg.first, cfg.second, nItems,
+                   RunBatched<Payload>(cfg.first, cfg.second, nItems, capacity, batchSize));
+        }
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    uint64_t nItems = 1000000;
+    size_t capacity = 100;
+    size_t batchSize = 16;
+    int repeat = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg {argv[i]};
+        if (arg == "--items" && i + 1 < argc) {
+            nItems = std::stoull(argv[++i]);
+        }
+        else if (arg == "--capacity" && i + 1 < argc) {
+            capacity = std::stoul(argv[++i]);
+        }
+        else if (arg == "--batch" && i + 1 < argc) {
+            batchSize = std::stoul(argv[++i]);
+        }
+        else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::stoi(argv[++i]);
+        }
+        else {
+            std::cerr << "usage: QueueBenchmark [--items N] [--capacity N] [--batch N] [--repeat N]" << std::endl;
+            return 1;
+        }
+    }
+
+    RunAll<IntPayload>("int", nItems, capacity, batchSize, repeat);
+    RunAll<FramePayload>("frame", nItems / 4, capacity, batchSize, repeat);
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+// Builds synthetic GRAW frames in memory for the benchmarks.
+
+#ifndef SYNTHETICFRAMES_H
+#define SYNTHETICFRAMES_H
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+#include "GRAWFrame.h"
+#include "RawFrame.h"
+#include "Constants.h"
+
+//! \brief Append the lowest `nBytes` bytes of `val` to `buf`, most significant first.
+inline void PutBE(std::vector<uint8_t>& buf, const uint64_t val, const int nBytes)
+{
+    for (int i = nBytes - 1; i >= 0; i--) {
+        buf.push_back(static_cast<uint8_t>(val >> (8*i)));
+    }
+}
+
+//! \brief Append one partial-readout data item to `buf`.
+inline void PutPartialReadoutItem(std::vector<uint8_t>& buf, const uint32_t aget, const uint32_t ch, const uint32_t tb,
+                                  const uint32_t sample)
+{
+    PutBE(buf, (aget << 30) | (ch << 23) | (tb << 14) | sample, 4);
+}
+
+//! \brief Mark a channel as hit in a frame's hit patterns, which have one bitset per AGET.
+inline void MarkHit(std::vector<std::bitset<72>>& hitPatterns, const uint32_t aget, const uint32_t ch)
+{
+    hitPatterns.resize(std::max<size_t>(hitPatterns.size(), Constants::num_agets));
+    hitPatterns[aget].set(67 - ch);  // channel 0 is the lowest bit of the last byte read, after 4 unused bits
+}
+
+/** \brief Wrap the given items (already encoded) in a frame header.
+ *
+ *  The frame comes from the given CoBo and AsAd, and has event ID 1. If `hitPatterns` is empty, the hit patterns
+ *  and multiplicities are left as zeros.
+ */
+inline RawFrame MakeFrame(const uint8_t cobo, const uint8_t asad, const uint16_t frameType, const uint16_t itemSize,
+                          const std::vector<uint8_t>& items, const std::vector<std::bitset<72>>& hitPatterns = {})
+{
+    const size_t unit = GRAWFrame::sizeUnit;
+    const size_t frameUnits = (unit + items.size() + unit - 1) / unit;
+
+    std::vector<uint8_t> buf;
+    buf.reserve(frameUnits * unit);
+    PutBE(buf, GRAWFrame::Expected_metaType, 1);
+    PutBE(buf, frameUnits, 3);
+    PutBE(buf, 0, 1);
+    PutBE(buf, frameType, 2);
+    PutBE(buf, 5, 1);
+    PutBE(buf, GRAWFrame::Expected_headerSize, 2);
+    PutBE(buf, itemSize, 2);
+    PutBE(buf, items.size() / itemSize, 4);
+    PutBE(buf, 1000, 6);  // event time
+    PutBE(buf, 1, 4);     // event ID
+    PutBE(buf, cobo, 1);
+    PutBE(buf, asad, 1);
+    PutBE(buf, 0, 2);     // read offset
+    PutBE(buf, 0, 1);     // status
+    for (const auto& pattern : hitPatterns) {
+        for (int byte = 8; byte >= 0; byte--) {
+            PutBE(buf, ((pattern >> (8*byte)) & std::bitset<72>(0xFF)).to_ulong(), 1);
+        }
+    }
+    for (const auto& pattern : hitPatterns) PutBE(buf, pattern.count(), 2);
+    buf.resize(unit, 0);  // the rest of the header
+    buf.insert(buf.end(), items.begin(), items.end());
+    buf.resize(frameUnits * unit, 0);
+
+    RawFrame raw (buf.size());
+    std::copy(buf.begin(), buf.end(), raw.getWritablePointer());
+    return raw;
+}
+
+#endif /* end of include guard: SYNTHETICFRAMES_H */
@@ -115,7 +115,7 @@ public:
     //! \brief Check if the end of the file has been reached.
     virtual bool eof() const;
 
-    bool is_open() const;
+    virtual bool is_open() const;
 
     //! \brief Returns the current file position.
     virtual std::streamoff GetPosition();
@@ -123,6 +123,9 @@ public:
     //! \brief Returns the filename.
     virtual const std::string GetFilename() const;
 
+    //! \brief Returns the full path to the file.
+    const boost::filesystem::path& GetPath() const { return filePath; }
+
 protected:
     /** \brief The path to the file.
 
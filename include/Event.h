@@ -5,11 +5,16 @@
 #include <vector>
 #include "Constants.h"
 #include "GRAWFrame.h"
+#include "GRAWFrameView.h"
+#include "ItemDecoder.h"
 #include "GRAWDataItem.h"
 #include "LookupTable.h"
 #include "PadLookupTable.h"
 #include "GMExceptions.h"
-#include <unordered_map>
+#include <array>
+#include <iterator>
+#include <cstddef>
+#include <utility>
 #include <cmath>
 #include "Utilities.h"
 #include "HardwareAddress.h"
@@ -21,11 +26,75 @@
 
  This class represents a single event from the DAQ. It is created initially by merging together corresponding frames from the GRAW files.
 
+ The samples are stored densely. Each AsAd that contributes to the event gets one block holding room for every channel
+ of its four AGETs, along with a bitmap of which channels are present and the pad number of each channel. The blocks
+ live in a single vector, so building an event takes one allocation if Reserve is called first, instead of one per
+ trace. A small table maps each (CoBo, AsAd) pair to its block.
+
+ Iterating over the event visits the traces that are present, in hardware address order. Each element is a pair of
+ the HardwareAddress and an `arma::Col<sample_t>` that refers directly to the samples in the event, so modifying it
+ modifies the event.
+
  */
 class Event
 {
+private:
+    static const size_t tracesPerAsad = Constants::num_agets * Constants::num_channels;
+    static const size_t presenceWords = (tracesPerAsad + 63) / 64;
+    static const size_t numAsadSlots = Constants::num_cobos * Constants::num_asads;
+    static const uint8_t noBlock = 0xFF;
+
+    static_assert(std::tuple_size<HitMask>::value == presenceWords, "A HitMask must line up with a block's bitmap");
+
+    //! \brief The storage for one AsAd. Traces are indexed by `aget*num_channels + channel`.
+    struct AsadBlock
+    {
+        uint64_t present[presenceWords];
+        pad_t pads[tracesPerAsad];
+        sample_t samples[tracesPerAsad * Constants::num_tbs];
+    };
+
 public:
-    using mapType = std::unordered_map<HardwareAddress, arma::Col<sample_t>>;
+    //! \brief Iterates over the traces present in an event. `ColT` is `arma::Col<sample_t>`, possibly const.
+    template <typename EventT, typename ColT>
+    class TraceIterator
+    {
+    public:
+        using value_type = std::pair<HardwareAddress, ColT>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+        using iterator_category = std::input_iterator_tag;
+
+        TraceIterator(EventT* evt, const size_t slot) : evt(evt), slot(slot) { skipAbsent(); }
+
+        //! \brief Returns the address and a view of the samples of the current trace.
+        value_type operator*() const;
+
+        //! \brief Holds the value for `operator->`, since there is no stored pair to point to.
+        struct ArrowProxy
+        {
+            value_type value;
+            value_type* operator->() { return &value; }
+        };
+
+        ArrowProxy operator->() const { return ArrowProxy {**this}; }
+
+        TraceIterator& operator++() { slot++; skipAbsent(); return *this; }
+        TraceIterator operator++(int) { TraceIterator old {*this}; ++(*this); return old; }
+
+        bool operator==(const TraceIterator& other) const { return slot == other.slot; }
+        bool operator!=(const TraceIterator& other) const { return slot != other.slot; }
+
+    private:
+        void skipAbsent();
+
+        EventT* evt;
+        size_t slot;  // (cobo*num_asads + asad)*tracesPerAsad + aget*num_channels + channel
+    };
+
+    using iterator = TraceIterator<Event, arma::Col<sample_t>>;
+    using const_iterator = TraceIterator<const Event, const arma::Col<sample_t>>;
 
     // Construction of Events
 
@@ -44,10 +113,29 @@ public:
     //! \brief Move operator
     Event& operator=(Event&& orig);
 
-    mapType::iterator begin();
-    mapType::iterator end();
-    mapType::const_iterator cbegin() const;
-    mapType::const_iterator cend() const;
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+
+    /** \brief Remove all traces and reset the header fields, keeping the allocated storage for reuse.
+
+     The lookup table pointer is kept as well.
+
+     */
+    void Clear();
+
+    /** \brief Reserve storage for the given number of AsAds.
+
+     If this is at least the number of AsAds that end up in the event, the storage is allocated exactly once.
+
+     */
+    void Reserve(const size_t numAsads);
+
+    //! \brief The memory each AsAd in an event takes, in bytes.
+    static size_t BytesPerAsad() { return sizeof(AsadBlock); }
 
     // Setting properties
 
@@ -64,16 +152,53 @@ public:
 
      The frame should be initialized and filled with data before appending it to the event. This function should be called for each frame that composes the event. The event time and event ID will be checked for each frame. If no frames have been appended to the Event yet, then the event time and event ID will be set by the first frame to be appended. If the time or ID do not match on subsequent frames, an error message will be printed.
 
+     For partial readout, the channels marked in the frame's hit patterns are added to the event, with their pads,
+     before any samples are copied, so the copying doesn't have to check each item's channel. Afterwards, channels
+     that turned out to have no data are removed again, and channels with data that the hit patterns left out are
+     added, so the event holds exactly the channels with data either way.
+
+     \return The number of channels where the hit patterns and the data disagreed.
+
+     */
+    HitPatternMismatch AppendFrame(const GRAWFrame& frame);
+
+    /** \brief Decode a raw frame and append it to the event.
+
+     The result is the same as `AppendFrame(GRAWFrame(rawFrame))`, but only the header is parsed into a view, and
+     the data items are decoded with ItemDecoder into a scratch buffer instead of a full GRAWFrame. Full-readout
+     items are decoded straight into the event's storage.
+
+     \throws Exceptions::Bad_Data If the frame is too short, or comes from outside the detector geometry.
+
+     */
+    HitPatternMismatch AppendRawFrame(const RawFrame& rawFrame);
+
+    //! \brief The same, for a frame that already has a view. The frame's RawFrame must still exist.
+    HitPatternMismatch AppendRawFrame(const GRAWFrameView& frame);
+
+    /** \brief The same, decoding the items into `scratch`.
+
+     Passing the same scratch buffer for every frame saves allocating a new one each time. Its contents are replaced.
+
      */
-    void AppendFrame(const GRAWFrame& frame);
+    HitPatternMismatch AppendRawFrame(const GRAWFrameView& frame, DecodedItems& scratch);
 
     // Getting properties and members
 
     /** \brief Get the Trace for the given set of parameters.
 
+     The returned vector refers to the samples stored in the event, so changes to it change the event. Note that
+     copying it (e.g. with `auto tr = GetTrace(...)`) makes an independent copy of the samples.
+
      \throws std::out_of_range if the trace is not present in the event.
      */
-    arma::Col<sample_t>& GetTrace(addr_t cobo, addr_t asad, addr_t aget, addr_t channel);
+    arma::Col<sample_t> GetTrace(addr_t cobo, addr_t asad, addr_t aget, addr_t channel);
+
+    //! \brief Returns true if the event contains the given trace.
+    bool HasTrace(addr_t cobo, addr_t asad, addr_t aget, addr_t channel) const;
+
+    //! \brief Remove a trace from the event. Nothing happens if the trace is not present.
+    void RemoveTrace(addr_t cobo, addr_t asad, addr_t aget, addr_t channel);
 
     // Manipulations of contained data
 
@@ -93,21 +218,31 @@ public:
 
      After this process, the FPN channels are deleted from the event. This reduces the size of the output file substantially.
 
+     The work is done directly on each AsAd's block, using its bitmap to find the traces that are present, and the
+     arithmetic is done on whole traces at once with the functions in TraceKernels. AGETs without any FPN channels are
+     left alone.
+
      \endrst
 
      */
     void SubtractFPN();
 
-    //! \brief Subtract precomputed pedestal values from each trace in the event.
+    /** \brief Subtract precomputed pedestal values from each trace in the event.
+
+     Every sample of a trace has its channel's pedestal subtracted. Channels missing from the table have a pedestal of
+     `pedsTable.missingValue`.
+
+     */
     void SubtractPedestals(const LookupTable<sample_t>& pedsTable);
 
     /** \brief Applies the provided threshold to the traces in the event.
 
-    Any sample that is less than the threshold is set to zero.
+    Any sample that is less than the threshold is set to zero. The traces are kept, even if every sample is zeroed.
 
     */
     void ApplyThreshold(const sample_t threshold);
 
+    //! \brief The number of traces present in the event.
     size_t numTraces() const;
 
 
@@ -137,12 +272,133 @@ private:
 
     int nFramesAppended;  // The number of frames appended to this event
 
-    // Traces for each pad
+    // Trace storage
+
+    //! \brief Returns the block for the given AsAd, or nullptr if it has none. The address must be in range.
+    AsadBlock* FindBlock(const addr_t cobo, const addr_t asad);
+    const AsadBlock* FindBlock(const addr_t cobo, const addr_t asad) const;
+
+    //! \brief Returns the block for the given AsAd, adding one if needed.
+    AsadBlock& GetOrAddBlock(const addr_t cobo, const addr_t asad);
+
+    //! \brief Check a frame's header against the event, and return the block its data goes in.
+    AsadBlock& BeginFrame(const GRAWFrameHeader& header);
 
-    std::unordered_map<HardwareAddress, arma::Col<sample_t>> data;
+    /** \brief Mark a trace as present, looking up its pad if it wasn't already.
+
+     \return The index of the trace within the block.
+
+     */
+    size_t MarkPresent(AsadBlock& block, const addr_t cobo, const addr_t asad, const addr_t aget, const addr_t channel)
+    {
+        const size_t idx = aget * Constants::num_channels + channel;
+        uint64_t& presentWord = block.present[idx / 64];
+        const uint64_t presentBit = uint64_t(1) << (idx % 64);
+        if (!(presentWord & presentBit)) {
+            presentWord |= presentBit;
+            block.pads[idx] = lookupTable->Find(cobo, asad, aget, channel);
+            nTraces++;
+        }
+        return idx;
+    }
+
+    //! \brief Returns true if the trace with the given index is present in the block.
+    static bool IsPresent(const AsadBlock& block, const size_t idx)
+    {
+        return (block.present[idx / 64] >> (idx % 64)) & 1;
+    }
+
+    //! \brief Remove the trace with the given index from the block, if it is present.
+    void RemoveFromBlock(AsadBlock& block, const size_t idx);
+
+    /** \brief Mark the channels in a hit mask as present, looking up the pads of the ones that weren't.
+
+     \return Which traces of the block were present before.
+
+     */
+    HitMask MarkHitChannels(AsadBlock& block, const addr_t cobo, const addr_t asad, const HitMask& hits);
+
+    /** \brief Copy a partial-readout frame's decoded items into the block.
+
+     The channels in the hit mask are marked first, so each item can be copied without checking its channel, and then
+     the traces are reconciled with the channels that had data.
+
+     */
+    HitPatternMismatch AppendItems(AsadBlock& block, const addr_t cobo, const addr_t asad, const DecodedItems& items,
+                                   const HitMask& hits);
+
+    /** \brief Make the block's traces match the channels that a frame actually had data for.
+
+     Channels that were added for the hit mask but got no data are removed, and channels that got data without being
+     in the hit mask are added. Their samples were already written, since every slot of a block has room for them.
+
+     \param before The traces that were present before the frame, as returned by MarkHitChannels.
+     \param found The channels that the frame had data items for.
+
+     */
+    HitPatternMismatch ReconcileHitChannels(AsadBlock& block, const addr_t cobo, const addr_t asad,
+                                            const HitMask& hits, const HitMask& before, const HitMask& found);
+
+    //! \brief Mark every trace of an AsAd as present, as for a full-readout frame.
+    void MarkAllPresent(AsadBlock& block, const addr_t cobo, const addr_t asad);
+
+    //! \brief Returns true if the given address is within the geometry of the detector.
+    static bool AddressIsValid(const addr_t cobo, const addr_t asad, const addr_t aget, const addr_t channel);
+
+    std::array<uint8_t, numAsadSlots> blockIndex;  // Index in `blocks` for each (cobo, asad), or noBlock
+    std::vector<AsadBlock> blocks;
+    size_t nTraces;
 
     friend class EventFile;
     friend class EventTestFixture;
 };
 
+template <typename EventT, typename ColT>
+void Event::TraceIterator<EventT, ColT>::skipAbsent()
+{
+    const size_t endSlot = numAsadSlots * tracesPerAsad;
+    while (slot < endSlot) {
+        const size_t asadSlot = slot / tracesPerAsad;
+        const uint8_t blockNum = evt->blockIndex[asadSlot];
+        if (blockNum == noBlock) {
+            slot = (asadSlot + 1) * tracesPerAsad;  // skip the whole AsAd
+            continue;
+        }
+
+        const size_t idx = slot % tracesPerAsad;
+        const uint64_t word = evt->blocks[blockNum].present[idx / 64] >> (idx % 64);
+        if (word != 0) {
+            // Jump to the next present trace in this word. The unused bits past the last channel are never set.
+            slot += static_cast<size_t>(__builtin_ctzll(word));
+            return;
+        }
+
+        // Go on to the next word, or to the next AsAd after the last word
+        slot += 64 - (idx % 64);
+        if (slot > (asadSlot + 1) * tracesPerAsad) {
+            slot = (asadSlot + 1) * tracesPerAsad;
+        }
+    }
+    slot = endSlot;
+}
+
+template <typename EventT, typename ColT>
+typename Event::TraceIterator<EventT, ColT>::value_type Event::TraceIterator<EventT, ColT>::operator*() const
+{
+    const size_t asadSlot = slot / tracesPerAsad;
+    const size_t idx = slot % tracesPerAsad;
+    auto& block = evt->blocks[evt->blockIndex[asadSlot]];
+
+    HardwareAddress addr;
+    addr.cobo = static_cast<addr_t>(asadSlot / Constants::num_asads);
+    addr.asad = static_cast<addr_t>(asadSlot % Constants::num_asads);
+    addr.aget = static_cast<addr_t>(idx / Constants::num_channels);
+    addr.channel = static_cast<addr_t>(idx % Constants::num_channels);
+    addr.pad = block.pads[idx];
+
+    // The column aliases the event's memory. For a const event, the column itself is const.
+    sample_t* samples = const_cast<sample_t*>(block.samples + idx * Constants::num_tbs);
+    return value_type(addr, arma::Col<sample_t>(samples, Constants::num_tbs, false, true));
+}
+
 #endif /* defined(EVENT_H) */
@@ -0,0 +1,52 @@
+#ifndef EVENTIDWINDOW_H
+#define EVENTIDWINDOW_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "Constants.h"
+
+/** \brief A compact record of which event IDs have been finished.
+
+ Event IDs arrive almost in order, so instead of remembering every finished ID, this keeps a low watermark and a ring
+ bitmap covering a window of `width` IDs starting at the watermark. Every ID below the watermark is finished. The
+ watermark moves up past IDs as soon as they're finished, so the bitmap only has to cover IDs that are finished out of
+ order. Memory use is fixed at `width` bits, and both insert and contains are constant time (amortized, for insert).
+
+ If an ID at or beyond the end of the window is inserted, the window slides up to include it. Any IDs that fall below
+ the watermark as a result are treated as finished, even if they never were. With a window much wider than the spread
+ of events in flight, such IDs are far too old to still be arriving.
+
+ */
+class EventIdWindow
+{
+public:
+    //! \brief Create a window covering at least `width` IDs. The width is rounded up to a power of two (min 64).
+    explicit EventIdWindow(const size_t width = 65536);
+
+    //! \brief Mark an event ID as finished.
+    void insert(const evtid_t id);
+
+    //! \brief Returns true if the event ID was finished (or is below the watermark).
+    bool contains(const evtid_t id) const;
+
+    //! \brief The lowest ID that is not known to be finished.
+    uint64_t lowWatermark() const { return low; }
+
+    //! \brief The number of IDs covered by the bitmap.
+    size_t width() const { return mask + 1; }
+
+private:
+    bool testBit(const uint64_t id) const { return (bits[(id & mask) >> 6] >> (id & 63)) & 1; }
+    void setBit(const uint64_t id) { bits[(id & mask) >> 6] |= uint64_t(1) << (id & 63); }
+    void clearBit(const uint64_t id) { bits[(id & mask) >> 6] &= ~(uint64_t(1) << (id & 63)); }
+
+    //! \brief Move the watermark past any finished IDs at the bottom of the window.
+    void advanceWatermark();
+
+    std::vector<uint64_t> bits;
+    uint64_t mask;
+    uint64_t low;  // 64 bits so low + width can't overflow
+};
+
+#endif /* end of include guard: EVENTIDWINDOW_H */
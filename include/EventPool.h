@@ -0,0 +1,42 @@
+#ifndef EVENTPOOL_H
+#define EVENTPOOL_H
+
+#include <atomic>
+#include <memory>
+#include "Event.h"
+#include "SyncQueue.h"
+
+/** \brief A pool of Event objects whose storage is reused from one event to the next.
+
+ Events are large, so rather than allocating new storage for each one and freeing it after it's written, the writer
+ gives finished events back to the pool and the builder takes them out again. The pool holds at most `capacity`
+ spare events. Events released while it's full are simply destroyed, and acquire makes a new event when it's empty,
+ so the pool never blocks.
+
+ The pool is safe to use from several threads at once.
+
+ */
+class EventPool
+{
+public:
+    explicit EventPool(const size_t capacity);
+
+    //! \brief Returns an empty event, reusing the storage of a released event if there is one.
+    Event acquire();
+
+    //! \brief Give an event back to the pool once it is no longer needed.
+    void release(Event&& evt);
+
+    //! \brief The number of times acquire had to make a new event.
+    uint64_t numCreated() const { return created.load(); }
+
+    //! \brief The number of times acquire reused a released event.
+    uint64_t numReused() const { return reused.load(); }
+
+private:
+    SyncQueue<Event> spares;
+    std::atomic<uint64_t> created;
+    std::atomic<uint64_t> reused;
+};
+
+#endif /* end of include guard: EVENTPOOL_H */
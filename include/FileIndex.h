@@ -3,23 +3,125 @@
 
 #include <vector>
 #include <map>
+#include <set>
 #include <memory>
 #include <algorithm>
+#include <boost/filesystem.hpp>
 #include "GRAWFile.h"
 #include "Constants.h"
 
+/** \brief An index of every frame in a set of GRAW files.
+
+ The index records the event ID, event time, position, size, CoBo, and AsAd of each frame in each file. This lets the
+ merger seek directly to the frames that make up an event instead of reading the files blindly.
+
+ Scanning the frame headers of a large run takes a while, so the index of each file is saved in a sidecar file next to
+ it (the same path with the extension `.gidx`). On later runs, the sidecar is used instead of scanning the file as long
+ as the size and modification time of the GRAW file still match the values recorded in the sidecar.
+
+ */
 class FileIndex
 {
 public:
+    //! \brief The frames in one file, in the order they appear in the file.
+    using FrameList = std::vector<GRAWFile::FrameMetadata>;
+
+    //! \brief The location of a single frame.
+    struct FrameLocation
+    {
+        std::shared_ptr<GRAWFile> file;
+        GRAWFile::FrameMetadata meta;
+    };
+
     FileIndex() = default;
-    FileIndex(const std::vector<std::shared_ptr<GRAWFile>>& files);
+    FileIndex(const std::vector<std::shared_ptr<GRAWFile>>& files, const unsigned numThreads = 1);
+
+    /** \brief Build the index for the given files.
+
+     Each file is indexed from its sidecar if there is a valid one, or by scanning its frame headers otherwise. In the
+     latter case, a new sidecar is written. The read pointer of each file is left at the beginning of the file.
+
+     The files are indexed concurrently by up to `numThreads` threads. Each file is only ever touched by one thread.
 
-    void indexFiles(const std::vector<std::shared_ptr<GRAWFile>>& files);
+     */
+    void indexFiles(const std::vector<std::shared_ptr<GRAWFile>>& files, const unsigned numThreads = 1);
 
+    //! \brief Returns the open files whose first event is at or before the given event ID.
     std::vector<std::shared_ptr<GRAWFile>> findFilesForEvtId(const evtid_t evtid) const;
 
+    //! \brief Returns the location of every frame belonging to the given event, in file order.
+    std::vector<FrameLocation> findFramesForEvtId(const evtid_t evtid) const;
+
+    //! \brief Returns the sorted list of distinct event IDs found in the files.
+    const std::vector<evtid_t>& getEventIds() const { return eventIds; }
+
+    //! \brief Returns the files that contained at least one frame, in the order they were given.
+    const std::vector<std::shared_ptr<GRAWFile>>& getIndexedFiles() const { return indexedFiles; }
+
+    //! \brief Returns the frames of the file at position `fileIdx` in getIndexedFiles().
+    const FrameList& getFrameList(const size_t fileIdx) const { return frameLists.at(fileIdx); }
+
+    //! \brief Returns the (CoBo, AsAd) pairs that produced at least one frame.
+    const std::set<std::pair<addr_t, addr_t>>& getSources() const { return sources; }
+
+    //! \brief Returns the total number of frames in the index.
+    size_t numFrames() const { return frameRefs.size(); }
+
+    /** \brief Read the frame list of a file from its sidecar.
+
+     \return True if a sidecar was found, it matches the current size and modification time of the GRAW file, and
+             every frame it lists lies within the file.
+
+     */
+    static bool ReadSidecar(const boost::filesystem::path& grawPath, FrameList& frames);
+
+    /** \brief Write the frame list of a file to its sidecar.
+
+     \throws Exceptions::File_Open_Failed If the sidecar could not be written.
+
+     */
+    static void WriteSidecar(const boost::filesystem::path& grawPath, const FrameList& frames);
+
+    //! \brief Returns the path of the sidecar for the given GRAW file.
+    static boost::filesystem::path SidecarPath(const boost::filesystem::path& grawPath);
+
 private:
+    /** \brief Fill in the frame list for one file, from its sidecar or by scanning it.
+
+     \return True if the sidecar was used.
+
+     */
+    static bool IndexOneFile(GRAWFile& file, FrameList& frames);
+
+    /** \brief Scan every frame header in the file.
+
+     \return False if the scan stopped early because of a bad frame. The frames before it are still returned.
+
+     */
+    static bool ScanFile(GRAWFile& file, FrameList& frames);
+
+    //! \brief Position of one frame in `frameLists`, sortable by event ID.
+    struct FrameRef
+    {
+        evtid_t evtId;
+        uint32_t fileIdx;
+        uint32_t frameIdx;
+
+        bool operator<(const FrameRef& other) const
+        {
+            if (evtId != other.evtId) return evtId < other.evtId;
+            if (fileIdx != other.fileIdx) return fileIdx < other.fileIdx;
+            return frameIdx < other.frameIdx;
+        }
+    };
+
     std::multimap<evtid_t, std::shared_ptr<GRAWFile>> filemap;
+
+    std::vector<std::shared_ptr<GRAWFile>> indexedFiles;
+    std::vector<FrameList> frameLists;
+    std::vector<FrameRef> frameRefs;
+    std::vector<evtid_t> eventIds;
+    std::set<std::pair<addr_t, addr_t>> sources;
 };
 
 
@@ -69,7 +69,7 @@ public:
     void OpenFileForWrite(const boost::filesystem::path& path) override;
 
     //! \brief Find the size of the next frame in the file
-    uint16_t GetNextFrameSize();
+    virtual uint16_t GetNextFrameSize();
 
     /** \brief Get the next raw frame from the file
 
@@ -99,6 +99,15 @@ public:
 
         //! \brief The event time from the header
         ts_t evtTime;
+
+        //! \brief The size of the frame in bytes
+        uint32_t size;
+
+        //! \brief The CoBo ID from the header
+        addr_t cobo;
+
+        //! \brief The AsAd ID from the header
+        addr_t asad;
     };
 
     /** \brief Read some metadata from the header of the next frame.
@@ -108,16 +117,16 @@ public:
 
      \return FrameMetadata struct describing the frame
      */
-    FrameMetadata ReadFrameMetadata();
+    virtual FrameMetadata ReadFrameMetadata();
 
     //! \brief Returns the event number of the next frame in the file.
     //! \throws Exceptions::End_of_File if there is not another frame.
     virtual evtid_t NextFrameEvtId();
 
-    void seek(const std::streampos pos) { filestream.seekg(pos); }
-    void seek(const std::streamoff offset, std::ios_base::seekdir dir) { filestream.seekg(offset, dir); }
+    virtual void seek(const std::streampos pos) { filestream.seekg(pos); }
+    virtual void seek(const std::streamoff offset, std::ios_base::seekdir dir) { filestream.seekg(offset, dir); }
 
-    void Rewind() { filestream.seekg(0); }
+    virtual void Rewind() { filestream.clear(); filestream.seekg(0); isEOF = false; }
 
 private:
 
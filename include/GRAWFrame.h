@@ -3,7 +3,7 @@
 
 #include <iostream>
 #include <vector>
-#include <queue>
+#include <array>
 #include <bitset>
 #include <cmath>
 #include <assert.h>
@@ -14,8 +14,63 @@
 #include "Utilities.h"
 #include "Constants.h"
 #include "RawFrame.h"
+#include "ItemDecoder.h"
 
-class GRAWFrame
+/** \brief The fixed-size fields at the start of a frame.
+
+ Read() checks the fields and corrects them where they are inconsistent, so everything that reads frames agrees on
+ where the data items are and how many there are, whether or not it builds a full GRAWFrame.
+
+ */
+struct GRAWFrameHeader
+{
+    uint8_t metaType; // set to 0x8
+    uint32_t frameSize; // in units of 256 bytes
+    uint8_t dataSource;
+    uint16_t frameType;
+    uint8_t revision;
+    uint16_t headerSize;
+    uint16_t itemSize;
+    uint32_t nItems;
+    uint64_t eventTime;
+    uint32_t eventId;
+    uint8_t coboId;
+    uint8_t asadId;
+    uint16_t readOffset;
+    uint8_t status;
+
+    /** \brief Read and check the header of a raw frame.
+
+     \throws Exceptions::Bad_Data If the frame is too short to hold a header.
+
+     */
+    static GRAWFrameHeader Read(const RawFrame& rawFrame);
+
+    //! \brief The byte offset of the first data item from the start of the frame.
+    size_t DataOffset() const;
+};
+
+/** \brief The channels that a frame's hit patterns mark as having data, one bit per channel.
+
+ Channel `ch` of AGET `aget` is bit `aget*num_channels + ch`, counting from the lowest bit of the first word. This is
+ the order of the traces in an Event's storage for one AsAd.
+
+ */
+using HitMask = std::array<uint64_t, (Constants::num_agets * Constants::num_channels + 63) / 64>;
+
+//! \brief How a partial-readout frame's hit patterns compare with the channels that have data items.
+struct HitPatternMismatch
+{
+    //! \brief Channels that the hit patterns mark, but that have no data items.
+    size_t nMissing = 0;
+
+    //! \brief Channels that have data items, but that the hit patterns don't mark.
+    size_t nUnexpected = 0;
+
+    bool any() const { return nMissing > 0 || nUnexpected > 0; }
+};
+
+class GRAWFrame : public GRAWFrameHeader
 {
 public:
     GRAWFrame();
@@ -23,25 +78,74 @@ public:
 
     // Iteration
 
-    std::vector<GRAWDataItem>::iterator begin();
-    std::vector<GRAWDataItem>::iterator end();
-    std::vector<GRAWDataItem>::const_iterator cbegin() const;
-    std::vector<GRAWDataItem>::const_iterator cend() const;
+    //! \brief Iterates over the data items, presenting each one as a GRAWDataItem.
+    class const_iterator
+    {
+    public:
+        const_iterator(const GRAWFrame& frame, const size_t pos) : frame(&frame), pos(pos) {}
 
-    // Data extraction functions
+        GRAWDataItem operator*() const
+        {
+            if (frame->IsFullReadout()) {
+                // The block is in [aget][channel][tb] order
+                const size_t trace = pos / Constants::num_tbs;
+                return GRAWDataItem(static_cast<addr_t>(trace / Constants::num_channels),
+                                    static_cast<addr_t>(trace % Constants::num_channels),
+                                    static_cast<tb_t>(pos % Constants::num_tbs),
+                                    frame->fullReadoutSamples[pos]);
+            }
+            const DecodedItems& items = frame->items;
+            return GRAWDataItem(items.aget[pos], items.channel[pos], items.tb[pos], items.sample[pos]);
+        }
+
+        const_iterator& operator++() { pos++; return *this; }
+        const_iterator operator++(int) { const_iterator old {*this}; pos++; return old; }
+
+        bool operator==(const const_iterator& other) const { return pos == other.pos; }
+        bool operator!=(const const_iterator& other) const { return pos != other.pos; }
+        bool operator<(const const_iterator& other) const { return pos < other.pos; }
+
+    private:
+        const GRAWFrame* frame;
+        size_t pos;
+    };
+
+    const_iterator begin() const { return const_iterator(*this, 0); }
+    const_iterator end() const { return const_iterator(*this, numItems()); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    //! \brief The data items of a partial-readout frame, with one array per field. This is empty for full readout.
+    const DecodedItems& GetItems() const { return items; }
 
-    template <typename charIter>
-    void ExtractPartialReadoutData(charIter& begin, charIter& end);
+    //! \brief True if the frame's samples are in GetFullReadoutSamples() rather than GetItems().
+    bool IsFullReadout() const { return !fullReadoutSamples.empty(); }
+
+    /** \brief The samples of a full-readout frame.
+
+     There are `fullReadoutBlockSize` samples in [aget][channel][tb] order, so the trace of channel `ch` of AGET `aget`
+     starts at index `(aget * num_channels + ch) * num_tbs`. Samples that were missing from the frame are zero.
+
+     */
+    const std::vector<sample_t>& GetFullReadoutSamples() const { return fullReadoutSamples; }
+
+    //! \brief The hit patterns of the four AGETs as one mask.
+    HitMask GetHitMask() const;
+
+    //! \brief The number of valid data items (or samples, for full readout).
+    size_t numItems() const { return IsFullReadout() ? fullReadoutSamples.size() : items.size(); }
+
+    // Data extraction functions
 
-    template <typename charIter>
-    void ExtractFullReadoutData(charIter& begin, charIter& end);
+    void ExtractPartialReadoutData(const uint8_t* begin, const uint8_t* end);
+    void ExtractFullReadoutData(const uint8_t* begin, const uint8_t* end);
 
-    static addr_t ExtractAgetId(const uint32_t raw);
-    static addr_t ExtractChannel(const uint32_t raw);
-    static tb_t ExtractTBid(const uint32_t raw);
-    static sample_t ExtractSample(const uint32_t raw);
-    static addr_t ExtractAgetIdFullReadout(const uint16_t raw);
-    static sample_t ExtractSampleFullReadout(const uint16_t raw);
+    static addr_t ExtractAgetId(const uint32_t raw) { return (raw & 0xC0000000)>>30; }
+    static addr_t ExtractChannel(const uint32_t raw) { return (raw & 0x3F800000)>>23; }
+    static tb_t ExtractTBid(const uint32_t raw) { return (raw & 0x007FC000)>>14; }
+    static sample_t ExtractSample(const uint32_t raw) { return (raw & 0x00000FFF); }
+    static addr_t ExtractAgetIdFullReadout(const uint16_t raw) { return (raw & 0xC000)>>14; }
+    static sample_t ExtractSampleFullReadout(const uint16_t raw) { return (raw & 0x0FFF); }
 
     static const uint8_t  Expected_metaType;
     static const uint16_t Expected_headerSize;
@@ -50,32 +154,23 @@ public:
     static const uint16_t Expected_frameTypePartialReadout;
     static const uint16_t Expected_frameTypeFullReadout;
     static const int      sizeUnit;
+    static const size_t   fullReadoutBlockSize;
 
-    // Header fields
+    // Header fields beyond GRAWFrameHeader
 
-    uint8_t metaType; // set to 0x6
-    uint32_t frameSize; // in units of 64 bytes
-    uint8_t dataSource;
-    uint16_t frameType;
-    uint8_t revision;
-    uint16_t headerSize;
-    uint16_t itemSize;
-    uint32_t nItems;
-    uint64_t eventTime;
-    uint32_t eventId;
-    uint8_t coboId;
-    uint8_t asadId;
-    uint16_t readOffset;
-    uint8_t status;
 //    uint8_t hitPattern[4][9];
     std::vector< std::bitset<9*8> > hitPatterns;
 //    uint16_t multiplicity[4];
     std::vector<uint16_t> multiplicity;
 
+    //! \brief Where the hit patterns disagree with the data items. Always zero for full readout.
+    HitPatternMismatch hitPatternMismatch;
+
 private:
     // Data items
 
-    std::vector<GRAWDataItem> data;
+    DecodedItems items;
+    std::vector<sample_t> fullReadoutSamples;
 
     // Friends
 
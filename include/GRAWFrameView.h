@@ -0,0 +1,110 @@
+#ifndef GRAWFRAMEVIEW_H
+#define GRAWFRAMEVIEW_H
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+#include "GRAWFrame.h"
+#include "GRAWDataItem.h"
+#include "Constants.h"
+#include "RawFrame.h"
+
+/** \brief A lightweight, read-only view of a frame.
+
+ Constructing a view only reads the fixed header fields. Nothing is allocated or copied: the hit patterns and
+ multiplicities are read from the frame's bytes when they are asked for, and the data items are decoded one at a time
+ while iterating over them. This makes it much cheaper than a GRAWFrame for anything that only needs the header or a
+ quick look at the frame, like routing frames to events or collecting statistics.
+
+ The view refers to the RawFrame's buffer, so the RawFrame must outlive it.
+
+ */
+class GRAWFrameView
+{
+public:
+    /** \brief Make a view of the given frame.
+
+     \throws Exceptions::Bad_Data If the frame is too short to hold a header.
+
+     */
+    explicit GRAWFrameView(const RawFrame& rawFrame);
+
+    //! \brief The fixed header fields, checked and corrected as in GRAWFrame.
+    const GRAWFrameHeader& GetHeader() const { return header; }
+
+    evtid_t eventId() const { return header.eventId; }
+    ts_t eventTime() const { return header.eventTime; }
+    addr_t coboId() const { return header.coboId; }
+    addr_t asadId() const { return header.asadId; }
+
+    bool IsPartialReadout() const { return header.frameType == GRAWFrame::Expected_frameTypePartialReadout; }
+    bool IsFullReadout() const { return header.frameType == GRAWFrame::Expected_frameTypeFullReadout; }
+
+    //! \brief True if the hit pattern of the given AGET says that the channel has data.
+    bool IsChannelHit(const addr_t aget, const addr_t channel) const;
+
+    //! \brief The hit pattern of one AGET, in the same form as GRAWFrame::hitPatterns.
+    std::bitset<72> GetHitPattern(const addr_t aget) const;
+
+    //! \brief The hit patterns of the four AGETs as one mask, as in GRAWFrame::GetHitMask.
+    HitMask GetHitMask() const;
+
+    //! \brief The multiplicity field of one AGET.
+    uint16_t GetMultiplicity(const addr_t aget) const;
+
+    //! \brief The raw bytes of the data items.
+    const uint8_t* ItemData() const { return rawData + header.DataOffset(); }
+
+    /** \brief Decodes the data items one at a time, in the order they appear in the frame.
+
+     Items with an invalid address are skipped, as in GRAWFrame. For full readout, each item's channel and time bucket
+     come from its position in its AGET's stream of samples.
+
+     */
+    class const_iterator
+    {
+    public:
+        using value_type = GRAWDataItem;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+        using iterator_category = std::input_iterator_tag;
+
+        const_iterator(const GRAWFrameView& view, const size_t pos);
+
+        GRAWDataItem operator*() const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int) { const_iterator old {*this}; ++(*this); return old; }
+
+        bool operator==(const const_iterator& other) const { return pos == other.pos; }
+        bool operator!=(const const_iterator& other) const { return pos != other.pos; }
+
+    private:
+        //! \brief Advance `pos` to the next valid item, starting from the current one.
+        void skipInvalid();
+
+        const uint8_t* data;
+        size_t pos;
+        size_t end;
+        bool fullReadout;
+
+        // For full readout, the (channel, tb) of the next sample of each AGET
+        addr_t channel[Constants::num_agets];
+        tb_t tbid[Constants::num_agets];
+    };
+
+    const_iterator begin() const { return const_iterator(*this, 0); }
+    const_iterator end() const { return const_iterator(*this, numRawItems()); }
+
+private:
+    //! \brief The number of items to iterate over, counting invalid ones. Frames of unknown type have none.
+    size_t numRawItems() const { return (IsPartialReadout() || IsFullReadout()) ? header.nItems : 0; }
+
+    const uint8_t* rawData;
+    GRAWFrameHeader header;
+};
+
+#endif /* end of include guard: GRAWFRAMEVIEW_H */
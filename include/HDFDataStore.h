@@ -2,22 +2,272 @@
 #define HDFDATASTORE_H
 
 #include <string>
+#include <vector>
 #include <H5Cpp.h>
 #include "Event.h"
 #include "Constants.h"
 
+/** \brief How the events are laid out in the HDF5 file.
+
+ \rst
+
+ All layouts live in the group ``get``. In the dense layouts, each trace is one row of ``traceColumns`` values: the
+ CoBo, AsAd, AGET, channel, and pad number, followed by the 512 samples.
+
+ PerEvent
+     Each event is its own 2-D dataset, named after its event ID.
+
+ Table
+     All traces go into one extendable dataset, ``traces``, in the order the events were written. A second dataset,
+     ``events``, has one row per event with its ID, time, first row in ``traces``, and number of rows. Long runs
+     produce two objects instead of millions, and any event can be read with a single hyperslab selection.
+
+ Sparse
+     Like Table, but only the nonzero samples are stored, which suits data that has been thresholded. ``traces`` has
+     one compound row per trace with its address, pad, and where its samples are in ``runs``. ``runs`` is a single
+     stream of samples where each trace's nonzero samples are stored as runs: the first time bucket, the length, and
+     then the values of the run. A trace with no nonzero samples has no runs. HDFDataStore::readEvent expands the
+     traces back into dense rows.
+
+ \endrst
+
+ */
+enum class HDFLayout { PerEvent, Table, Sparse };
+
+/** \brief Options that control how events are stored in the HDF5 file.
+
+ By default, each event is stored contiguously and uncompressed. If any filter is enabled, the events are stored in
+ chunks of `chunkTraces` traces instead, and each chunk is passed through the filters in this order: scale-offset or
+ n-bit packing, then byte shuffling, then deflate. All of these are built into HDF5, so any HDF5 reader can open the file.
+
+ The Table and Sparse layouts are always chunked, since their datasets grow. In the Sparse layout, each chunk of
+ ``runs`` holds as many values as a chunk of `chunkTraces` dense rows would.
+
+ */
+struct HDFWriteOptions
+{
+    HDFLayout layout = HDFLayout::PerEvent;
+
+    //! \brief The number of traces (rows) in each chunk.
+    hsize_t chunkTraces = 64;
+
+    //! \brief The number of traces collected in memory before they are written to the file together.
+    hsize_t batchTraces = 4096;
+
+    //! \brief Shuffle the bytes of the samples so the high and low bytes are compressed separately.
+    bool shuffle = false;
+
+    //! \brief The deflate (gzip) level, from 1 to 9. Zero turns deflate off.
+    unsigned deflateLevel = 0;
+
+    //! \brief Pack each chunk into the fewest bits that hold its range of values. This is lossless.
+    bool scaleOffset = false;
+
+    /** \brief Store the samples with this many bits (including the sign bit). Zero turns n-bit packing off.
+
+     This is lossy if a sample doesn't fit: HDF5 clips it to the nearest value that does. The 12-bit samples need 13
+     bits, since they can go below zero after the FPN is subtracted. The precision also applies to the values stored
+     alongside the samples, which must not be clipped, so it can't be less than MinNbitPrecision().
+
+     */
+    unsigned nbitPrecision = 0;
+
+    /** \brief The smallest n-bit precision that stores everything but the samples exactly.
+
+     In the dense layouts, this is the full 16 bits, since the pad number column holds the lookup table's missing
+     value (20000) for channels without a pad, so n-bit packing can't save any space there. In the Sparse layout, the
+     pads are in the trace table instead, and this is 11 bits for the run headers, since a run can be up to
+     `Constants::num_tbs` long.
+
+     */
+    unsigned MinNbitPrecision() const;
+
+    //! \brief True if any filter is enabled, so the datasets have to be chunked.
+    bool IsChunked() const { return shuffle || deflateLevel > 0 || scaleOffset || nbitPrecision > 0; }
+};
+
+/** \brief Reads and writes events in an HDF5 file.
+
+ A writable store creates (or truncates) the file, and writes events in the layout given in its options. A read-only
+ store opens an existing file in any layout, which it detects, and reads back events by their position in the file,
+ always as dense rows.
+
+ */
 class HDFDataStore
 {
 public:
-    HDFDataStore(const std::string& filename, const bool writable=false);
+    //! \brief The number of values in each row: the hardware address and pad, and the samples.
+    static const hsize_t traceColumns = 5 + Constants::num_tbs;
+
+    //! \brief An event read back from the file.
+    struct EventRecord
+    {
+        evtid_t eventId = 0;
+        ts_t eventTime = 0;  // not stored in the PerEvent layout
+        hsize_t nTraces = 0;
+
+        //! \brief The traces, row-major, `traceColumns` values each.
+        std::vector<sample_t> data;
+    };
+
+    /** \brief Events serialized into rows, ready to be written together with writeBatch.
+
+     The rows are in the format described for HDFLayout, so they can be handed to HDF5 without any rearranging.
+     Clearing a batch keeps its memory, so a batch can be refilled many times without allocating.
+
+     */
+    struct EventBatch
+    {
+        //! \brief One row of the event table. The first row counts from the start of the batch.
+        struct Entry
+        {
+            uint64_t eventId;
+            uint64_t eventTime;
+            uint64_t firstRow;
+            uint64_t nRows;
+        };
+
+        std::vector<sample_t> rows;
+        std::vector<Entry> events;
+
+        //! \brief Serialize an event and add it to the end of the batch.
+        void add(const Event& evt);
+
+        hsize_t numTraces() const { return rows.size() / traceColumns; }
+        bool empty() const { return events.empty(); }
+        void clear() { rows.clear(); events.clear(); }
+    };
+
+    //! \brief One row of the `traces` dataset of the Sparse layout.
+    struct SparseTraceEntry
+    {
+        uint64_t firstValue;  // the position of the trace's first run in `runs`
+        uint32_t nValues;     // the number of values its runs take up in `runs`, including their headers
+        uint16_t cobo;
+        uint16_t asad;
+        uint16_t aget;
+        uint16_t channel;
+        uint16_t pad;
+    };
 
+    /** \brief Append the runs of nonzero samples in a trace of `Constants::num_tbs` samples to `runs`.
+
+     \return The number of values appended.
+
+     */
+    static size_t EncodeRuns(const sample_t* samples, std::vector<sample_t>& runs);
+
+    /** \brief Expand `n` values of runs into a trace of `Constants::num_tbs` samples, which must be zeroed first.
+
+     \throws Exceptions::Bad_Data If a run doesn't fit in the trace.
+
+     */
+    static void ExpandRuns(const sample_t* runs, const size_t n, sample_t* samples);
+
+    HDFDataStore(const std::string& filename, const bool writable=false,
+                 const HDFWriteOptions& opts=HDFWriteOptions());
+
+    //! \brief Flushes any events that are still in memory. Errors are logged, since they can't be thrown from here.
+    ~HDFDataStore();
+
+    HDFDataStore(const HDFDataStore&) = delete;
+    HDFDataStore& operator=(const HDFDataStore&) = delete;
+
+    /** \brief Write an event.
+
+     In the Table and Sparse layouts, events are held in memory until `batchTraces` traces have been collected, and are
+     then written together.
+
+     */
     void writeEvent(const Event& evt);
 
+    //! \brief Write a batch of events, after any that are being held in memory.
+    void writeBatch(const EventBatch& batch);
+
+    //! \brief Write out any events that are being held in memory.
+    void flush();
+
+    //! \brief The number of events in the file. For a writable store, this includes the ones not flushed yet.
+    size_t numEvents() const;
+
+    /** \brief Read the event at the given position. The store must be read-only.
+
+     Events are numbered in the order they were written for the Table and Sparse layouts, or in order of event ID for
+     the PerEvent layout.
+
+     \throws std::out_of_range If there is no such event.
+
+     */
+    EventRecord readEvent(const size_t n) const;
 
 private:
+    using EventTableEntry = EventBatch::Entry;
+
+    static H5::CompType EventTableType();
+    static H5::CompType SparseTraceType();
+
+    //! \brief The creation properties (layout and filters) for a dataset of the given number of traces.
+    H5::DSetCreatPropList MakeCreateProps(const hsize_t nTraces, const hsize_t nColumns) const;
+
+    //! \brief Add the filters in the options to a chunked dataset's properties.
+    void AddFilters(H5::DSetCreatPropList& props) const;
+
+    //! \brief Extend an extendable 1-D or 2-D dataset by `newRows` rows and write them.
+    static void AppendRows(H5::DataSet& dset, const void* data, const H5::DataType& memType, const hsize_t oldRows,
+                           const hsize_t newRows);
+
+    void writePerEvent(const Event& evt);
+
+    //! \brief Create one dataset for each event in the batch.
+    void writeBatchPerEvent(const EventBatch& batch);
+
+    //! \brief Append the batch to the datasets of the Table layout.
+    void appendToTable(const EventBatch& batch);
+
+    //! \brief Encode the batch's traces as runs and append them to the datasets of the Sparse layout.
+    void appendToSparse(const EventBatch& batch);
+
+    //! \brief Append the batch's events to the event table. `traceSet` must already hold their traces.
+    void appendEvents(const EventBatch& batch);
+
+    void createTableDatasets();
+    void openForReading();
+
+    //! \brief Read an event of the Sparse layout and expand it into dense rows.
+    void readSparseEvent(const EventTableEntry& entry, EventRecord& record) const;
+
     H5::H5File file;
     H5::Group gp;
     std::string groupName = "get";
+    bool writable;
+
+    HDFWriteOptions opts;
+
+    //! \brief The type the samples are stored as in the file. This has a reduced precision if n-bit packing is on.
+    H5::IntType fileType;
+
+    size_t eventsInFile = 0;
+
+    //! \brief Holds one event at a time for writeEvent in the PerEvent layout.
+    EventBatch scratch;
+
+    // For the Table and Sparse layouts
+    H5::DataSet traceSet;
+    H5::DataSet eventSet;
+    hsize_t rowsInFile = 0;
+    EventBatch pending;
+    std::vector<EventTableEntry> tableEntries;  // reused to write the event table
+
+    // For the Sparse layout
+    H5::DataSet runSet;
+    hsize_t runValuesInFile = 0;
+    std::vector<SparseTraceEntry> sparseTraces;  // reused to encode each batch
+    std::vector<sample_t> sparseRuns;
+
+    // For reading. The whole event table is loaded for the Table and Sparse layouts, and the dataset names (in order
+    // of event ID) are listed for the PerEvent layout. The layout is detected and kept in `opts`.
+    std::vector<EventTableEntry> eventTable;
+    std::vector<std::string> datasetNames;
 };
 
 #endif /* end of include guard: HDFDATASTORE_H */
@@ -0,0 +1,86 @@
+#ifndef ITEMDECODER_H
+#define ITEMDECODER_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "Constants.h"
+
+/** \brief The data items of a frame, stored as one array per field.
+
+ Item `i` is (aget[i], channel[i], tb[i], sample[i]). Keeping the fields in separate arrays lets the decoder write
+ several items at once, and lets consumers that only need some of the fields skip the rest.
+
+ */
+struct DecodedItems
+{
+    std::vector<addr_t> aget;
+    std::vector<addr_t> channel;
+    std::vector<tb_t> tb;
+    std::vector<sample_t> sample;
+
+    //! \brief Items that were dropped because their AGET, channel, or time bucket was out of range.
+    size_t nBadAget = 0;
+    size_t nBadChannel = 0;
+    size_t nBadTB = 0;
+
+    size_t size() const { return sample.size(); }
+    bool empty() const { return sample.empty(); }
+    size_t numInvalid() const { return nBadAget + nBadChannel + nBadTB; }
+
+    void clear();
+    void resize(const size_t n);
+
+    //! \brief Add one item without checking it.
+    void push_back(const addr_t agetId, const addr_t chan, const tb_t tbid, const sample_t samp);
+};
+
+/** \brief Decoders for the data items of GRAW frames.
+
+ Each partial-readout item is big-endian and packs the AGET (2 bits), channel (7 bits), time bucket (9 bits), and
+ sample (12 bits). The scalar decoder handles one item at a time. On x86, there are also SSE4.1 and AVX2 decoders that
+ byte-swap and unpack 4 or 8 items per instruction. A block that contains an invalid item is handed to the scalar decoder, so all
+ implementations produce exactly the same output.
+
+ DecodePartialReadout picks the fastest implementation the CPU supports the first time it is called.
+
+ */
+namespace ItemDecoder {
+
+    enum class Impl { Scalar, SSE41, AVX2 };
+
+    //! \brief True if this build and the CPU it is running on support the given implementation.
+    bool IsSupported(const Impl impl);
+
+    //! \brief The implementation used by DecodePartialReadout.
+    Impl BestSupported();
+
+    const char* ImplName(const Impl impl);
+
+    /** \brief Decode `nItems` partial-readout items starting at `data`, replacing the contents of `out`.
+
+     Items whose AGET, channel, or time bucket are out of range are left out and counted in `out`.
+
+     */
+    void DecodePartialReadout(const uint8_t* data, const size_t nItems, DecodedItems& out);
+
+    //! \brief The same, with a specific implementation. It must be supported.
+    void DecodePartialReadout(const uint8_t* data, const size_t nItems, DecodedItems& out, const Impl impl);
+
+    /** \brief Decode `nItems` 16-bit full-readout items into a [aget][channel][tb] sample block.
+
+     Each AGET's samples arrive in time bucket order, with all channels of one time bucket together, but the AGETs may
+     be interleaved. The block must hold `num_agets * num_channels * num_tbs` samples. Samples that aren't in the
+     frame are left as they were.
+
+     Items with an invalid AGET are counted in `nBadAget`, and items past the last time bucket of their AGET are
+     counted in `nBadTB`.
+
+     */
+    void DecodeFullReadout(const uint8_t* data, const size_t nItems, sample_t* block, size_t& nBadAget, size_t& nBadTB);
+
+    //! \brief Log a warning with the counts in `items` if any of a frame's items were invalid.
+    void WarnInvalidItems(const DecodedItems& items, const bool fullReadout);
+}
+
+#endif /* end of include guard: ITEMDECODER_H */
@@ -1,129 +1,156 @@
 #ifndef LOOKUPTABLE_H
 #define LOOKUPTABLE_H
 
-#include <iostream>
-#include <sstream>
-#include <fstream>
-#include <unordered_map>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <boost/log/trivial.hpp>
 #include "Constants.h"
+#include "GMExceptions.h"
+#include "LookupTableFile.h"
 
 /** \brief A base class representing a lookup table.
 
   This class represents a lookup table that maps cobo, asad, aget, and channel onto some value. This can be used to look up, for example, pad numbers or pedestals.
 
   For the purposes of this code, we assume that the table has already been made and is in an external file. The file name has to be passed to the constructor of this class, and it will be opened and read in.
+
+  The values are kept in one flat array with a slot for every address in the table's geometry, indexed by the packed
+  address. This makes a lookup a few integer operations and a single load from an array small enough to stay in the
+  cache (about 21 kB of pad numbers for the full detector). Slots with no entry in the file hold `missingValue`, as
+  does one extra slot at the end, which is where lookups of addresses outside the geometry are sent.
   */
 template <typename mapped_t, mapped_t missingValue_=0>
 class LookupTable
 {
 public:
     /** \brief Load from CSV file
-      The constructor takes a string argument that specifies where on disk the lookup table file is located. The file should be in csv format, with data in the order cobo, asad, aget, channel, value. There should be no headers in the file.
+      The constructor takes a string argument that specifies where on disk the lookup table file is located. The file should be in csv format, with data in the order cobo, asad, aget, channel, value. There should be no headers in the file. Lines may end in `\\n`, `\\r\\n`, or the classic Mac OS `\\r` that Igor writes.
 
-      \rst
-      .. WARNING::
-      Igor's output files have classic Mac OS `\\r` line endings. This program assumes standard Unix `\\n` line endings. This could easily be changed, but at the expense of using the standard. I've chosen to change the line endings in the Igor file manually instead.
-      \endrst
+      If `useCache` is true, the table is loaded from the binary cache of the file if it is up to date, and otherwise the
+      file is parsed and the cache is written. See LookupTableFile.
       */
-    LookupTable(const std::string& path)
+    LookupTable(const std::string& path, const LookupTableGeometry& geometry=LookupTableGeometry(),
+                const bool useCache=false)
+    : geometry(geometry)
     {
-        ReadFile(path);
+        ReadFile(path, useCache);
     }
 
     //! \brief A default constructor (for testing only)
-    LookupTable() {}
+    explicit LookupTable(const LookupTableGeometry& geometry=LookupTableGeometry())
+    : geometry(geometry), values(geometry.size() + 1, missingValue), hasEntry(geometry.size(), false) {}
 
     //! \brief Looks up a pad number in the table using the information passed to the function.
     mapped_t Find(addr_t cobo, addr_t asad, addr_t aget, addr_t channel) const
     {
-        if (!table.empty()) {
-            auto hash = CalculateHash(cobo, asad, aget, channel);
-            auto foundItem = table.find(hash);
-            if (foundItem != table.end()) {
-                return foundItem->second;
-            }
-            else {
-                return missingValue; // an invalid value
-            }
-        }
-        else {
-            throw Exceptions::Not_Init();
-        }
+        if (numEntries == 0) throw Exceptions::Not_Init();
+        return values[Index(cobo, asad, aget, channel)];
     }
 
     //! \brief Tests if the table is empty.
     bool Empty() const
     {
-        return table.empty();
+        return numEntries == 0;
     }
 
-    //! \brief Read the file at the provided path and replace all values in the hash table with values from the file.
-    void ReadFile(const std::string& path)
+    const LookupTableGeometry& Geometry() const
     {
-        std::ifstream file (path, std::ios::in|std::ios::binary);
-
-        // MUST throw out the first two junk lines in file. No headers!
+        return geometry;
+    }
 
-        if (!file.good()) throw 0; // FIX THIS!
+    /** \brief Read the file at the provided path and replace all values in the table with values from the file.
 
-        if (table.size() != 0) {
-            table.clear();
-        }
+      If an address appears more than once, its first row is used. Rows with addresses outside the table's geometry
+      are skipped with a warning.
 
-        std::string line;
+      \throws Exceptions::File_Open_Failed If the file can't be read.
+      \throws Exceptions::Bad_Data If a line of the file is malformed.
+      */
+    void ReadFile(const std::string& path, const bool useCache=false)
+    {
+        values.assign(geometry.size() + 1, missingValue);
+        hasEntry.assign(geometry.size(), false);
+        numEntries = 0;
 
-        while (!file.eof()) {
-            addr_t cobo, asad, aget, channel;
-            mapped_t value;
-            getline(file,line,'\n');
-            std::stringstream lineStream(line);
-            std::string element;
+        if (useCache && LookupTableFile::LoadCache(path, geometry, sizeof(mapped_t), MissingBits(), values.data(),
+                                                   numEntries)) {
+            return;
+        }
 
-            getline(lineStream, element,',');
-            if (element == "-1" || element == "") continue; // KLUDGE!
-            cobo = static_cast<addr_t>(stoi(element));
+        values.assign(geometry.size() + 1, missingValue);
+        numEntries = 0;
+        for (const auto& row : LookupTableFile::ParseCSV(path)) {
+            Set(row.cobo, row.asad, row.aget, row.channel, static_cast<mapped_t>(row.value));
+        }
 
-            getline(lineStream, element,',');
-            asad = static_cast<addr_t>(stoi(element));
+        if (useCache) {
+            LookupTableFile::SaveCache(path, geometry, sizeof(mapped_t), MissingBits(), values.data(), numEntries);
+        }
+    }
 
-            getline(lineStream, element,',');
-            aget = static_cast<addr_t>(stoi(element));
+    //! \brief The value returned when a pad is missing from the lookup table. Change it only before loading a file.
+    mapped_t missingValue {missingValue_};
 
-            getline(lineStream, element,',');
-            channel = static_cast<addr_t>(stoi(element));
+    //! \brief The initial value of `missingValue`.
+    static constexpr mapped_t defaultMissingValue = missingValue_;
 
-            auto hash = CalculateHash(cobo, asad, aget, channel);
+protected:
+    static_assert(std::is_trivially_copyable<mapped_t>::value && sizeof(mapped_t) <= sizeof(uint64_t),
+                  "The values are cached as raw bytes");
 
-            getline(lineStream, element);
-            value = static_cast<mapped_t>(stoi(element));
+    //! \brief The bytes of the missing value, which identify the table along with its geometry in the cache.
+    uint64_t MissingBits() const
+    {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &missingValue, sizeof(mapped_t));
+        return bits;
+    }
 
-            table.emplace(hash, value);
-        }
+    /** \brief The position of an address in the array of values.
 
+      The address is packed as cobo, asad, aget, channel, with the channel varying fastest. Addresses outside the
+      geometry go to the last slot, which always holds the missing value. This is a select rather than a branch, so
+      the lookup doesn't depend on guessing which addresses are valid.
+      */
+    size_t Index(addr_t cobo, addr_t asad, addr_t aget, addr_t channel) const
+    {
+        const size_t packed = ((size_t(cobo) * geometry.numAsads + asad) * geometry.numAgets + aget)
+                              * geometry.numChannels + channel;
+        const bool inRange = (cobo < geometry.numCobos) & (asad < geometry.numAsads)
+                             & (aget < geometry.numAgets) & (channel < geometry.numChannels);
+        return inRange ? packed : values.size() - 1;
     }
 
-    //! \brief The value returned when a pad is missing from the lookup table.
-    mapped_t missingValue {missingValue_};
+    /** \brief Set the value at an address, unless it already has one.
 
-protected:
-    /** \brief Hashing function for the hashtable used to store the values.
+      The first value set for an address is kept, so a duplicated row in a file doesn't replace the earlier one. An
+      address outside the table's geometry is skipped with a warning.
 
-      It simply concatenates cobo+asad+aget+channel since this is unique for each value.
+      \return True if the value was stored.
       */
-    static hash_t CalculateHash(addr_t cobo, addr_t asad, addr_t aget, addr_t channel)
+    bool Set(addr_t cobo, addr_t asad, addr_t aget, addr_t channel, mapped_t value)
     {
-        // Widen the integers so they don't overflow on multiplication
-        auto wcobo = hash_t(cobo);
-        auto wasad = hash_t(asad);
-        auto waget = hash_t(aget);
-        auto wchannel = hash_t(channel);
-
-        auto result = wchannel + waget*100 + wasad*10000 + wcobo*1000000;
+        const size_t idx = Index(cobo, asad, aget, channel);
+        if (idx == values.size() - 1) {
+            BOOST_LOG_TRIVIAL(warning) << "Skipped lookup table entry with address out of range: "
+                                       << std::to_string(cobo) << "," << std::to_string(asad) << ","
+                                       << std::to_string(aget) << "," << std::to_string(channel);
+            return false;
+        }
+        if (hasEntry[idx]) return false;
 
-        return result;
+        values[idx] = value;
+        hasEntry[idx] = true;
+        numEntries++;
+        return true;
     }
 
-    std::unordered_map<hash_t,mapped_t> table;  // The hashtable, maps hash:value
+    LookupTableGeometry geometry;
+    std::vector<mapped_t> values;  // One per address in the geometry, plus the slot for invalid addresses
+    std::vector<bool> hasEntry;    // Which addresses Set has filled, so later rows for them are ignored
+    size_t numEntries = 0;        // The number of addresses with a value, from the file or by Set
 
     friend class EventTestFixture;
     friend class PadLookupTableTestFixture;
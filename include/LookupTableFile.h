@@ -0,0 +1,97 @@
+#ifndef LOOKUPTABLEFILE_H
+#define LOOKUPTABLEFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Constants.h"
+
+/** \brief The range of hardware addresses a LookupTable can hold.
+
+ The default is the full AT-TPC: every channel of every AGET on every AsAd of every CoBo.
+
+ */
+struct LookupTableGeometry
+{
+    addr_t numCobos = Constants::num_cobos;
+    addr_t numAsads = Constants::num_asads;
+    addr_t numAgets = Constants::num_agets;
+    addr_t numChannels = Constants::num_channels;
+
+    //! \brief The number of addresses in the geometry.
+    size_t size() const { return size_t(numCobos) * numAsads * numAgets * numChannels; }
+};
+
+/** \brief Reading lookup tables from CSV files, and caching them in a binary form.
+
+ \rst
+
+ Parsing a CSV lookup table is slow compared to the rest of the startup, and batch jobs load the same tables for
+ every run. So a LookupTable can compile its CSV file into a cache next to it, named after the CSV file with
+ ``.bin`` appended, and load that instead on later runs.
+
+ The cache is a fixed-size header followed by the table's array of values, exactly as it is held in memory, so it
+ is loaded by mapping it and copying the array. The header records:
+
+ - the size and modification time of the CSV file it was compiled from,
+ - the geometry of the table, the size of its values, and the missing value,
+ - a checksum of the values.
+
+ If any of these don't match, or the file is the wrong size, the cache is ignored and the CSV file is parsed again,
+ which rewrites the cache. The cache is written to a temporary file and renamed into place, so concurrent jobs
+ never see a partial cache. It is in the machine's native byte order, which the header also records.
+
+ \endrst
+
+ */
+namespace LookupTableFile {
+
+    //! \brief One line of a lookup table file.
+    struct Row
+    {
+        addr_t cobo, asad, aget, channel;
+        long long value;
+    };
+
+    /** \brief Parse a lookup table file.
+
+     Each line holds the CoBo, AsAd, AGET, channel, and value, separated by commas. Empty lines and lines whose first
+     field is -1 are skipped. Lines may end in `\n`, `\r\n`, or `\r`. As with `std::stoi`, anything after the digits
+     of a field (like a decimal point) is ignored.
+
+     \throws Exceptions::File_Open_Failed If the file can't be read.
+     \throws Exceptions::Bad_Data If a line doesn't have five integer fields, or an address doesn't fit in addr_t.
+
+     */
+    std::vector<Row> ParseCSV(const std::string& path);
+
+    //! \brief Parse lookup table rows from text already in memory. See ParseCSV.
+    std::vector<Row> ParseCSV(const char* begin, const char* end);
+
+    //! \brief The path of the cache for the given CSV file.
+    std::string CachePath(const std::string& csvPath);
+
+    /** \brief Load a table from the cache of the given CSV file, if it is valid.
+
+     The table's description (geometry, value size, and the bytes of the missing value) must match the cache's.
+
+     \param values Where the array of values is copied. It must hold `geometry.size() + 1` values.
+     \param numEntries Set to the number of entries the table was compiled from.
+     \return True if the cache was loaded. If it wasn't, `values` may have been partly overwritten.
+
+     */
+    bool LoadCache(const std::string& csvPath, const LookupTableGeometry& geometry, const size_t valueSize,
+                   const uint64_t missingBits, void* values, size_t& numEntries);
+
+    /** \brief Write the cache for the given CSV file.
+
+     Failing to write the cache (if the directory is read-only, say) isn't an error, since the table was loaded
+     anyway. It is logged as a warning.
+
+     */
+    void SaveCache(const std::string& csvPath, const LookupTableGeometry& geometry, const size_t valueSize,
+                   const uint64_t missingBits, const void* values, const size_t numEntries);
+}
+
+#endif /* end of include guard: LOOKUPTABLEFILE_H */
@@ -0,0 +1,99 @@
+#ifndef MAPPEDGRAWFILE_H
+#define MAPPEDGRAWFILE_H
+
+#include <memory>
+#include <string>
+#include <boost/filesystem.hpp>
+
+#include "GRAWFile.h"
+#include "GMExceptions.h"
+#include "Constants.h"
+#include "RawFrame.h"
+
+/** \brief Interface to a .GRAW file that is read through a memory mapping.
+
+     This is a drop-in replacement for GRAWFile that maps the whole file into memory instead of reading it through a
+     filestream. Frames are walked in place, and ReadRawFrame returns a RawFrame that is a view into the mapping rather
+     than a copy. The views keep the mapping alive, so they remain valid even after the file is closed.
+
+     The kernel is told that the file will be read sequentially, and the region just ahead of the read cursor is
+     prefetched as the file is consumed.
+*/
+class MappedGRAWFile : public GRAWFile
+{
+public:
+    //! \brief Default constructor. Call OpenFileForRead before using the object.
+    MappedGRAWFile() = default;
+
+    /** \brief Constructs the object and maps the file at the provided path.
+
+     \param path The path to the file.
+     */
+    MappedGRAWFile(const std::string& path);
+
+    //! \overload
+    MappedGRAWFile(const boost::filesystem::path& path);
+
+    /** \brief Maps a file for input
+
+     This performs the same checks as GRAWFile::OpenFileForRead, but maps the file instead of opening a stream.
+
+     \throws Exceptions::Bad_File Thrown if the file could not be opened or mapped.
+     */
+    void OpenFileForRead(const std::string& path) override;
+
+    //! \overload
+    void OpenFileForRead(const boost::filesystem::path& path) override;
+
+    //! \brief Mapped files are read-only, so this always throws Exceptions::File_Open_Failed.
+    void OpenFileForWrite(const std::string& path) override;
+
+    //! \overload
+    void OpenFileForWrite(const boost::filesystem::path& path) override;
+
+    //! \brief Releases this object's reference to the mapping.
+    void CloseFile() override;
+
+    uint16_t GetNextFrameSize() override;
+
+    /** \brief Get the next raw frame from the file
+
+     The returned frame is a view into the mapping. No data is copied.
+
+     \throws Exceptions::End_of_File Thrown if there are no more frames in the file.
+
+     \throws Exceptions::Frame_Read_Error Thrown if the frame size is invalid or the frame is truncated.
+     */
+    RawFrame ReadRawFrame() override;
+
+    FrameMetadata ReadFrameMetadata() override;
+
+    evtid_t NextFrameEvtId() override;
+
+    bool eof() const override;
+    bool is_open() const override;
+    std::streamoff GetPosition() override;
+
+    void seek(const std::streampos pos) override;
+    void seek(const std::streamoff offset, std::ios_base::seekdir dir) override;
+    void Rewind() override;
+
+    //! \brief The size of the window that is prefetched ahead of the read cursor, in bytes.
+    static const size_t prefetchWindow;
+
+private:
+    //! \brief Checks that `len` bytes starting at the cursor are inside the mapping.
+    bool HaveBytes(const size_t len) const { return cursor + len <= mappedSize; }
+
+    //! \brief Asks the kernel to start reading the next window if the cursor has left the last one.
+    void AdviseAhead();
+
+    std::shared_ptr<uint8_t> mapping;
+    size_t mappedSize = 0;
+    size_t cursor = 0;
+    size_t adviseStart = 0;
+    size_t nextAdviseAt = 0;
+    bool isOpen = false;
+};
+
+#endif /* defined(MAPPEDGRAWFILE_H) */
@@ -2,7 +2,9 @@
 #define MERGER_H
 
 #include "GRAWFile.h"
+#include "MappedGRAWFile.h"
 #include "GRAWFrame.h"
+#include "GRAWFrameView.h"
 #include "GMExceptions.h"
 #include "PadLookupTable.h"
 #include "HDFDataStore.h"
@@ -10,37 +12,126 @@
 #include "Event.h"
 #include "SyncQueue.h"
 #include "RawFrame.h"
-#include "LRUCache.h"
 #include "FileIndex.h"
+#include "EventIdWindow.h"
+#include "EventPool.h"
+#include "ReorderBuffer.h"
 
 #include <map>
+#include <set>
 #include <vector>
 #include <queue>
-#include <unordered_set>
 #include <list>
 #include <boost/log/trivial.hpp>
 #include <memory>
 #include <mutex>
+#include <condition_variable>
 #include <future>
 #include <thread>
 #include <string>
 #include <iostream>
 #include <cassert>
+#include <chrono>
+#include <limits>
+
+/** \brief The processing applied to each built event before it is written.
+
+ The FPN is always subtracted first. Then the pedestals are subtracted, if a table was given, and then the threshold is
+ applied, if it is enabled, so the threshold is compared with the pedestal-subtracted samples.
+
+ */
+struct ProcessingOptions
+{
+    //! \brief The pedestal of each channel, or null to leave the pedestals in.
+    std::shared_ptr<const LookupTable<sample_t>> pedestals;
+
+    //! \brief Zero the samples that are below `threshold`.
+    bool applyThreshold = false;
+    sample_t threshold = 0;
+};
+
+//! \brief Options that control how the Merger reads its input.
+struct MergerOptions
+{
+    //! \brief Read the GRAW files through a memory mapping (MappedGRAWFile) instead of a filestream.
+    bool useMappedFiles = false;
+
+    //! \brief The maximum number of threads used to index the files before merging.
+    unsigned indexThreads = 4;
+
+    /** \brief The maximum number of partially-built events the EventBuilder holds before emitting the oldest one.
+
+     Each event takes Event::BytesPerAsad() (about 280 kB) for every AsAd in the run, and the event pool keeps a spare
+     for every event that can be in flight, which is this plus 40, plus 6 per processing thread. So each extra pending
+     event costs about 2.7 MB for a 10-AsAd run, or 11 MB for the full detector.
+
+     */
+    size_t maxPendingEvents = 10;
+
+    //! \brief How long (in seconds) an event may wait for missing frames before it is emitted anyway.
+    double eventTimeout = 1.0;
+
+    //! \brief The number of EventProcessor threads that process built events before they are written.
+    unsigned processThreads = 1;
+
+    //! \brief What the EventProcessor threads do to each event.
+    ProcessingOptions processing;
+
+    //! \brief How the events are stored in the output file.
+    HDFWriteOptions output;
+};
+
+//! \brief A built event, numbered in the order the EventBuilder emitted it.
+struct SequencedEvent
+{
+    uint64_t seq = 0;
+    Event evt;
+};
 
 class Merger
 {
 public:
-    Merger(const std::vector<std::string>& filePaths, const std::shared_ptr<PadLookupTable>& lt);
+    Merger(const std::vector<std::string>& filePaths, const std::shared_ptr<PadLookupTable>& lt,
+           const MergerOptions& opts = MergerOptions());
     void MergeByEvtId(const std::string& outfilename);
 
 private:
     std::shared_ptr<SyncQueue<RawFrame>> frameQueue;
+    std::shared_ptr<SyncQueue<SequencedEvent>> builtQueue;
     std::shared_ptr<SyncQueue<Event>> eventQueue;
+    std::shared_ptr<ReorderBuffer<Event>> reorderBuffer;
+    std::shared_ptr<EventPool> eventPool;
     std::shared_ptr<PadLookupTable> lookupTable;
     std::vector<std::shared_ptr<GRAWFile>> files;
 
+    //! \brief The number of built events that may wait for the writer. Events are large, so this is kept small.
+    static const size_t eventQueueCapacity;
+
+    //! \brief The number of built events that may wait for a processor.
+    static const size_t builtQueueCapacity;
+
+    //! \brief Warn if the events in flight can take more memory than this, in MB.
+    static const double eventMemoryWarningMB;
+
     FileIndex findex;
 
+    /** \brief How far apart (in events) the file readers may get.
+
+     The EventBuilder must be able to hold the events in the window plus the events the slowest reader is still
+     finishing, so this is half of MergerOptions::maxPendingEvents.
+
+     */
+    size_t readerWindowWidth;
+
+    size_t maxPendingEvents;
+    double eventTimeout;
+    unsigned processThreads;
+    ProcessingOptions processingOptions;
+    HDFWriteOptions outputOptions;
+
+    //! \brief Time spent opening and indexing the files in the constructor, in seconds.
+    double indexSeconds = 0;
+
     //! \brief Creates the progress bar in the terminal
     void ShowProgress(uint64_t currEvt, uint64_t numEvt);
 };
@@ -73,45 +164,271 @@ private:
     std::thread thr;
 };
 
+/** \brief Keeps the file readers close to each other in the event sequence.
+
+ Each reader reports the ordinal (position in the sorted list of event IDs) of the next frame it wants to push. A reader
+ is held back until that ordinal is less than `width` events ahead of the slowest reader that hasn't finished. This
+ bounds the number of partially-built events the EventBuilder has to hold at any time.
+
+ */
+class ReaderWindow
+{
+public:
+    ReaderWindow(const size_t numReaders, const size_t width)
+    : positions(numReaders, 0), width(width) {}
+
+    //! \brief Record that a reader is at the given ordinal, and wait until it may push that event's frames.
+    void advance(const size_t reader, const size_t ordinal);
+
+    //! \brief Record that a reader is done, so the others no longer wait for it.
+    void finish(const size_t reader);
+
+private:
+    size_t lowestPosition() const;
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::vector<size_t> positions;
+    size_t width;
+};
+
+/** \brief Reads the frames of one GRAW file and pushes them into the frame queue.
+
+ Frames are read in event order using the file's frame index, seeking only when a frame is not the next one in the
+ file. All of the file's frames for one event are pushed into the queue together as a batch. There is one of these per
+ input file, so the files are read concurrently.
+
+ */
+class FileReader : public Worker
+{
+public:
+    FileReader(const std::shared_ptr<GRAWFile>& file, const FileIndex::FrameList& frames,
+               const std::vector<evtid_t>& eventIds, const std::shared_ptr<SyncQueue<RawFrame>>& rawFrameQueue,
+               ReaderWindow& window, const size_t readerId)
+    : file(file), frames(frames), eventIds(eventIds), rawFrameQueue(rawFrameQueue), window(window),
+      readerId(readerId) {}
+    virtual ~FileReader() = default;
+
+    void run() override;
+
+private:
+    std::shared_ptr<GRAWFile> file;
+    FileIndex::FrameList frames;
+    const std::vector<evtid_t>& eventIds;
+    std::shared_ptr<SyncQueue<RawFrame>> rawFrameQueue;
+    ReaderWindow& window;
+    size_t readerId;
+};
+
+/** \brief Assembles frames into events and sends the events on to be processed.
+
+ The builder is told which (CoBo, AsAd) sources appear in the run, and an event is emitted as soon as it has a frame
+ from each of them. If some frames never arrive, the event is emitted anyway once it has waited longer than the
+ timeout, or once more than `maxPendingEvents` events are pending (lowest event ID first). Anything still pending when
+ the input runs out is emitted at the end. The timeout only counts time the builder spends on its input: while it is
+ blocked on a full output queue, the missing frames may be sitting in the input queue, so pending events don't age.
+
+ A frame that arrives after its event was emitted can't be added to it any more, so it is dropped and counted as a
+ late frame.
+
+ */
 class EventBuilder : public Worker
 {
 public:
+    //! \brief Counters describing how the events were emitted.
+    struct Stats
+    {
+        uint64_t eventsEmitted = 0;
+
+        //! \brief Events that were emitted without a frame from every expected source.
+        uint64_t incompleteEvents = 0;
+
+        //! \brief Frames that were dropped because their event had already been emitted.
+        uint64_t lateFrames = 0;
+
+        //! \brief Partial-readout frames whose hit patterns didn't match the channels they had data for.
+        uint64_t hitPatternMismatchFrames = 0;
+
+        //! \brief Over those frames, the channels marked as hit that had no data, and the reverse.
+        uint64_t missingHitChannels = 0;
+        uint64_t unexpectedHitChannels = 0;
+
+        //! \brief Sum over all events of the time from their first frame to their emission, in seconds.
+        double totalEmitLatency = 0;
+        double maxEmitLatency = 0;
+
+        double meanEmitLatency() const { return eventsEmitted > 0 ? totalEmitLatency / eventsEmitted : 0; }
+    };
+
     EventBuilder(const std::shared_ptr<SyncQueue<RawFrame>>& rawFrameQueue,
-                 const std::shared_ptr<SyncQueue<Event>>& outputQueue,
-                 const std::shared_ptr<PadLookupTable>& lookupTable)
-    : rawFrameQueue(rawFrameQueue), outputQueue(outputQueue),
-      eventCache(10, std::bind(&EventBuilder::processAndOutputEvent, this, std::placeholders::_1)),
-      lookupTable(lookupTable) {}
+                 const std::shared_ptr<SyncQueue<SequencedEvent>>& outputQueue,
+                 const std::shared_ptr<PadLookupTable>& lookupTable,
+                 const std::shared_ptr<EventPool>& eventPool,
+                 const std::set<std::pair<addr_t, addr_t>>& expectedSources,
+                 const size_t maxPendingEvents, const double timeout);
     EventBuilder(EventBuilder&&) = default;
     virtual ~EventBuilder() = default;
 
     void run() override;
-    Event* makeNewEvent(const evtid_t evtid);
     bool eventWasAlreadyWritten(const evtid_t evtid) const;
-    void processAndOutputEvent(Event&& evt);
+
+    //! \brief Number a finished event and stage it to be sent to the processors with the next batch.
+    void outputEvent(Event&& evt);
+
+    //! \brief Counters for this builder. Only meaningful once run() has returned.
+    const Stats& getStats() const { return stats; }
+
+    //! \brief The maximum number of frames taken from the input queue at once.
+    static const size_t frameBatchSize;
 
 private:
+    using Clock = std::chrono::steady_clock;
+
+    //! \brief A bit mask with one bit per (CoBo, AsAd) source.
+    using SourceMask = uint64_t;
+
+    //! \brief Returns the bit for the given source, or 0 if it is out of range.
+    static SourceMask SourceBit(const addr_t cobo, const addr_t asad);
+
+    struct PendingEvent
+    {
+        Event evt;
+        SourceMask sourcesSeen;
+        Clock::time_point firstFrameTime;
+        Clock::duration blockedBefore;  // the value of `blockedTime` when the first frame arrived
+    };
+
+    using PendingMap = std::map<evtid_t, PendingEvent>;
+
+    void addFrame(const RawFrame& raw);
+
+    //! \brief Remove an event from the pending map and emit it.
+    void emitEvent(const PendingMap::iterator& iter);
+
+    //! \brief Emit events that have waited too long, and the oldest events if there are too many.
+    void emitStaleEvents();
+
+    //! \brief Send the staged events to the output queue, adding the time spent waiting for room to `blockedTime`.
+    void flushOutputBatch();
+
     std::shared_ptr<SyncQueue<RawFrame>> rawFrameQueue;
-    std::shared_ptr<SyncQueue<Event>> outputQueue;
-    LRUCache<evtid_t, Event> eventCache;
+    std::shared_ptr<SyncQueue<SequencedEvent>> outputQueue;
     std::shared_ptr<PadLookupTable> lookupTable;
-    std::unordered_set<evtid_t> finishedEventIds;
+    std::shared_ptr<EventPool> eventPool;
+    EventIdWindow finishedEventIds;
+    std::vector<SequencedEvent> outputBatch;
+    DecodedItems decodedItems;  // scratch space for decoding each frame's items
+    uint64_t nextSeq;
+
+    PendingMap pendingEvents;
+    SourceMask expectedSources;
+    size_t numExpectedSources;
+    size_t maxPendingEvents;
+    Clock::duration timeout;
+
+    //! \brief Total time spent waiting for the output queue. Events don't age while the builder is blocked downstream.
+    Clock::duration blockedTime;
+
+    Stats stats;
+};
+
+/** \brief Applies the processing chain (currently FPN subtraction) to built events.
+
+ Any number of these may run at once. Each one takes events from the EventBuilder's output queue and puts the
+ processed events into a ReorderBuffer, which passes them on to the writer in the order the builder emitted them.
+
+ */
+class EventProcessor : public Worker
+{
+public:
+    EventProcessor(const std::shared_ptr<SyncQueue<SequencedEvent>>& inputQueue,
+                   const std::shared_ptr<ReorderBuffer<Event>>& reorderBuffer,
+                   const ProcessingOptions& opts = ProcessingOptions())
+    : inputQueue(inputQueue), reorderBuffer(reorderBuffer), opts(opts) {}
+    virtual ~EventProcessor() = default;
+
+    void run() override;
+
+    //! \brief Apply the processing chain to one event.
+    static void process(Event& evt, const ProcessingOptions& opts);
+
+    //! \brief The number of events this processor handled. Only meaningful once run() has returned.
+    uint64_t numProcessed() const { return eventsProcessed; }
+
+    //! \brief Time spent in process(), in seconds. Only meaningful once run() has returned.
+    double processSeconds() const { return busySeconds; }
+
+    //! \brief The maximum number of events taken from the input queue at once. Kept small to spread the load.
+    static const size_t eventBatchSize;
+
+private:
+    std::shared_ptr<SyncQueue<SequencedEvent>> inputQueue;
+    std::shared_ptr<ReorderBuffer<Event>> reorderBuffer;
+    ProcessingOptions opts;
+    uint64_t eventsProcessed = 0;
+    double busySeconds = 0;
 };
 
+/** \brief Writes the processed events to the HDF5 file.
+
+ Writing is double-buffered. This thread serializes each event into a staging buffer and hands the event's storage
+ straight back to the pool. Once the buffer holds `HDFWriteOptions::batchTraces` traces, it is passed to a second
+ thread that writes it to the file with HDFDataStore::writeBatch, while this thread fills the other buffer. So the
+ stages upstream only stall if HDF5 falls a whole buffer behind.
+
+ */
 class HDFWriter : public Worker
 {
 public:
+    //! \brief Where the writer's time went. Only meaningful once run() has returned.
+    struct Stats
+    {
+        //! \brief Time the HDF5 thread spent writing, in seconds.
+        double hdfSeconds = 0;
+
+        //! \brief Time spent waiting for events to write.
+        double inputWaitSeconds = 0;
+
+        //! \brief Time spent waiting for the HDF5 thread to finish with a buffer.
+        double bufferWaitSeconds = 0;
+
+        uint64_t buffersWritten = 0;
+
+        //! \brief Events that failed to be written, and so are missing from the file.
+        uint64_t eventsFailed = 0;
+    };
+
     HDFWriter(const std::string& filePath,
-              const std::shared_ptr<SyncQueue<Event>>& outputQueue)
-    : hfile(filePath, true), eventQueue(outputQueue), numEvtsWritten(0) {}
+              const std::shared_ptr<SyncQueue<Event>>& outputQueue,
+              const std::shared_ptr<EventPool>& eventPool,
+              const HDFWriteOptions& opts = HDFWriteOptions());
     virtual ~HDFWriter() = default;
 
     void run() override;
 
+    const Stats& getStats() const { return stats; }
+
+    //! \brief The maximum number of events taken from the input queue at once.
+    static const size_t eventBatchSize;
+
 private:
+    //! \brief Write the full buffers until there are no more. This runs on its own thread.
+    void writeBuffers();
+
+    //! \brief Pass the buffer being filled to the HDF5 thread, and wait for an empty one to fill next.
+    void swapBuffers();
+
     HDFDataStore hfile;
     std::shared_ptr<SyncQueue<Event>> eventQueue;
-    evtid_t numEvtsWritten;
+    std::shared_ptr<EventPool> eventPool;
+    hsize_t bufferTraces;
+    uint64_t numEvtsWritten;
+
+    HDFDataStore::EventBatch filling;
+    SyncQueue<HDFDataStore::EventBatch> fullBuffers;
+    SyncQueue<HDFDataStore::EventBatch> emptyBuffers;
+
+    Stats stats;
 };
 
 #endif /* defined(MERGER_H) */
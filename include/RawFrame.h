@@ -2,31 +2,52 @@
 #define RAWFRAME_H
 
 #include <memory>
+#include <cstdint>
 
 class RawFrame
 {
 public:
-    RawFrame() : data_size(0) {}
-    RawFrame(const size_t size) : data(new uint8_t[size]), data_size(size) {}
+    RawFrame() : data_ptr(nullptr), data_size(0) {}
+    RawFrame(const size_t size) : storage(new uint8_t[size]), data_ptr(storage.get()), data_size(size) {}
+
+    /** \brief Construct a non-owning view of a frame that lives in someone else's buffer.
+
+     No data is copied. The `owner` pointer keeps the underlying buffer (e.g. a memory-mapped file) alive for as long
+     as this frame exists, so the view stays valid even if the file it came from is closed in the meantime.
+
+     */
+    RawFrame(const uint8_t* ptr, const size_t size, const std::shared_ptr<const void>& owner)
+    : data_ptr(ptr), data_size(size), owner(owner) {}
+
     RawFrame(RawFrame&&) = default;
 
     RawFrame& operator=(RawFrame&& rhs) = default;
 
-    typedef uint8_t* iterator;
     typedef const uint8_t* const_iterator;
 
-    iterator begin() { return data.get(); }
-    iterator end() { return data.get() + data_size; }
-    const_iterator begin() const { return data.get(); }
-    const_iterator end() const { return data.get() + data_size; }
+    const_iterator begin() const { return data_ptr; }
+    const_iterator end() const { return data_ptr + data_size; }
 
-    uint8_t* getRawPointer() { return data.get(); }
+    const uint8_t* getRawPointer() const { return data_ptr; }
+
+    /** \brief The frame's own buffer, for filling it in.
+
+     A view may refer to read-only memory (like a file mapped with PROT_READ), so it can't be written through, and
+     this returns nullptr for it.
+
+     */
+    uint8_t* getWritablePointer() { return storage.get(); }
 
     size_t size() const { return data_size; }
 
+    //! \brief True if this frame refers to memory it does not own.
+    bool isView() const { return owner != nullptr; }
+
 private:
-    std::unique_ptr<uint8_t> data;
+    std::unique_ptr<uint8_t[]> storage;
+    const uint8_t* data_ptr;
     size_t data_size;
+    std::shared_ptr<const void> owner;
 };
 
 #endif /* end of include guard: RAWFRAME_H */
@@ -0,0 +1,74 @@
+#ifndef REORDERBUFFER_H
+#define REORDERBUFFER_H
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include "SyncQueue.h"
+
+/** \brief Puts items that were processed in parallel back into their original order.
+
+ Each item is numbered, starting from zero, before it is handed to the workers. When a worker is done with an item, it
+ puts it here with its number. Items are passed on to the output queue in numerical order: an item is held until every
+ item before it has arrived, and then the whole run of consecutive items is sent at once.
+
+ At most `capacity` numbers past the next one due out may be held. A worker putting an item further ahead than that
+ waits until the items before it catch up. The item that is due next is never held back, so this can't deadlock as
+ long as every number is eventually put.
+
+ */
+template <typename T>
+class ReorderBuffer
+{
+public:
+    ReorderBuffer(const std::shared_ptr<SyncQueue<T>>& output, const size_t capacity)
+    : output(output), capacity(std::max<size_t>(1, capacity)), nextSeq(0), maxHeld(0) {}
+
+    ReorderBuffer(const ReorderBuffer&) = delete;
+    ReorderBuffer& operator=(const ReorderBuffer&) = delete;
+
+    //! \brief Add the item with the given number, passing it and any items it was holding up to the output.
+    void put(const uint64_t seq, T&& item)
+    {
+        std::unique_lock<std::mutex> lock {mtx};
+        cond.wait(lock, [this, seq]{ return seq < nextSeq + capacity; });
+
+        held.emplace(seq, std::move(item));
+        maxHeld = std::max(maxHeld, held.size());
+        if (seq != nextSeq) return;
+
+        for (auto iter = held.begin(); iter != held.end() && iter->first == nextSeq; iter = held.erase(iter)) {
+            ready.push_back(std::move(iter->second));
+            nextSeq++;
+        }
+
+        // Hand the run over while still holding the lock, so that runs can't overtake each other.
+        output->putBatch(ready);
+        cond.notify_all();
+    }
+
+    //! \brief The most items that were held at once, waiting for earlier ones.
+    size_t maxItemsHeld() const
+    {
+        std::lock_guard<std::mutex> lock {mtx};
+        return maxHeld;
+    }
+
+private:
+    std::shared_ptr<SyncQueue<T>> output;
+    const size_t capacity;
+
+    mutable std::mutex mtx;
+    std::condition_variable cond;
+    std::map<uint64_t, T> held;
+    std::vector<T> ready;
+    uint64_t nextSeq;
+    size_t maxHeld;
+};
+
+#endif /* end of include guard: REORDERBUFFER_H */
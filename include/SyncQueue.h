@@ -2,9 +2,14 @@
 #define SYNCQUEUE_H
 
 #include <thread>
+#include <atomic>
+#include <mutex>
 #include <condition_variable>
-#include <list>
+#include <chrono>
+#include <memory>
 #include <exception>
+#include <cstddef>
+#include <vector>
 
 class NoMoreTasks : public std::exception
 {
@@ -12,51 +17,283 @@ public:
     virtual const char* what() const noexcept { return "End of Queue"; }
 };
 
+/** \brief A bounded, thread-safe queue used to pass work between threads.
+
+ This is a lock-free multi-producer, multi-consumer ring buffer (the algorithm is Dmitry Vyukov's bounded MPMC queue).
+ Each slot carries a sequence number that tells producers and consumers whether it is free or full, so put and get
+ only contend on a single atomic increment. No memory is allocated after construction.
+
+ When the queue is full (for put) or empty (for get), the calling thread spins briefly, then yields, and finally
+ blocks on a condition variable. The other side only takes the lock to wake it if someone is actually waiting.
+
+ Items can also be moved in and out in batches with putBatch and getBatch. A batch claims a whole run of slots with one
+ atomic operation and wakes the other side at most once, which is much cheaper than handling the items one at a time.
+
+ Once the producers are done, call finish(). It waits until the queue is drained, and then any thread waiting in get
+ (or calling it later) gets a NoMoreTasks exception.
+
+ */
 template<typename T>
 class SyncQueue {
 public:
-    SyncQueue() : finished(false) {}
+    //! \brief Create a queue that holds at least `capacity` items. The capacity is rounded up to a power of two.
+    explicit SyncQueue(const size_t capacity = 100)
+    : enqueuePos(0), dequeuePos(0), finished(false), waitingGetters(0), waitingPutters(0)
+    {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    SyncQueue(const SyncQueue&) = delete;
+    SyncQueue& operator=(const SyncQueue&) = delete;
 
     void put(const T& task)
     {
-        std::unique_lock<std::mutex> lock(qmtx);
-        cond.wait(lock, [this]{ return q.size() < 100; });
-        q.push_back(task);
-        cond.notify_all();
+        T copy {task};
+        put(std::move(copy));
     }
 
     void put(T&& task)
     {
-        std::unique_lock<std::mutex> lock(qmtx);
-        cond.wait(lock, [this]{ return q.size() < 100; });
-        q.push_back(std::move(task));
-        cond.notify_all();
+        if (!tryPut(task)) {
+            waitUntil(notFull, waitingPutters, [this, &task]{ return tryPut(task); });
+        }
+        wake(notEmpty, waitingGetters);
     }
 
     void get(T& dest)
     {
-        std::unique_lock<std::mutex> lock(qmtx);
-        cond.wait(lock, [this]{ return !q.empty() || finished; });
-        if (finished) throw NoMoreTasks();
-        dest = std::move(q.front());
-        q.pop_front();
-        cond.notify_all();
+        bool gotItem = tryGet(dest);
+        if (!gotItem) {
+            waitUntil(notEmpty, waitingGetters, [this, &dest, &gotItem]{
+                gotItem = tryGet(dest);
+                return gotItem || finished.load();
+            });
+        }
+        if (!gotItem) throw NoMoreTasks();
+        wake(notFull, waitingPutters);
     }
 
     void finish()
     {
-        std::unique_lock<std::mutex> lock {qmtx};
-        cond.wait(lock, [this]{ return q.empty(); });
-        finished = true;
-        cond.notify_all();
+        waitUntil(notFull, waitingPutters, [this]{ return empty(); });
+        finished.store(true);
+
+        std::lock_guard<std::mutex> lock {waitMtx};
+        notEmpty.notify_all();
+    }
+
+    /** \brief Add all of the given items, in order, waiting for room as needed.
+
+     As many items as there are free slots are claimed at once, so a batch costs about as much synchronization as a
+     single put. If the queue can't hold the whole batch, other producers' items may end up between parts of it.
+
+     The items are moved from, and `items` is left empty.
+
+     */
+    void putBatch(std::vector<T>& items)
+    {
+        size_t done = 0;
+        while (done < items.size()) {
+            done += tryPutBatch(items, done);
+            if (done < items.size()) {
+                // Wait for any room at all, then hand over what fits so the consumers can get started.
+                waitUntil(notFull, waitingPutters, [this, &items, &done]{
+                    size_t count = tryPutBatch(items, done);
+                    done += count;
+                    return count > 0;
+                });
+            }
+            wake(notEmpty, waitingGetters);
+        }
+        items.clear();
+    }
+
+    /** \brief Remove up to `maxItems` items at once, waiting until there is at least one.
+
+     The contents of `dest` are replaced by the items, in queue order.
+
+     \return The number of items in `dest`.
+     \throws NoMoreTasks If the queue is empty and finish() was called.
+
+     */
+    size_t getBatch(std::vector<T>& dest, const size_t maxItems)
+    {
+        dest.clear();
+        if (tryGetBatch(dest, maxItems) == 0) {
+            waitUntil(notEmpty, waitingGetters, [this, &dest, maxItems]{
+                return tryGetBatch(dest, maxItems) > 0 || finished.load();
+            });
+        }
+        if (dest.empty()) throw NoMoreTasks();
+        wake(notFull, waitingPutters);
+        return dest.size();
+    }
+
+    //! \brief Try to add an item without waiting. On success, the item is moved from.
+    bool tryPut(T& task)
+    {
+        size_t pos;
+        if (claim(enqueuePos, 0, 1, pos) == 0) return false;
+
+        Cell& cell = cells[pos & mask];
+        cell.data = std::move(task);
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    //! \brief Try to remove an item without waiting.
+    bool tryGet(T& dest)
+    {
+        size_t pos;
+        if (claim(dequeuePos, 1, 1, pos) == 0) return false;
+
+        Cell& cell = cells[pos & mask];
+        dest = std::move(cell.data);
+        cell.sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    //! \brief True if nothing is in the queue or being added to it. This is only a snapshot.
+    bool empty() const
+    {
+        return dequeuePos.load() == enqueuePos.load();
     }
 
+    //! \brief The number of items the queue can hold.
+    size_t capacity() const { return mask + 1; }
+
 private:
-    std::mutex qmtx;
-    std::condition_variable cond;
-    std::list<T> q;
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    /** \brief Claim a run of up to `maxCount` consecutive slots.
+
+     A slot at position `pos` is ready for us when its sequence number is `pos + readyOffset`: 0 for producers looking
+     for free slots, and 1 for consumers looking for full ones. The run is claimed with a single compare-and-swap of
+     `counter`, so nobody else can touch those slots until we release them by updating their sequence numbers.
+
+     \return The number of slots claimed. The first one is at `first`.
+
+     */
+    size_t claim(std::atomic<size_t>& counter, const size_t readyOffset, const size_t maxCount, size_t& first)
+    {
+        size_t pos = counter.load(std::memory_order_relaxed);
+        while (true) {
+            size_t count = 0;
+            bool stale = false;
+            while (count < maxCount) {
+                size_t seq = cells[(pos + count) & mask].sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + count + readyOffset);
+                if (diff == 0) {
+                    count++;
+                }
+                else {
+                    // diff > 0 means someone else already claimed this slot, so our position is out of date.
+                    // diff < 0 means the queue is full (for producers) or empty (for consumers) from here on.
+                    stale = (diff > 0 && count == 0);
+                    break;
+                }
+            }
+
+            if (stale) {
+                pos = counter.load(std::memory_order_relaxed);
+            }
+            else if (count == 0) {
+                return 0;
+            }
+            else if (counter.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                first = pos;
+                return count;
+            }
+        }
+    }
+
+    //! \brief Move as many of `items` (starting at `offset`) into the queue as there is room for.
+    size_t tryPutBatch(std::vector<T>& items, const size_t offset)
+    {
+        size_t pos;
+        size_t count = claim(enqueuePos, 0, items.size() - offset, pos);
+        for (size_t i = 0; i < count; i++) {
+            Cell& cell = cells[(pos + i) & mask];
+            cell.data = std::move(items[offset + i]);
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return count;
+    }
+
+    //! \brief Append up to `maxItems` items to `dest`, without waiting.
+    size_t tryGetBatch(std::vector<T>& dest, const size_t maxItems)
+    {
+        size_t pos;
+        size_t count = claim(dequeuePos, 1, maxItems, pos);
+        for (size_t i = 0; i < count; i++) {
+            Cell& cell = cells[(pos + i) & mask];
+            dest.push_back(std::move(cell.data));
+            cell.sequence.store(pos + i + mask + 1, std::memory_order_release);
+        }
+        return count;
+    }
+
+    //! \brief Spin, then yield, then block until `ready` returns true.
+    template <typename Pred>
+    void waitUntil(std::condition_variable& cond, std::atomic<int>& waiters, Pred ready)
+    {
+        for (int i = 0; i < spinCount; i++) {
+            if (ready()) return;
+        }
+        for (int i = 0; i < yieldCount; i++) {
+            std::this_thread::yield();
+            if (ready()) return;
+        }
+
+        std::unique_lock<std::mutex> lock {waitMtx};
+        waiters++;
+        // The timeout is a backstop in case a wakeup races with us registering as a waiter.
+        while (!ready()) {
+            cond.wait_for(lock, std::chrono::milliseconds(1));
+        }
+        waiters--;
+    }
+
+    //! \brief Wake a thread waiting on `cond`, if there is one.
+    void wake(std::condition_variable& cond, std::atomic<int>& waiters)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load() > 0) {
+            std::lock_guard<std::mutex> lock {waitMtx};
+            cond.notify_all();
+        }
+    }
+
+    static const int spinCount = 64;
+    static const int yieldCount = 64;
+
+    // Keep the two indices on separate cache lines so producers and consumers don't false-share.
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    char pad0[64];
+    std::atomic<size_t> enqueuePos;
+    char pad1[64];
+    std::atomic<size_t> dequeuePos;
+    char pad2[64];
+
+    std::atomic<bool> finished;
 
-    bool finished;
+    std::mutex waitMtx;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::atomic<int> waitingGetters;
+    std::atomic<int> waitingPutters;
 };
 
 #endif //SYNCQUEUE_H
@@ -0,0 +1,36 @@
+#ifndef TRACEKERNELS_H
+#define TRACEKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include "Constants.h"
+
+/** \brief Elementwise operations on arrays of samples, used to process the traces in an event.
+
+ On x86, these use SSE2, which every 64-bit x86 CPU has, so no runtime dispatch is needed. Elsewhere, they fall back
+ to plain loops. Both give identical results. Additions and subtractions wrap around like sample_t arithmetic does,
+ so the results match doing the same operation one sample at a time.
+
+ */
+namespace TraceKernels {
+
+    //! \brief Adds `trace` to `sum`, and adds one to `count` wherever `trace` is nonzero.
+    void AccumulateWithCount(sample_t* sum, int16_t* count, const sample_t* trace, const size_t n);
+
+    //! \brief Divides each value by its count, truncating toward zero. Values with a count of zero are left alone.
+    void DivideByCount(sample_t* vals, const int16_t* count, const size_t n);
+
+    //! \brief Finds the sum of the values and the number of them that are nonzero.
+    void SumNonzero(const sample_t* vals, const size_t n, int64_t& total, int64_t& numNonzero);
+
+    //! \brief Subtracts `offset` from each value.
+    void SubtractScalar(sample_t* vals, const sample_t offset, const size_t n);
+
+    //! \brief Subtracts `vals` from `trace`, elementwise.
+    void Subtract(sample_t* trace, const sample_t* vals, const size_t n);
+
+    //! \brief Sets each value that is less than `threshold` to zero.
+    void ZeroBelow(sample_t* vals, const sample_t threshold, const size_t n);
+}
+
+#endif /* end of include guard: TRACEKERNELS_H */
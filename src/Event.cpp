@@ -1,24 +1,28 @@
 #include "Event.h"
+#include "TraceKernels.h"
 
 // --------
 // Constructors, Move, and Copy
 // --------
 
 Event::Event()
-: eventId(0),eventTime(0),lookupTable(nullptr),nFramesAppended(0)
+: eventId(0),eventTime(0),lookupTable(nullptr),nFramesAppended(0),nTraces(0)
 {
+    blockIndex.fill(noBlock);
 }
 
 Event::Event(const Event& orig)
-: eventId(orig.eventId),eventTime(orig.eventTime),lookupTable(orig.lookupTable),nFramesAppended(orig.nFramesAppended)
+: eventId(orig.eventId),eventTime(orig.eventTime),lookupTable(orig.lookupTable),nFramesAppended(orig.nFramesAppended),
+  blockIndex(orig.blockIndex),blocks(orig.blocks),nTraces(orig.nTraces)
 {
-    data = orig.data;
 }
 
 Event::Event(Event&& orig)
-: eventId(orig.eventId),eventTime(orig.eventTime),lookupTable(orig.lookupTable),nFramesAppended(orig.nFramesAppended)
+: eventId(orig.eventId),eventTime(orig.eventTime),lookupTable(orig.lookupTable),nFramesAppended(orig.nFramesAppended),
+  blockIndex(orig.blockIndex),blocks(std::move(orig.blocks)),nTraces(orig.nTraces)
 {
-    data = std::move(orig.data);
+    orig.blockIndex.fill(noBlock);
+    orig.nTraces = 0;
 }
 
 Event& Event::operator=(const Event& orig)
@@ -28,8 +32,9 @@ Event& Event::operator=(const Event& orig)
     this->eventTime = orig.eventTime;
     this->nFramesAppended = orig.nFramesAppended;
 
-    this->data.clear();
-    this->data = orig.data;
+    this->blockIndex = orig.blockIndex;
+    this->blocks = orig.blocks;
+    this->nTraces = orig.nTraces;
 
     return *this;
 }
@@ -41,30 +46,61 @@ Event& Event::operator=(Event&& orig)
     this->eventTime = orig.eventTime;
     this->nFramesAppended = orig.nFramesAppended;
 
-    this->data.clear();
-    this->data = std::move(orig.data);
+    this->blockIndex = orig.blockIndex;
+    this->blocks = std::move(orig.blocks);
+    this->nTraces = orig.nTraces;
+
+    orig.blockIndex.fill(noBlock);
+    orig.blocks.clear();
+    orig.nTraces = 0;
 
     return *this;
 }
 
-Event::mapType::iterator Event::begin()
+Event::iterator Event::begin()
+{
+    return iterator(this, 0);
+}
+
+Event::iterator Event::end()
+{
+    return iterator(this, numAsadSlots * tracesPerAsad);
+}
+
+Event::const_iterator Event::begin() const
 {
-    return data.begin();
+    return cbegin();
 }
 
-Event::mapType::iterator Event::end()
+Event::const_iterator Event::end() const
 {
-    return data.end();
+    return cend();
 }
 
-Event::mapType::const_iterator Event::cbegin() const
+Event::const_iterator Event::cbegin() const
 {
-    return data.cbegin();
+    return const_iterator(this, 0);
+}
+
+Event::const_iterator Event::cend() const
+{
+    return const_iterator(this, numAsadSlots * tracesPerAsad);
+}
+
+void Event::Clear()
+{
+    eventId = 0;
+    eventTime = 0;
+    nFramesAppended = 0;
+
+    blockIndex.fill(noBlock);
+    blocks.clear();  // keeps the capacity
+    nTraces = 0;
 }
 
-Event::mapType::const_iterator Event::cend() const
+void Event::Reserve(const size_t numAsads)
 {
-    return data.cend();
+    blocks.reserve(numAsads);
 }
 
 // --------
@@ -76,7 +112,7 @@ void Event::SetLookupTable(const std::shared_ptr<PadLookupTable>& table)
     lookupTable = table;
 }
 
-void Event::AppendFrame(const GRAWFrame& frame)
+Event::AsadBlock& Event::BeginFrame(const GRAWFrameHeader& header)
 {
     // Make sure pointers to required objects are valid
 
@@ -87,145 +123,315 @@ void Event::AppendFrame(const GRAWFrame& frame)
 
     // Get header information from frame
 
-    addr_t cobo = frame.coboId;
-    addr_t asad = frame.asadId;
+    addr_t cobo = header.coboId;
+    addr_t asad = header.asadId;
+
+    if (cobo >= Constants::num_cobos || asad >= Constants::num_asads) {
+        throw Exceptions::Bad_Data("Frame from CoBo " + std::to_string(cobo) + ", AsAd " + std::to_string(asad)
+                                   + " is outside the detector geometry");
+    }
 
     if (nFramesAppended == 0) {
-        this->eventId = frame.eventId;
+        this->eventId = header.eventId;
     }
-    else if (this->eventId != frame.eventId) {
+    else if (this->eventId != header.eventId) {
         BOOST_LOG_TRIVIAL(warning) << "Event ID mismatch: CoBo " << cobo << ", AsAd " << asad;
     }
 
     if (nFramesAppended == 0) {
-        this->eventTime = frame.eventTime;
+        this->eventTime = header.eventTime;
     }
 
     nFramesAppended++;
 
-    // Extract data items and create traces for them
+    return GetOrAddBlock(cobo, asad);
+}
 
-    for (auto frameIter = frame.cbegin(); frameIter < frame.cend(); frameIter++) {
-        const GRAWDataItem& dataItem = *frameIter;
-        // Extract information
-        auto aget = dataItem.agetId;
-        auto channel = dataItem.channel;
-        auto tbid = dataItem.timeBucketId;
-        auto sample = dataItem.sample;
+void Event::MarkAllPresent(AsadBlock& block, const addr_t cobo, const addr_t asad)
+{
+    for (addr_t aget = 0; aget < Constants::num_agets; aget++) {
+        for (addr_t channel = 0; channel < Constants::num_channels; channel++) {
+            MarkPresent(block, cobo, asad, aget, channel);
+        }
+    }
+}
 
-        auto pad = lookupTable->Find(cobo, asad, aget, channel);
+HitMask Event::MarkHitChannels(AsadBlock& block, const addr_t cobo, const addr_t asad, const HitMask& hits)
+{
+    HitMask before;
+    for (size_t w = 0; w < presenceWords; w++) {
+        before[w] = block.present[w];
+
+        // Look up the pads of the channels that are new to the event, in one pass over the set bits
+        uint64_t added = hits[w] & ~block.present[w];
+        block.present[w] |= added;
+        nTraces += static_cast<size_t>(__builtin_popcountll(added));
+        while (added != 0) {
+            const size_t idx = w * 64 + static_cast<size_t>(__builtin_ctzll(added));
+            block.pads[idx] = lookupTable->Find(cobo, asad, static_cast<addr_t>(idx / Constants::num_channels),
+                                                static_cast<addr_t>(idx % Constants::num_channels));
+            added &= added - 1;
+        }
+    }
+    return before;
+}
 
-        HardwareAddress hwaddr = {cobo, asad, aget, channel, pad};
+HitPatternMismatch Event::ReconcileHitChannels(AsadBlock& block, const addr_t cobo, const addr_t asad,
+                                               const HitMask& hits, const HitMask& before, const HitMask& found)
+{
+    HitPatternMismatch mismatch;
+    for (size_t w = 0; w < presenceWords; w++) {
+        const uint64_t missing = hits[w] & ~found[w];
+        uint64_t unexpected = found[w] & ~hits[w];
+        mismatch.nMissing += static_cast<size_t>(__builtin_popcountll(missing));
+        mismatch.nUnexpected += static_cast<size_t>(__builtin_popcountll(unexpected));
+
+        // Nothing was written to the channels without data, so their samples are still zero
+        const uint64_t unused = missing & ~before[w];
+        block.present[w] &= ~unused;
+        nTraces -= static_cast<size_t>(__builtin_popcountll(unused));
+
+        while (unexpected != 0) {
+            const size_t idx = w * 64 + static_cast<size_t>(__builtin_ctzll(unexpected));
+            MarkPresent(block, cobo, asad, static_cast<addr_t>(idx / Constants::num_channels),
+                        static_cast<addr_t>(idx % Constants::num_channels));
+            unexpected &= unexpected - 1;
+        }
+    }
+    return mismatch;
+}
 
-        // Find trace in hash table, if it exists
-        arma::Col<sample_t>& tr = data[hwaddr];
+HitPatternMismatch Event::AppendFrame(const GRAWFrame& frame)
+{
+    AsadBlock& block = BeginFrame(frame);
+    const addr_t cobo = frame.coboId;
+    const addr_t asad = frame.asadId;
+
+    if (frame.IsFullReadout()) {
+        // The frame's block already has the same layout as ours, so copy it in one go
+        MarkAllPresent(block, cobo, asad);
+        std::copy_n(frame.GetFullReadoutSamples().data(), GRAWFrame::fullReadoutBlockSize, block.samples);
+        return HitPatternMismatch();
+    }
 
-        if (tr.is_empty()) {
-            // The trace was just default-constructed, so it's new
-            tr.set_size(Constants::num_tbs);
-        }
+    // The frame has already checked that the AGET, channel, and time bucket of each item are in range
+    return AppendItems(block, cobo, asad, frame.GetItems(), frame.GetHitMask());
+}
+
+HitPatternMismatch Event::AppendRawFrame(const RawFrame& rawFrame)
+{
+    return AppendRawFrame(GRAWFrameView(rawFrame));
+}
+
+HitPatternMismatch Event::AppendRawFrame(const GRAWFrameView& frame)
+{
+    DecodedItems scratch;
+    return AppendRawFrame(frame, scratch);
+}
+
+HitPatternMismatch Event::AppendRawFrame(const GRAWFrameView& frame, DecodedItems& scratch)
+{
+    const GRAWFrameHeader& header = frame.GetHeader();
+    AsadBlock& block = BeginFrame(header);
+    const addr_t cobo = header.coboId;
+    const addr_t asad = header.asadId;
+    const uint8_t* data = frame.ItemData();
+
+    if (frame.IsFullReadout()) {
+        // Clear the block first, since samples missing from the frame are zero
+        MarkAllPresent(block, cobo, asad);
+        std::fill_n(block.samples, GRAWFrame::fullReadoutBlockSize, sample_t(0));
+        scratch.clear();
+        ItemDecoder::DecodeFullReadout(data, header.nItems, block.samples, scratch.nBadAget, scratch.nBadTB);
+        ItemDecoder::WarnInvalidItems(scratch, true);
+        return HitPatternMismatch();
+    }
+    if (frame.IsPartialReadout()) {
+        ItemDecoder::DecodePartialReadout(data, header.nItems, scratch);
+        ItemDecoder::WarnInvalidItems(scratch, false);
+        return AppendItems(block, cobo, asad, scratch, frame.GetHitMask());
+    }
+
+    return HitPatternMismatch();
+}
+
+HitPatternMismatch Event::AppendItems(AsadBlock& block, const addr_t cobo, const addr_t asad,
+                                      const DecodedItems& items, const HitMask& hits)
+{
+    const HitMask before = MarkHitChannels(block, cobo, asad, hits);
 
-        tr(tbid) = sample;
+    HitMask found {};
+    for (size_t i = 0; i < items.size(); i++) {
+        const size_t idx = items.aget[i] * Constants::num_channels + items.channel[i];
+        found[idx / 64] |= uint64_t(1) << (idx % 64);
+        block.samples[idx * Constants::num_tbs + items.tb[i]] = items.sample[i];
     }
+
+    return ReconcileHitChannels(block, cobo, asad, hits, before, found);
 }
 
 // --------
-// Getting Properties and Members
+// Trace Storage
 // --------
 
-arma::Col<sample_t>& Event::GetTrace(addr_t cobo, addr_t asad, addr_t aget, addr_t channel)
+bool Event::AddressIsValid(const addr_t cobo, const addr_t asad, const addr_t aget, const addr_t channel)
 {
-    pad_t pad = lookupTable->Find(cobo, asad, aget, channel);
-    HardwareAddress hwaddr {cobo, asad, aget, channel, pad};
-    return data.at(hwaddr);  // could throw out_of_range
+    return cobo < Constants::num_cobos && asad < Constants::num_asads
+           && aget < Constants::num_agets && channel < Constants::num_channels;
 }
 
-size_t Event::numTraces() const
+Event::AsadBlock* Event::FindBlock(const addr_t cobo, const addr_t asad)
+{
+    const uint8_t blockNum = blockIndex[cobo * Constants::num_asads + asad];
+    return blockNum == noBlock ? nullptr : &blocks[blockNum];
+}
+
+const Event::AsadBlock* Event::FindBlock(const addr_t cobo, const addr_t asad) const
 {
-    return data.size();
+    const uint8_t blockNum = blockIndex[cobo * Constants::num_asads + asad];
+    return blockNum == noBlock ? nullptr : &blocks[blockNum];
+}
+
+Event::AsadBlock& Event::GetOrAddBlock(const addr_t cobo, const addr_t asad)
+{
+    uint8_t& blockNum = blockIndex[cobo * Constants::num_asads + asad];
+    if (blockNum == noBlock) {
+        blockNum = static_cast<uint8_t>(blocks.size());
+        blocks.emplace_back();  // value-initialized, so every sample starts at zero
+    }
+    return blocks[blockNum];
 }
 
 // --------
-// Manipulation of Contained Data
+// Getting Properties and Members
 // --------
 
-static void renormalizeVectorToZero(arma::Col<sample_t> v)
+arma::Col<sample_t> Event::GetTrace(addr_t cobo, addr_t asad, addr_t aget, addr_t channel)
+{
+    if (!HasTrace(cobo, asad, aget, channel)) {
+        throw std::out_of_range("Trace not found in event");
+    }
+
+    AsadBlock* block = FindBlock(cobo, asad);
+    const size_t idx = aget * Constants::num_channels + channel;
+    return arma::Col<sample_t>(block->samples + idx * Constants::num_tbs, Constants::num_tbs, false, true);
+}
+
+bool Event::HasTrace(addr_t cobo, addr_t asad, addr_t aget, addr_t channel) const
+{
+    if (!AddressIsValid(cobo, asad, aget, channel)) return false;
+
+    const AsadBlock* block = FindBlock(cobo, asad);
+    if (block == nullptr) return false;
+
+    return IsPresent(*block, aget * Constants::num_channels + channel);
+}
+
+void Event::RemoveTrace(addr_t cobo, addr_t asad, addr_t aget, addr_t channel)
 {
-    arma::Col<sample_t> nz = arma::nonzeros(v);
-    int64_t total = arma::accu(nz);
-    int64_t nzCount = static_cast<int64_t>(nz.n_elem);
-    sample_t mean = narrow_cast<sample_t>(total / nzCount);
+    if (!HasTrace(cobo, asad, aget, channel)) return;
 
-    v -= mean;
+    RemoveFromBlock(*FindBlock(cobo, asad), aget * Constants::num_channels + channel);
 }
 
+void Event::RemoveFromBlock(AsadBlock& block, const size_t idx)
+{
+    if (!IsPresent(block, idx)) return;
+
+    block.present[idx / 64] &= ~(uint64_t(1) << (idx % 64));
+
+    // Clear the samples so the slot is clean if the trace is added again
+    std::fill_n(block.samples + idx * Constants::num_tbs, Constants::num_tbs, sample_t(0));
+    nTraces--;
+}
+
+size_t Event::numTraces() const
+{
+    return nTraces;
+}
+
+// --------
+// Manipulation of Contained Data
+// --------
+
 void Event::SubtractFPN()
 {
-    std::vector<addr_t> fpn_channels {11,22,45,56};  // from AGET Docs
-
-    for (addr_t cobo = 0; cobo < Constants::num_cobos; cobo++) {
-        for (addr_t asad = 0; asad < Constants::num_asads; asad++) {
-            for (addr_t aget = 0; aget < Constants::num_agets; aget++) {
-
-                // Get the FPN channels and find the mean.
-                // Each FPN channel may be missing different time buckets, so
-                // count the denom of the mean separately for each TB.
-
-                arma::Col<sample_t> mean_fpn (Constants::num_tbs, arma::fill::zeros);
-                arma::Col<int> tb_multip (Constants::num_tbs, arma::fill::zeros);
-
-                int num_fpns = 0;
-
-                for (auto ch : fpn_channels) {
-                    try {
-                        arma::Col<sample_t>& tr = GetTrace(cobo, asad, aget, ch);
-                        mean_fpn += tr;
-                        for (arma::uword i = 0; i < mean_fpn.n_elem; i++) {
-                            if (tr(i) != 0) {
-                                tb_multip(i) += 1;
-                            }
-                        }
-                        num_fpns++;
-                    }
-                    catch (std::out_of_range&) {
-                        continue;
-                    }
-                }
+    static const addr_t fpnChannels[] = {11, 22, 45, 56};  // from AGET Docs
 
-                // Check if there's any FPN data. If not, skip the next part.
+    for (AsadBlock& block : blocks) {
+        for (addr_t aget = 0; aget < Constants::num_agets; aget++) {
+            const size_t agetBegin = aget * Constants::num_channels;
 
-                if (num_fpns == 0) continue;
+            // Sum the FPN channels that are present. Each FPN channel may be missing different time buckets,
+            // so count the denominator of the mean separately for each TB.
 
-                // Divide by the multiplicity if that value is nonzero.
-                for (arma::uword i = 0; i < mean_fpn.n_elem; i++) {
-                    if (tb_multip(i) != 0) {
-                        mean_fpn(i) /= tb_multip(i);
-                    }
-                }
+            alignas(16) sample_t meanFpn[Constants::num_tbs] = {};
+            alignas(16) int16_t tbMultip[Constants::num_tbs] = {};
+            int numFpns = 0;
 
-                // Renormalize mean FPN to zero
-                renormalizeVectorToZero(mean_fpn);
+            for (const addr_t ch : fpnChannels) {
+                const size_t idx = agetBegin + ch;
+                if (!IsPresent(block, idx)) continue;
+                TraceKernels::AccumulateWithCount(meanFpn, tbMultip, block.samples + idx * Constants::num_tbs,
+                                                  Constants::num_tbs);
+                numFpns++;
+            }
 
-                // Now subtract this mean from the other channels, binwise.
-                // This iteration includes the FPN channels.
+            if (numFpns == 0) continue;
 
-                for (addr_t ch = 0; ch < Constants::num_channels; ch++) {
-                    try {
-                        auto tr = GetTrace(cobo, asad, aget, ch);
-                        tr -= mean_fpn;
-                    }
-                    catch (const std::out_of_range&) {
-                        continue;
-                    }
-                }
+            TraceKernels::DivideByCount(meanFpn, tbMultip, Constants::num_tbs);
 
-                // Finally, kill the traces that represent the FPN, since
-                // we don't need them for anything else
+            // Renormalize the mean FPN to zero. The sum is taken in 64 bits since it won't fit in a sample_t.
+            int64_t total, nzCount;
+            TraceKernels::SumNonzero(meanFpn, Constants::num_tbs, total, nzCount);
+            if (nzCount != 0) {
+                TraceKernels::SubtractScalar(meanFpn, static_cast<sample_t>(total / nzCount), Constants::num_tbs);
+            }
+
+            // Subtract the mean from the other channels of this AGET, then remove the FPN channels, since
+            // we don't need them for anything else.
 
-                for (auto ch : fpn_channels) {
-                    data.erase(HardwareAddress{cobo, asad, aget, ch, lookupTable->missingValue});
+            for (size_t idx = agetBegin; idx < agetBegin + Constants::num_channels; idx++) {
+                if (IsPresent(block, idx)) {
+                    TraceKernels::Subtract(block.samples + idx * Constants::num_tbs, meanFpn, Constants::num_tbs);
                 }
             }
+
+            for (const addr_t ch : fpnChannels) {
+                RemoveFromBlock(block, agetBegin + ch);
+            }
+        }
+    }
+}
+
+void Event::SubtractPedestals(const LookupTable<sample_t>& pedsTable)
+{
+    for (size_t asadSlot = 0; asadSlot < numAsadSlots; asadSlot++) {
+        if (blockIndex[asadSlot] == noBlock) continue;
+
+        AsadBlock& block = blocks[blockIndex[asadSlot]];
+        const addr_t cobo = static_cast<addr_t>(asadSlot / Constants::num_asads);
+        const addr_t asad = static_cast<addr_t>(asadSlot % Constants::num_asads);
+
+        for (size_t idx = 0; idx < tracesPerAsad; idx++) {
+            if (!IsPresent(block, idx)) continue;
+
+            const sample_t ped = pedsTable.Find(cobo, asad, static_cast<addr_t>(idx / Constants::num_channels),
+                                                static_cast<addr_t>(idx % Constants::num_channels));
+            if (ped != 0) {
+                TraceKernels::SubtractScalar(block.samples + idx * Constants::num_tbs, ped, Constants::num_tbs);
+            }
+        }
+    }
+}
+
+void Event::ApplyThreshold(const sample_t threshold)
+{
+    for (AsadBlock& block : blocks) {
+        for (size_t idx = 0; idx < tracesPerAsad; idx++) {
+            if (IsPresent(block, idx)) {
+                TraceKernels::ZeroBelow(block.samples + idx * Constants::num_tbs, threshold, Constants::num_tbs);
+            }
         }
     }
 }
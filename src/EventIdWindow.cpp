@@ -0,0 +1,62 @@
+#include "EventIdWindow.h"
+
+#include <algorithm>
+
+EventIdWindow::EventIdWindow(const size_t width)
+: low(0)
+{
+    size_t size = 64;
+    while (size < width) size <<= 1;
+
+    mask = size - 1;
+    bits.assign(size / 64, 0);
+}
+
+void EventIdWindow::insert(const evtid_t id)
+{
+    if (id < low) return;
+
+    if (id > low + mask) {
+        // Slide the window up so that `id` is the last ID in it. The slots of the IDs that fall off the bottom are
+        // reused for the new IDs at the top, so they must be cleared.
+        uint64_t newLow = uint64_t(id) - mask;
+        if (newLow - low > mask) {
+            std::fill(bits.begin(), bits.end(), 0);
+        }
+        else {
+            for (uint64_t i = low; i < newLow; i++) {
+                clearBit(i);
+            }
+        }
+        low = newLow;
+    }
+
+    setBit(id);
+    advanceWatermark();
+}
+
+void EventIdWindow::advanceWatermark()
+{
+    while (true) {
+        uint64_t& word = bits[(low & mask) >> 6];
+        if ((low & 63) == 0 && word == ~uint64_t(0)) {
+            // A whole word of consecutive finished IDs
+            word = 0;
+            low += 64;
+        }
+        else if (testBit(low)) {
+            clearBit(low);
+            low++;
+        }
+        else {
+            break;
+        }
+    }
+}
+
+bool EventIdWindow::contains(const evtid_t id) const
+{
+    if (id < low) return true;
+    if (id > low + mask) return false;
+    return testBit(id);
+}
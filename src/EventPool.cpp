@@ -0,0 +1,25 @@
+#include "EventPool.h"
+
+EventPool::EventPool(const size_t capacity)
+: spares(capacity), created(0), reused(0)
+{
+}
+
+Event EventPool::acquire()
+{
+    Event evt;
+    if (spares.tryGet(evt)) {
+        reused++;
+        evt.Clear();
+    }
+    else {
+        created++;
+    }
+    return evt;
+}
+
+void EventPool::release(Event&& evt)
+{
+    // If the pool is full, the event keeps its storage and is destroyed by the caller
+    spares.tryPut(evt);
+}
@@ -1,37 +1,296 @@
 #include "FileIndex.h"
 
-FileIndex::FileIndex(const std::vector<std::shared_ptr<GRAWFile>>& files)
+#include <fstream>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <boost/log/trivial.hpp>
+
+// --------
+// Sidecar format
+// --------
+//
+// All integers are little-endian.
+//
+//   Header (32 bytes):
+//     char[4]  magic        "GIDX"
+//     uint32   version      currently 1
+//     uint64   grawSize     size of the GRAW file in bytes
+//     int64    grawMtime    modification time of the GRAW file (seconds since the epoch)
+//     uint64   nFrames      number of entries that follow
+//
+//   Entry (26 bytes each):
+//     uint64   filePos
+//     uint64   evtTime      (only 48 bits are used)
+//     uint32   evtId
+//     uint32   size         in bytes
+//     uint8    cobo
+//     uint8    asad
+
+namespace {
+    const char sidecarMagic[4] = {'G', 'I', 'D', 'X'};
+    const uint32_t sidecarVersion = 1;
+    const size_t sidecarHeaderSize = 32;
+    const size_t sidecarEntrySize = 26;
+
+    template <typename T>
+    void PutLE(std::vector<char>& buf, T val, const size_t nBytes = sizeof(T))
+    {
+        for (size_t i = 0; i < nBytes; i++) {
+            buf.push_back(static_cast<char>((static_cast<uint64_t>(val) >> (8*i)) & 0xFF));
+        }
+    }
+
+    template <typename T>
+    T GetLE(const char* ptr, const size_t nBytes = sizeof(T))
+    {
+        uint64_t val = 0;
+        for (size_t i = 0; i < nBytes; i++) {
+            val |= static_cast<uint64_t>(static_cast<uint8_t>(ptr[i])) << (8*i);
+        }
+        return static_cast<T>(val);
+    }
+}
+
+boost::filesystem::path FileIndex::SidecarPath(const boost::filesystem::path& grawPath)
 {
-    indexFiles(files);
+    boost::filesystem::path result {grawPath};
+    result.replace_extension(".gidx");
+    return result;
+}
+
+bool FileIndex::ReadSidecar(const boost::filesystem::path& grawPath, FrameList& frames)
+{
+    namespace fs = boost::filesystem;
+
+    fs::path sidecarPath = SidecarPath(grawPath);
+    boost::system::error_code ec;
+    if (!fs::is_regular_file(sidecarPath, ec)) return false;
+
+    std::ifstream sidecar (sidecarPath.string(), std::ios::in|std::ios::binary);
+    if (!sidecar.good()) return false;
+
+    char header[sidecarHeaderSize];
+    if (!sidecar.read(header, sidecarHeaderSize)) return false;
+
+    if (std::memcmp(header, sidecarMagic, sizeof(sidecarMagic)) != 0) return false;
+    if (GetLE<uint32_t>(header + 4) != sidecarVersion) return false;
+
+    // Reject the sidecar if the GRAW file has changed since it was written
+    uint64_t grawSize = GetLE<uint64_t>(header + 8);
+    int64_t grawMtime = GetLE<int64_t>(header + 16);
+    if (grawSize != fs::file_size(grawPath, ec) || ec) return false;
+    if (grawMtime != static_cast<int64_t>(fs::last_write_time(grawPath, ec)) || ec) return false;
+
+    uint64_t nFrames = GetLE<uint64_t>(header + 24);
+    if (sidecarHeaderSize + nFrames*sidecarEntrySize != fs::file_size(sidecarPath, ec) || ec) return false;
+
+    std::vector<char> body (nFrames * sidecarEntrySize);
+    if (!sidecar.read(body.data(), static_cast<std::streamsize>(body.size()))) return false;
+
+    frames.clear();
+    frames.reserve(nFrames);
+    for (const char* ptr = body.data(); ptr < body.data() + body.size(); ptr += sidecarEntrySize) {
+        GRAWFile::FrameMetadata meta {};
+        meta.filePos = GetLE<std::streamoff>(ptr);
+        meta.evtTime = GetLE<ts_t>(ptr + 8);
+        meta.evtId = GetLE<evtid_t>(ptr + 16);
+        meta.size = GetLE<uint32_t>(ptr + 20);
+        meta.cobo = GetLE<addr_t>(ptr + 24);
+        meta.asad = GetLE<addr_t>(ptr + 25);
+
+        // A damaged or copied sidecar could point past the end of the file, and with --mmap, outside the mapping
+        if (meta.filePos < 0 || meta.size == 0 || static_cast<uint64_t>(meta.filePos) + meta.size > grawSize) {
+            BOOST_LOG_TRIVIAL(warning) << "Frame index " << sidecarPath.string() << " has a frame outside of "
+                                       << grawPath.string() << ". Rebuilding it.";
+            frames.clear();
+            return false;
+        }
+        frames.push_back(meta);
+    }
+
+    return true;
 }
 
-void FileIndex::indexFiles(const std::vector<std::shared_ptr<GRAWFile>>& files)
+void FileIndex::WriteSidecar(const boost::filesystem::path& grawPath, const FrameList& frames)
 {
-    const int indexDepth = 5*4;  // 4 AsAds => 4 frames, and read 5 events
+    namespace fs = boost::filesystem;
+
+    std::vector<char> buf;
+    buf.reserve(sidecarHeaderSize + frames.size()*sidecarEntrySize);
+
+    buf.insert(buf.end(), sidecarMagic, sidecarMagic + sizeof(sidecarMagic));
+    PutLE(buf, sidecarVersion);
+    PutLE(buf, static_cast<uint64_t>(fs::file_size(grawPath)));
+    PutLE(buf, static_cast<int64_t>(fs::last_write_time(grawPath)));
+    PutLE(buf, static_cast<uint64_t>(frames.size()));
 
-    for (const auto& file : files) {
-        // Read metadata for first `indexDepth` events
-        file->Rewind();
-        std::vector<GRAWFile::FrameMetadata> metas;
-        for (int i = 0; i < indexDepth; i++) {
-            metas.push_back(file->ReadFrameMetadata());
+    for (const auto& meta : frames) {
+        PutLE(buf, static_cast<uint64_t>(meta.filePos));
+        PutLE(buf, static_cast<uint64_t>(meta.evtTime));
+        PutLE(buf, meta.evtId);
+        PutLE(buf, meta.size);
+        PutLE(buf, meta.cobo);
+        PutLE(buf, meta.asad);
+    }
+
+    // Write to a temporary file and rename it so a partially-written sidecar is never picked up.
+    fs::path sidecarPath = SidecarPath(grawPath);
+    fs::path tempPath = sidecarPath;
+    tempPath += ".tmp";
+
+    {
+        std::ofstream sidecar (tempPath.string(), std::ios::out|std::ios::trunc|std::ios::binary);
+        sidecar.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+        if (!sidecar.good()) {
+            boost::system::error_code ec;
+            fs::remove(tempPath, ec);
+            throw Exceptions::File_Open_Failed(sidecarPath.string());
         }
+    }
+
+    boost::system::error_code ec;
+    fs::rename(tempPath, sidecarPath, ec);
+    if (ec) {
+        fs::remove(tempPath, ec);
+        throw Exceptions::File_Open_Failed(sidecarPath.string());
+    }
+}
+
+// --------
+// Indexing
+// --------
+
+FileIndex::FileIndex(const std::vector<std::shared_ptr<GRAWFile>>& files, const unsigned numThreads)
+{
+    indexFiles(files, numThreads);
+}
+
+bool FileIndex::ScanFile(GRAWFile& file, FrameList& frames)
+{
+    frames.clear();
+
+    file.Rewind();
+    while (true) {
+        try {
+            frames.push_back(file.ReadFrameMetadata());
+        }
+        catch (const Exceptions::End_of_File&) {
+            return true;
+        }
+        catch (const std::exception& err) {
+            BOOST_LOG_TRIVIAL(warning) << "Stopped indexing " << file.GetFilename() << " after " << frames.size()
+                                       << " frames: " << err.what();
+            return false;
+        }
+    }
+}
+
+bool FileIndex::IndexOneFile(GRAWFile& file, FrameList& frames)
+{
+    bool fromSidecar = false;
+
+    if (ReadSidecar(file.GetPath(), frames)) {
+        fromSidecar = true;
+    }
+    else if (ScanFile(file, frames)) {
+        // Only save complete indices, so a damaged file is rescanned (and reported) next time
+        try {
+            WriteSidecar(file.GetPath(), frames);
+        }
+        catch (const std::exception& err) {
+            BOOST_LOG_TRIVIAL(warning) << "Could not save frame index: " << err.what();
+        }
+    }
+
+    // Rewind to leave file read pointer at the beginning
+    file.Rewind();
+
+    return fromSidecar;
+}
+
+void FileIndex::indexFiles(const std::vector<std::shared_ptr<GRAWFile>>& files, const unsigned numThreads)
+{
+    filemap.clear();
+    indexedFiles.clear();
+    frameLists.clear();
+    frameRefs.clear();
+    eventIds.clear();
+    sources.clear();
+
+    // Each file is independent, so a pool of threads pulls files off a shared counter until they're all done.
+
+    std::vector<FrameList> results (files.size());
+    std::vector<char> fromSidecar (files.size(), false);
+    std::atomic<size_t> nextFile {0};
+
+    auto indexWorker = [&] {
+        for (size_t i = nextFile++; i < files.size(); i = nextFile++) {
+            try {
+                fromSidecar[i] = IndexOneFile(*files[i], results[i]);
+            }
+            catch (const std::exception& err) {
+                BOOST_LOG_TRIVIAL(warning) << "Could not index " << files[i]->GetFilename() << ": " << err.what();
+                results[i].clear();
+            }
+        }
+    };
+
+    unsigned nWorkers = std::max(1u, numThreads);
+    nWorkers = static_cast<unsigned>(std::min<size_t>(nWorkers, files.size()));
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < nWorkers; i++) {
+        pool.emplace_back(indexWorker);
+    }
+    indexWorker();  // This thread does its share too
+    for (auto& thr : pool) {
+        thr.join();
+    }
+
+    // Now combine the results in the original file order
+
+    auto numFromSidecar = std::count(fromSidecar.begin(), fromSidecar.end(), true);
+
+    for (size_t i = 0; i < files.size(); i++) {
+        const auto& file = files[i];
+        FrameList& frames = results[i];
+
+        if (frames.empty()) continue;
 
-        // Find minimum
         auto comp = [] (const GRAWFile::FrameMetadata& a, const GRAWFile::FrameMetadata& b) {
             return a.evtId < b.evtId;
         };
-        auto minElem = std::min_element(metas.begin(), metas.end(), comp);
-        evtid_t minEvtId = minElem->evtId;
+        auto minElem = std::min_element(frames.begin(), frames.end(), comp);
+        filemap.emplace(minElem->evtId, file);
+
+        uint32_t fileIdx = static_cast<uint32_t>(indexedFiles.size());
+        for (uint32_t frameIdx = 0; frameIdx < frames.size(); frameIdx++) {
+            frameRefs.push_back(FrameRef {frames[frameIdx].evtId, fileIdx, frameIdx});
+            sources.emplace(frames[frameIdx].cobo, frames[frameIdx].asad);
+        }
+
+        indexedFiles.push_back(file);
+        frameLists.push_back(std::move(frames));
+    }
 
-        // Insert into map
-        filemap.emplace(minEvtId, file);
+    std::sort(frameRefs.begin(), frameRefs.end());
 
-        // Rewind again to leave file read pointer at the beginning
-        file->Rewind();
+    for (const auto& ref : frameRefs) {
+        if (eventIds.empty() || eventIds.back() != ref.evtId) {
+            eventIds.push_back(ref.evtId);
+        }
     }
+
+    BOOST_LOG_TRIVIAL(info) << "Indexed " << frameRefs.size() << " frames (" << eventIds.size() << " events) in "
+                            << indexedFiles.size() << " files from " << sources.size() << " AsAds, "
+                            << numFromSidecar << " from saved indices";
 }
 
+// --------
+// Lookup
+// --------
+
 std::vector<std::shared_ptr<GRAWFile>>
 FileIndex::findFilesForEvtId(const evtid_t evtid) const
 {
@@ -48,3 +307,17 @@ FileIndex::findFilesForEvtId(const evtid_t evtid) const
 
     return fileList;
 }
+
+std::vector<FileIndex::FrameLocation>
+FileIndex::findFramesForEvtId(const evtid_t evtid) const
+{
+    auto comp = [] (const FrameRef& ref, const evtid_t id) { return ref.evtId < id; };
+    auto iter = std::lower_bound(frameRefs.begin(), frameRefs.end(), evtid, comp);
+
+    std::vector<FrameLocation> result;
+    for ( ; iter != frameRefs.end() && iter->evtId == evtid; iter++) {
+        result.push_back(FrameLocation {indexedFiles[iter->fileIdx], frameLists[iter->fileIdx][iter->frameIdx]});
+    }
+
+    return result;
+}
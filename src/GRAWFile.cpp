@@ -69,6 +69,11 @@ uint16_t GRAWFile::GetNextFrameSize()
         throw Exceptions::Bad_File(filePath.filename().string());
     }
 
+    if (filestream.peek() == std::char_traits<char>::eof()) {
+        isEOF = true;
+        throw Exceptions::End_of_File();
+    }
+
     std::streamoff storedPos = filestream.tellg();
 
     uint8_t metaType = static_cast<uint8_t>(filestream.get());
@@ -115,7 +120,7 @@ RawFrame GRAWFile::ReadRawFrame()
     size_t dataSize = sizeFromFile * static_cast<size_t>(GRAWFrame::sizeUnit);
     RawFrame frame_raw(dataSize);
 
-    char* rawPtr = reinterpret_cast<char*>(frame_raw.getRawPointer());
+    char* rawPtr = reinterpret_cast<char*>(frame_raw.getWritablePointer());
 
     filestream.read(rawPtr, static_cast<std::streamsize>(frame_raw.size()));
 
@@ -146,12 +151,18 @@ GRAWFile::FrameMetadata GRAWFile::ReadFrameMetadata()
     evtid_t evtid = Utilities::ExtractByteSwappedInt<evtid_t>(evtid_raw.begin(),
                                                               evtid_raw.end());
 
+    addr_t cobo = static_cast<addr_t>(filestream.get());
+    addr_t asad = static_cast<addr_t>(filestream.get());
+
     filestream.seekg(startPos + size*GRAWFrame::sizeUnit); // move to start of next frame
 
     GRAWFile::FrameMetadata meta {};
     meta.filePos = startPos;
     meta.evtId = evtid;
     meta.evtTime = timestamp;
+    meta.size = size * static_cast<uint32_t>(GRAWFrame::sizeUnit);
+    meta.cobo = cobo;
+    meta.asad = asad;
 
     return meta;
 }
@@ -11,94 +11,136 @@ const uint16_t GRAWFrame::Expected_itemSizeFullReadout = 2;
 const uint16_t GRAWFrame::Expected_frameTypePartialReadout = 1;
 const uint16_t GRAWFrame::Expected_frameTypeFullReadout = 2;
 const int      GRAWFrame::sizeUnit = 256;
+const size_t   GRAWFrame::fullReadoutBlockSize = Constants::num_agets * Constants::num_channels * Constants::num_tbs;
 
 // --------
-// Constructor
+// Header
 // --------
 
-GRAWFrame::GRAWFrame()
-: metaType(6),frameSize(0),dataSource(0),frameType(1),revision(4),headerSize(2),itemSize(4),nItems(0),eventTime(0),eventId(0),coboId(0),asadId(0),readOffset(0),status(0)
+GRAWFrameHeader GRAWFrameHeader::Read(const RawFrame& rawFrame)
 {
-    hitPatterns = {0,0,0,0};
-    multiplicity = {0,0,0,0};
-}
+    if (rawFrame.size() < static_cast<size_t>(GRAWFrame::sizeUnit)) {
+        throw Exceptions::Bad_Data("Frame of " + std::to_string(rawFrame.size()) + " bytes is shorter than its header");
+    }
 
-GRAWFrame::GRAWFrame(const RawFrame& rawFrame)
-{
+    GRAWFrameHeader header;
     auto rawFrameIter = rawFrame.begin();
 
-    metaType = *rawFrameIter;
+    header.metaType = *rawFrameIter;
     rawFrameIter++;
-    if (metaType != Expected_metaType) {
-        BOOST_LOG_TRIVIAL(warning) << "Unexpected metaType " << int(metaType);
+    if (header.metaType != GRAWFrame::Expected_metaType) {
+        BOOST_LOG_TRIVIAL(warning) << "Unexpected metaType " << int(header.metaType);
     }
 
-    frameSize = Utilities::ExtractByteSwappedInt<uint32_t>(rawFrameIter, rawFrameIter + 3);
+    header.frameSize = Utilities::ExtractByteSwappedInt<uint32_t>(rawFrameIter, rawFrameIter + 3);
     rawFrameIter += 3;
-    if (frameSize*sizeUnit != rawFrame.size()) {
+    if (header.frameSize*GRAWFrame::sizeUnit != rawFrame.size()) {
         BOOST_LOG_TRIVIAL(warning) << "Wrong frameSize. Using raw frame size.";
-        frameSize = static_cast<decltype(frameSize)>(rawFrame.size()/sizeUnit);
+        header.frameSize = static_cast<decltype(header.frameSize)>(rawFrame.size()/GRAWFrame::sizeUnit);
     }
 
-    dataSource = *rawFrameIter;
+    header.dataSource = *rawFrameIter;
     rawFrameIter++;
 
-    frameType = Utilities::ExtractByteSwappedInt<uint16_t>(rawFrameIter, rawFrameIter+2);
+    header.frameType = Utilities::ExtractByteSwappedInt<uint16_t>(rawFrameIter, rawFrameIter+2);
     rawFrameIter += 2;
-    if (frameType != Expected_frameTypeFullReadout and
-        frameType != Expected_frameTypePartialReadout) {
+    if (header.frameType != GRAWFrame::Expected_frameTypeFullReadout and
+        header.frameType != GRAWFrame::Expected_frameTypePartialReadout) {
         BOOST_LOG_TRIVIAL(warning) << "Unknown frameType. Read will likely fail.";
     }
 
-    revision = *rawFrameIter;
+    header.revision = *rawFrameIter;
     rawFrameIter++;
 
-    headerSize = Utilities::ExtractByteSwappedInt<uint16_t>(rawFrameIter, rawFrameIter+2);
+    header.headerSize = Utilities::ExtractByteSwappedInt<uint16_t>(rawFrameIter, rawFrameIter+2);
     rawFrameIter += 2;
-    if (headerSize != Expected_headerSize) {
-        BOOST_LOG_TRIVIAL(warning) << "Wrong headerSize " << int(headerSize) << ". Correcting.";
-        headerSize = Expected_headerSize;
+    if (header.headerSize != GRAWFrame::Expected_headerSize) {
+        BOOST_LOG_TRIVIAL(warning) << "Wrong headerSize " << int(header.headerSize) << ". Correcting.";
+        header.headerSize = GRAWFrame::Expected_headerSize;
     }
 
-    itemSize = Utilities::ExtractByteSwappedInt<uint16_t>(rawFrameIter, rawFrameIter+2);
+    header.itemSize = Utilities::ExtractByteSwappedInt<uint16_t>(rawFrameIter, rawFrameIter+2);
     rawFrameIter += 2;
-    if ((frameType == Expected_frameTypePartialReadout and
-         itemSize != Expected_itemSizePartialReadout) or
-        (frameType == Expected_frameTypeFullReadout and
-         itemSize != Expected_itemSizeFullReadout)) {
-            BOOST_LOG_TRIVIAL(warning) << "Wrong itemSize " << int(itemSize) << ". Correcting.";
-            if (frameType == Expected_frameTypePartialReadout) {
-                itemSize = Expected_itemSizePartialReadout;
+    if ((header.frameType == GRAWFrame::Expected_frameTypePartialReadout and
+         header.itemSize != GRAWFrame::Expected_itemSizePartialReadout) or
+        (header.frameType == GRAWFrame::Expected_frameTypeFullReadout and
+         header.itemSize != GRAWFrame::Expected_itemSizeFullReadout)) {
+            BOOST_LOG_TRIVIAL(warning) << "Wrong itemSize " << int(header.itemSize) << ". Correcting.";
+            if (header.frameType == GRAWFrame::Expected_frameTypePartialReadout) {
+                header.itemSize = GRAWFrame::Expected_itemSizePartialReadout;
             }
-            else if (frameType == Expected_frameTypeFullReadout) {
-                itemSize = Expected_itemSizeFullReadout;
+            else if (header.frameType == GRAWFrame::Expected_frameTypeFullReadout) {
+                header.itemSize = GRAWFrame::Expected_itemSizeFullReadout;
             }
     }
 
-    nItems = Utilities::ExtractByteSwappedInt<uint32_t>(rawFrameIter, rawFrameIter+4);
+    header.nItems = Utilities::ExtractByteSwappedInt<uint32_t>(rawFrameIter, rawFrameIter+4);
     rawFrameIter += 4;
-    if (frameSize != ceil(double(nItems*itemSize + headerSize*sizeUnit)/sizeUnit)) {
+    if (header.itemSize == 0) {
+        // Nothing sensible can be done with the items, so ignore them
+        header.nItems = 0;
+    }
+    else if (header.frameSize != ceil(double(header.nItems*header.itemSize + header.headerSize*GRAWFrame::sizeUnit)
+                                      /GRAWFrame::sizeUnit)) {
         BOOST_LOG_TRIVIAL(warning) << "Mismatched nItems. Correcting.";
-        nItems = (frameSize*sizeUnit - headerSize*sizeUnit)/itemSize;
+        header.nItems = (header.frameSize*GRAWFrame::sizeUnit - header.headerSize*GRAWFrame::sizeUnit)/header.itemSize;
     }
 
-    eventTime = Utilities::ExtractByteSwappedInt<uint64_t>(rawFrameIter, rawFrameIter+6);
+    header.eventTime = Utilities::ExtractByteSwappedInt<uint64_t>(rawFrameIter, rawFrameIter+6);
     rawFrameIter += 6;
 
-    eventId = Utilities::ExtractByteSwappedInt<uint32_t>(rawFrameIter, rawFrameIter+4);
+    header.eventId = Utilities::ExtractByteSwappedInt<uint32_t>(rawFrameIter, rawFrameIter+4);
     rawFrameIter += 4;
 
-    coboId = *rawFrameIter;
+    header.coboId = *rawFrameIter;
     rawFrameIter++;
 
-    asadId = *rawFrameIter;
+    header.asadId = *rawFrameIter;
     rawFrameIter++;
 
-    readOffset = Utilities::ExtractByteSwappedInt<uint16_t>(rawFrameIter, rawFrameIter+2);
+    header.readOffset = Utilities::ExtractByteSwappedInt<uint16_t>(rawFrameIter, rawFrameIter+2);
     rawFrameIter+=2;
 
-    status = *rawFrameIter;
-    rawFrameIter++;
+    header.status = *rawFrameIter;
+
+    return header;
+}
+
+size_t GRAWFrameHeader::DataOffset() const
+{
+    return static_cast<size_t>(headerSize) * GRAWFrame::sizeUnit;
+}
+
+// --------
+// Constructor
+// --------
+
+GRAWFrame::GRAWFrame()
+{
+    metaType = 6;
+    frameSize = 0;
+    dataSource = 0;
+    frameType = 1;
+    revision = 4;
+    headerSize = 2;
+    itemSize = 4;
+    nItems = 0;
+    eventTime = 0;
+    eventId = 0;
+    coboId = 0;
+    asadId = 0;
+    readOffset = 0;
+    status = 0;
+
+    hitPatterns = {0,0,0,0};
+    multiplicity = {0,0,0,0};
+}
+
+GRAWFrame::GRAWFrame(const RawFrame& rawFrame)
+: GRAWFrameHeader(GRAWFrameHeader::Read(rawFrame))
+{
+    // The hit patterns and multiplicities follow the status byte, the last of the fixed header fields
+    auto rawFrameIter = rawFrame.begin() + 31;
 
     for (int aget = 0; aget<4; aget++) {
         std::bitset<9*8> bs {};   // init to 0
@@ -118,8 +160,8 @@ GRAWFrame::GRAWFrame(const RawFrame& rawFrame)
     }
 
     // Extract data items
-    auto dataBegin = rawFrame.begin() + headerSize*GRAWFrame::sizeUnit;
-    auto dataEnd   = dataBegin + nItems*itemSize;
+    const uint8_t* dataBegin = rawFrame.begin() + DataOffset();
+    const uint8_t* dataEnd   = dataBegin + nItems*itemSize;
 
     if (frameType == Expected_frameTypePartialReadout) {
         ExtractPartialReadoutData(dataBegin, dataEnd);
@@ -129,158 +171,50 @@ GRAWFrame::GRAWFrame(const RawFrame& rawFrame)
     }
 }
 
-// --------
-// Iteration
-// --------
-
-std::vector<GRAWDataItem>::iterator GRAWFrame::begin()
-{
-    return data.begin();
-}
-
-std::vector<GRAWDataItem>::iterator GRAWFrame::end()
-{
-    return data.end();
-}
-
-std::vector<GRAWDataItem>::const_iterator GRAWFrame::cbegin() const
-{
-    return data.cbegin();
-}
-
-std::vector<GRAWDataItem>::const_iterator GRAWFrame::cend() const
-{
-    return data.cend();
-}
-
 // --------
 // Data Extraction Functions
 // --------
 
-template <typename charIter>
-void GRAWFrame::ExtractPartialReadoutData(charIter& begin, charIter& end)
+void GRAWFrame::ExtractPartialReadoutData(const uint8_t* begin, const uint8_t* end)
 {
-    std::vector< std::bitset<72> > actualHitPattern {0,0,0,0};
-
-    for (auto rawFrameIter = begin; rawFrameIter != end; rawFrameIter+=itemSize) {
-        uint32_t item = Utilities::ExtractByteSwappedInt<uint32_t>(rawFrameIter, rawFrameIter+itemSize);
-
-        addr_t aget    = ExtractAgetId(item);
-        if (aget >= Constants::num_agets) {
-            BOOST_LOG_TRIVIAL(warning) << "Frame contains invalid AGET value " << std::to_string(aget);
-            continue;
-        }
+    ItemDecoder::DecodePartialReadout(begin, static_cast<size_t>(end - begin) / itemSize, items);
+    ItemDecoder::WarnInvalidItems(items, false);
 
-        addr_t channel = ExtractChannel(item);
-        if (channel >= Constants::num_channels) {
-            BOOST_LOG_TRIVIAL(warning) << "Frame contains invalid channel " << std::to_string(channel);
-            continue;
-        }
+    // Compare the hit patterns with the channels that have items
 
-        tb_t tbid   = ExtractTBid(item);
-        if (tbid >= Constants::num_tbs) {
-            BOOST_LOG_TRIVIAL(warning) << "Frame contains invalid TB " << std::to_string(tbid);
-            continue;
-        }
-
-        sample_t sample  = ExtractSample(item);
-
-        data.push_back(GRAWDataItem(aget,channel,tbid,sample));
-
-        // WARNING: The hit pattern is in the reverse order of the bitset's accessor.
-
-        actualHitPattern.at(aget).set(67-channel);
+    HitMask found {};
+    for (size_t i = 0; i < items.size(); i++) {
+        const size_t idx = items.aget[i] * Constants::num_channels + items.channel[i];
+        found[idx / 64] |= uint64_t(1) << (idx % 64);
     }
 
-    // Compare hit patterns
-
-    unsigned int nMissing = 0;
-    unsigned int nUnexpected = 0;
-
-    for (size_t aget_iter = 0; aget_iter < 4; aget_iter++) {
-        for (size_t ch_iter = 0; ch_iter < 68; ch_iter ++) {
-            bool isExpected = hitPatterns.at(aget_iter).test(ch_iter);
-            bool isFound = actualHitPattern.at(aget_iter).test(ch_iter);
-
-            if (isExpected and !isFound) {
-                nMissing++;
-            }
-            else if (isFound and !isExpected) {
-                nUnexpected++;
-            }
-        }
+    const HitMask expected = GetHitMask();
+    hitPatternMismatch = HitPatternMismatch();
+    for (size_t w = 0; w < expected.size(); w++) {
+        hitPatternMismatch.nMissing += static_cast<size_t>(__builtin_popcountll(expected[w] & ~found[w]));
+        hitPatternMismatch.nUnexpected += static_cast<size_t>(__builtin_popcountll(found[w] & ~expected[w]));
     }
-
-    if (data.size() != nItems) {
-        BOOST_LOG_TRIVIAL(warning) << "Missing data items";
-    }
-
 }
 
-template <typename charIter>
-void GRAWFrame::ExtractFullReadoutData(charIter& begin, charIter& end)
+HitMask GRAWFrame::GetHitMask() const
 {
-//    std::vector<std::queue<int16_t>> dataQueues (4);
-    std::vector<std::array<int16_t,34816>> dataArrays (4);
-    uint16_t i[4]={0,0,0,0};
-
-    for (auto rawFrameIter = begin; rawFrameIter != end; rawFrameIter += itemSize) {
-        uint16_t item = Utilities::ExtractByteSwappedInt<uint16_t>(rawFrameIter, rawFrameIter+itemSize);
-
-        addr_t aget    = ExtractAgetIdFullReadout(item);
-        if (aget >= Constants::num_agets) {
-            BOOST_LOG_TRIVIAL(warning) << "Invalid AGET value " << std::to_string(aget);
-        }
-        sample_t sample  = ExtractSampleFullReadout(item);
-
-//        dataQueues.at(aget).push(sample);
-        dataArrays.at(aget).at(i[aget]) = sample;
-        i[aget]++;
-        
-    }
-
-	i[0]=0;i[1]=0;i[2]=0;i[3]=0;
-    for (addr_t aget = 0; aget < 4; aget++) {
-        for (tb_t tbid = 0; tbid < 512; tbid ++) {
-            for (addr_t channel = 0; channel < 68; channel++) {
-//                auto sample = dataQueues.at(aget).front();
-//                dataQueues.at(aget).pop();
-				auto sample = dataArrays.at(aget).at(i[aget]);
-				i[aget]++;
-
-
-                data.push_back(GRAWDataItem(aget,channel,tbid,sample));
+    // WARNING: The hit pattern is in the reverse order of the bitset's accessor.
+    HitMask mask {};
+    for (size_t aget = 0; aget < hitPatterns.size() && aget < Constants::num_agets; aget++) {
+        for (size_t ch = 0; ch < Constants::num_channels; ch++) {
+            if (hitPatterns[aget].test(67 - ch)) {
+                const size_t idx = aget * Constants::num_channels + ch;
+                mask[idx / 64] |= uint64_t(1) << (idx % 64);
             }
         }
     }
+    return mask;
 }
 
-addr_t GRAWFrame::ExtractAgetId(const uint32_t raw)
-{
-    return (raw & 0xC0000000)>>30;
-}
-
-addr_t GRAWFrame::ExtractChannel(const uint32_t raw)
-{
-    return (raw & 0x3F800000)>>23;
-}
-
-tb_t GRAWFrame::ExtractTBid(const uint32_t raw)
-{
-    return (raw & 0x007FC000)>>14;
-}
-
-sample_t GRAWFrame::ExtractSample(const uint32_t raw)
-{
-    return (raw & 0x00000FFF);
-}
-
-addr_t GRAWFrame::ExtractAgetIdFullReadout(const uint16_t raw)
-{
-    return (raw & 0xC000)>>14;
-}
-
-sample_t GRAWFrame::ExtractSampleFullReadout(const uint16_t raw)
+void GRAWFrame::ExtractFullReadoutData(const uint8_t* begin, const uint8_t* end)
 {
-    return (raw & 0x0FFF);
+    fullReadoutSamples.assign(fullReadoutBlockSize, 0);
+    ItemDecoder::DecodeFullReadout(begin, static_cast<size_t>(end - begin) / itemSize, fullReadoutSamples.data(),
+                                   items.nBadAget, items.nBadTB);
+    ItemDecoder::WarnInvalidItems(items, true);
 }
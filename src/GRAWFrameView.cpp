@@ -0,0 +1,127 @@
+#include "GRAWFrameView.h"
+
+namespace {
+    // Offsets of the variable parts of the header
+    const size_t hitPatternOffset = 31;
+    const size_t hitPatternSize = 9;
+    const size_t multiplicityOffset = hitPatternOffset + Constants::num_agets * hitPatternSize;
+
+    uint32_t ReadPartialReadoutItem(const uint8_t* ptr)
+    {
+        return (uint32_t(ptr[0]) << 24) | (uint32_t(ptr[1]) << 16) | (uint32_t(ptr[2]) << 8) | uint32_t(ptr[3]);
+    }
+
+    uint16_t ReadFullReadoutItem(const uint8_t* ptr)
+    {
+        return static_cast<uint16_t>((ptr[0] << 8) | ptr[1]);
+    }
+}
+
+// --------
+// Header
+// --------
+
+GRAWFrameView::GRAWFrameView(const RawFrame& rawFrame)
+: rawData(rawFrame.begin()), header(GRAWFrameHeader::Read(rawFrame))
+{
+}
+
+bool GRAWFrameView::IsChannelHit(const addr_t aget, const addr_t channel) const
+{
+    // The pattern is a 72-bit big-endian number, and channel `ch` is bit 67 - ch.
+    const size_t bit = 67 - channel;
+    const uint8_t byte = rawData[hitPatternOffset + aget*hitPatternSize + (hitPatternSize - 1 - bit/8)];
+    return (byte >> (bit % 8)) & 1;
+}
+
+std::bitset<72> GRAWFrameView::GetHitPattern(const addr_t aget) const
+{
+    std::bitset<72> pattern;
+    const uint8_t* bytes = rawData + hitPatternOffset + aget*hitPatternSize;
+    for (size_t i = 0; i < hitPatternSize; i++) {
+        pattern <<= 8;
+        pattern |= std::bitset<72>(bytes[i]);
+    }
+    return pattern;
+}
+
+HitMask GRAWFrameView::GetHitMask() const
+{
+    HitMask mask {};
+    for (size_t aget = 0; aget < Constants::num_agets; aget++) {
+        // As in IsChannelHit, channel `ch` is bit 67 - ch of the big-endian pattern
+        const uint8_t* bytes = rawData + hitPatternOffset + aget*hitPatternSize;
+        for (size_t ch = 0; ch < Constants::num_channels; ch++) {
+            const size_t bit = 67 - ch;
+            if ((bytes[hitPatternSize - 1 - bit/8] >> (bit % 8)) & 1) {
+                const size_t idx = aget * Constants::num_channels + ch;
+                mask[idx / 64] |= uint64_t(1) << (idx % 64);
+            }
+        }
+    }
+    return mask;
+}
+
+uint16_t GRAWFrameView::GetMultiplicity(const addr_t aget) const
+{
+    const uint8_t* bytes = rawData + multiplicityOffset + 2*aget;
+    return static_cast<uint16_t>((bytes[0] << 8) | bytes[1]);
+}
+
+// --------
+// Item iteration
+// --------
+
+GRAWFrameView::const_iterator::const_iterator(const GRAWFrameView& view, const size_t pos)
+: data(view.ItemData()), pos(pos), end(view.numRawItems()), fullReadout(view.IsFullReadout()),
+  channel(), tbid()
+{
+    skipInvalid();
+}
+
+GRAWDataItem GRAWFrameView::const_iterator::operator*() const
+{
+    if (fullReadout) {
+        const uint16_t item = ReadFullReadoutItem(data + 2*pos);
+        const addr_t aget = GRAWFrame::ExtractAgetIdFullReadout(item);
+        return GRAWDataItem(aget, channel[aget], tbid[aget], GRAWFrame::ExtractSampleFullReadout(item));
+    }
+
+    const uint32_t item = ReadPartialReadoutItem(data + 4*pos);
+    return GRAWDataItem(GRAWFrame::ExtractAgetId(item), GRAWFrame::ExtractChannel(item), GRAWFrame::ExtractTBid(item),
+                        GRAWFrame::ExtractSample(item));
+}
+
+GRAWFrameView::const_iterator& GRAWFrameView::const_iterator::operator++()
+{
+    if (fullReadout) {
+        // Move this item's AGET on to its next sample
+        const addr_t aget = GRAWFrame::ExtractAgetIdFullReadout(ReadFullReadoutItem(data + 2*pos));
+        if (++channel[aget] == Constants::num_channels) {
+            channel[aget] = 0;
+            tbid[aget]++;
+        }
+    }
+
+    pos++;
+    skipInvalid();
+    return *this;
+}
+
+void GRAWFrameView::const_iterator::skipInvalid()
+{
+    for ( ; pos < end; pos++) {
+        if (fullReadout) {
+            const addr_t aget = GRAWFrame::ExtractAgetIdFullReadout(ReadFullReadoutItem(data + 2*pos));
+            if (aget < Constants::num_agets && tbid[aget] < Constants::num_tbs) return;
+        }
+        else {
+            const uint32_t item = ReadPartialReadoutItem(data + 4*pos);
+            if (GRAWFrame::ExtractAgetId(item) < Constants::num_agets
+                && GRAWFrame::ExtractChannel(item) < Constants::num_channels
+                && GRAWFrame::ExtractTBid(item) < Constants::num_tbs) {
+                return;
+            }
+        }
+    }
+}
@@ -1,43 +1,526 @@
 #include "HDFDataStore.h"
 
-HDFDataStore::HDFDataStore(const std::string& filename, const bool writable)
+#include <algorithm>
+#include <stdexcept>
+#include "GMExceptions.h"
+
+const hsize_t HDFDataStore::traceColumns;
+
+unsigned HDFWriteOptions::MinNbitPrecision() const
+{
+    // A signed value of n bits holds up to 2^(n-1) - 1
+    if (layout == HDFLayout::Sparse) {
+        static_assert(Constants::num_tbs < (1 << 10), "The run lengths don't fit in 11 bits");
+        return 11;
+    }
+
+    // The pad column holds the lookup table's missing value as well as the real pads
+    static_assert(PadLookupTable::defaultMissingValue > (1 << 14) - 1, "The missing pad would fit in 15 bits");
+    return 16;
+}
+
+HDFDataStore::HDFDataStore(const std::string& filename, const bool writable, const HDFWriteOptions& opts)
+: writable(writable), opts(opts), fileType(H5::PredType::NATIVE_INT16)
 {
+    if (opts.nbitPrecision > 0) {
+        if (opts.nbitPrecision < opts.MinNbitPrecision()) {
+            throw std::invalid_argument("HDFDataStore: an n-bit precision of " + std::to_string(opts.nbitPrecision)
+                                        + " bits would clip values other than the samples. It must be at least "
+                                        + std::to_string(opts.MinNbitPrecision()) + " bits for this layout.");
+        }
+        fileType.setPrecision(opts.nbitPrecision);
+    }
+
     auto mode = writable ? H5F_ACC_TRUNC : H5F_ACC_RDONLY;
     file = H5::H5File(filename, mode);
 
-    gp = file.createGroup(groupName);
+    if (writable) {
+        gp = file.createGroup(groupName);
+        if (opts.layout != HDFLayout::PerEvent) {
+            createTableDatasets();
+        }
+    }
+    else {
+        gp = file.openGroup(groupName);
+        openForReading();
+    }
 }
 
+HDFDataStore::~HDFDataStore()
+{
+    try {
+        flush();
+    }
+    catch (const std::exception& e) {
+        BOOST_LOG_TRIVIAL(error) << "Failed to write the last events to the HDF5 file: " << e.what();
+    }
+    catch (const H5::Exception& e) {
+        BOOST_LOG_TRIVIAL(error) << "Failed to write the last events to the HDF5 file: " << e.getDetailMsg();
+    }
+}
+
+// --------
+// Writing
+// --------
+
 void HDFDataStore::writeEvent(const Event& evt)
 {
-    const arma::uword nTraces = evt.numTraces();
-    const arma::uword nColumns = 512 + 5;  // (cobo/asad/aget/ch/pad) + number of TBs
-    arma::Mat<sample_t> dataMat (nTraces, nColumns);
+    if (opts.layout == HDFLayout::PerEvent) {
+        writePerEvent(evt);
+        return;
+    }
+
+    pending.add(evt);
+    if (pending.numTraces() >= opts.batchTraces) {
+        flush();
+    }
+}
+
+void HDFDataStore::writeBatch(const EventBatch& batch)
+{
+    flush();
+
+    if (opts.layout == HDFLayout::PerEvent) {
+        writeBatchPerEvent(batch);
+    }
+    else if (opts.layout == HDFLayout::Sparse) {
+        appendToSparse(batch);
+    }
+    else {
+        appendToTable(batch);
+    }
+}
+
+void HDFDataStore::writePerEvent(const Event& evt)
+{
+    // The rows are serialized in HDF5's (row-major) order, into a buffer that is reused for every event.
+    scratch.clear();
+    scratch.add(evt);
+    writeBatchPerEvent(scratch);
+}
+
+void HDFDataStore::writeBatchPerEvent(const EventBatch& batch)
+{
+    for (const auto& entry : batch.events) {
+        // Each event is its own dataset, so one that fails to write is skipped without losing the rest
+        try {
+            const hsize_t dims[2] = {entry.nRows, traceColumns};
+            H5::DataSpace dspace (2, dims);
+
+            H5::DataSet dset = gp.createDataSet(std::to_string(entry.eventId), fileType, dspace,
+                                                MakeCreateProps(entry.nRows, traceColumns));
+            if (entry.nRows > 0) {
+                dset.write(batch.rows.data() + entry.firstRow * traceColumns, H5::PredType::NATIVE_INT16);
+            }
+            eventsInFile++;
+        }
+        catch (const std::exception& e) {
+            BOOST_LOG_TRIVIAL(error) << "Failed to write event " << entry.eventId << ": " << e.what();
+        }
+        catch (const H5::Exception& e) {
+            BOOST_LOG_TRIVIAL(error) << "Failed to write event " << entry.eventId << ": " << e.getDetailMsg();
+        }
+    }
+}
+
+void HDFDataStore::EventBatch::add(const Event& evt)
+{
+    Entry entry;
+    entry.eventId = evt.eventId;
+    entry.eventTime = evt.eventTime;
+    entry.firstRow = numTraces();
+    entry.nRows = evt.numTraces();
+    events.push_back(entry);
+
+    const size_t begin = rows.size();
+    rows.resize(begin + entry.nRows * traceColumns);
+
+    sample_t* row = rows.data() + begin;
+    for (const auto& trace : evt) {
+        const HardwareAddress& addr = trace.first;
+
+        row[0] = addr.cobo;
+        row[1] = addr.asad;
+        row[2] = addr.aget;
+        row[3] = addr.channel;
+        row[4] = static_cast<sample_t>(addr.pad);
+        std::copy_n(trace.second.memptr(), Constants::num_tbs, row + 5);
+
+        row += traceColumns;
+    }
+}
+
+size_t HDFDataStore::EncodeRuns(const sample_t* samples, std::vector<sample_t>& runs)
+{
+    const size_t begin = runs.size();
+
+    tb_t tb = 0;
+    while (tb < Constants::num_tbs) {
+        if (samples[tb] == 0) {
+            tb++;
+            continue;
+        }
+
+        tb_t end = tb + 1;
+        while (end < Constants::num_tbs && samples[end] != 0) end++;
+
+        runs.push_back(static_cast<sample_t>(tb));
+        runs.push_back(static_cast<sample_t>(end - tb));
+        runs.insert(runs.end(), samples + tb, samples + end);
+        tb = end;
+    }
+
+    return runs.size() - begin;
+}
+
+void HDFDataStore::ExpandRuns(const sample_t* runs, const size_t n, sample_t* samples)
+{
+    size_t pos = 0;
+    while (pos < n) {
+        if (pos + 2 > n) throw Exceptions::Bad_Data("Sparse trace ends in the middle of a run header");
+
+        const sample_t start = runs[pos];
+        const sample_t length = runs[pos + 1];
+        if (start < 0 || length <= 0 || start + length > Constants::num_tbs || pos + 2 + length > n) {
+            throw Exceptions::Bad_Data("Sparse trace has a run that doesn't fit");
+        }
+
+        std::copy_n(runs + pos + 2, length, samples + start);
+        pos += 2 + static_cast<size_t>(length);
+    }
+}
+
+H5::CompType HDFDataStore::EventTableType()
+{
+    H5::CompType type (sizeof(EventTableEntry));
+    type.insertMember("eventId", HOFFSET(EventTableEntry, eventId), H5::PredType::NATIVE_UINT64);
+    type.insertMember("eventTime", HOFFSET(EventTableEntry, eventTime), H5::PredType::NATIVE_UINT64);
+    type.insertMember("firstRow", HOFFSET(EventTableEntry, firstRow), H5::PredType::NATIVE_UINT64);
+    type.insertMember("nRows", HOFFSET(EventTableEntry, nRows), H5::PredType::NATIVE_UINT64);
+    return type;
+}
+
+H5::CompType HDFDataStore::SparseTraceType()
+{
+    H5::CompType type (sizeof(SparseTraceEntry));
+    type.insertMember("firstValue", HOFFSET(SparseTraceEntry, firstValue), H5::PredType::NATIVE_UINT64);
+    type.insertMember("nValues", HOFFSET(SparseTraceEntry, nValues), H5::PredType::NATIVE_UINT32);
+    type.insertMember("cobo", HOFFSET(SparseTraceEntry, cobo), H5::PredType::NATIVE_UINT16);
+    type.insertMember("asad", HOFFSET(SparseTraceEntry, asad), H5::PredType::NATIVE_UINT16);
+    type.insertMember("aget", HOFFSET(SparseTraceEntry, aget), H5::PredType::NATIVE_UINT16);
+    type.insertMember("channel", HOFFSET(SparseTraceEntry, channel), H5::PredType::NATIVE_UINT16);
+    type.insertMember("pad", HOFFSET(SparseTraceEntry, pad), H5::PredType::NATIVE_UINT16);
+    return type;
+}
+
+void HDFDataStore::createTableDatasets()
+{
+    const hsize_t eventDims[1] = {0};
+    const hsize_t eventMaxDims[1] = {H5S_UNLIMITED};
+    H5::DataSpace eventSpace (1, eventDims, eventMaxDims);
 
-    arma::uword rowNumber = 0;
-    for (auto it = evt.cbegin(); it != evt.cend(); it++) {
-        const HardwareAddress& addr = it->first;
-        const arma::Col<sample_t>& tr = it->second;
+    H5::DSetCreatPropList eventProps;
+    const hsize_t eventChunk[1] = {1024};
+    eventProps.setChunk(1, eventChunk);
+    eventSet = gp.createDataSet("events", EventTableType(), eventSpace, eventProps);
 
-        dataMat(rowNumber, 0) = addr.cobo;
-        dataMat(rowNumber, 1) = addr.asad;
-        dataMat(rowNumber, 2) = addr.aget;
-        dataMat(rowNumber, 3) = addr.channel;
-        dataMat(rowNumber, 4) = static_cast<sample_t>(addr.pad);
+    const hsize_t chunkTraces = std::max<hsize_t>(1, opts.chunkTraces);
 
-        dataMat(rowNumber, arma::span(5, nColumns-1)) = tr.t();
+    if (opts.layout == HDFLayout::Sparse) {
+        // The trace entries are chunked like the event table. The runs get the filters.
+        H5::DataSpace traceSpace (1, eventDims, eventMaxDims);
+        H5::DSetCreatPropList traceProps;
+        const hsize_t traceChunk[1] = {chunkTraces};
+        traceProps.setChunk(1, traceChunk);
+        traceSet = gp.createDataSet("traces", SparseTraceType(), traceSpace, traceProps);
 
-        rowNumber++;
+        H5::DataSpace runSpace (1, eventDims, eventMaxDims);
+        H5::DSetCreatPropList runProps;
+        const hsize_t runChunk[1] = {chunkTraces * traceColumns};
+        runProps.setChunk(1, runChunk);
+        AddFilters(runProps);
+        runSet = gp.createDataSet("runs", fileType, runSpace, runProps);
+        return;
     }
 
-    arma::inplace_trans(dataMat);  // HACK: arma is col-major, hdf5 is row-major
+    const hsize_t traceDims[2] = {0, traceColumns};
+    const hsize_t traceMaxDims[2] = {H5S_UNLIMITED, traceColumns};
+    H5::DataSpace traceSpace (2, traceDims, traceMaxDims);
 
-    const int dspace_rank = 2;
-    const hsize_t dspace_dims[2] = {nTraces, nColumns};
-    H5::DataSpace dspace (dspace_rank, dspace_dims);
+    // Extendable datasets must be chunked, even without filters
+    H5::DSetCreatPropList traceProps = MakeCreateProps(chunkTraces, traceColumns);
+    if (traceProps.getLayout() != H5D_CHUNKED) {
+        const hsize_t chunkDims[2] = {chunkTraces, traceColumns};
+        traceProps.setChunk(2, chunkDims);
+    }
+    traceSet = gp.createDataSet("traces", fileType, traceSpace, traceProps);
+}
 
-    const std::string dset_name = std::to_string(evt.eventId);
+void HDFDataStore::flush()
+{
+    if (opts.layout == HDFLayout::PerEvent || pending.empty()) return;
+
+    if (opts.layout == HDFLayout::Sparse) {
+        appendToSparse(pending);
+    }
+    else {
+        appendToTable(pending);
+    }
+    pending.clear();
+}
+
+void HDFDataStore::appendToTable(const EventBatch& batch)
+{
+    if (batch.empty()) return;
 
-    H5::DataSet dset = gp.createDataSet(dset_name, H5::PredType::NATIVE_INT16, dspace);
-    dset.write(dataMat.memptr(), H5::PredType::NATIVE_INT16);
+    // Append the rows, then the events that refer to them
+    const hsize_t newRows = batch.numTraces();
+    if (newRows > 0) {
+        AppendRows(traceSet, batch.rows.data(), H5::PredType::NATIVE_INT16, rowsInFile, newRows);
+    }
+    appendEvents(batch);
+}
+
+void HDFDataStore::appendToSparse(const EventBatch& batch)
+{
+    if (batch.empty()) return;
+
+    sparseTraces.clear();
+    sparseRuns.clear();
+
+    const hsize_t nTraces = batch.numTraces();
+    for (hsize_t row = 0; row < nTraces; row++) {
+        const sample_t* values = batch.rows.data() + row * traceColumns;
+
+        SparseTraceEntry entry;
+        entry.firstValue = runValuesInFile + sparseRuns.size();
+        entry.nValues = static_cast<uint32_t>(EncodeRuns(values + 5, sparseRuns));
+        entry.cobo = static_cast<uint16_t>(values[0]);
+        entry.asad = static_cast<uint16_t>(values[1]);
+        entry.aget = static_cast<uint16_t>(values[2]);
+        entry.channel = static_cast<uint16_t>(values[3]);
+        entry.pad = static_cast<uint16_t>(values[4]);
+        sparseTraces.push_back(entry);
+    }
+
+    if (!sparseRuns.empty()) {
+        AppendRows(runSet, sparseRuns.data(), H5::PredType::NATIVE_INT16, runValuesInFile, sparseRuns.size());
+        runValuesInFile += sparseRuns.size();
+    }
+    if (nTraces > 0) {
+        AppendRows(traceSet, sparseTraces.data(), SparseTraceType(), rowsInFile, nTraces);
+    }
+    appendEvents(batch);
+}
+
+void HDFDataStore::appendEvents(const EventBatch& batch)
+{
+    // The batch counts rows from its own start, but the table counts them from the start of the file
+    tableEntries.assign(batch.events.begin(), batch.events.end());
+    for (auto& entry : tableEntries) {
+        entry.firstRow += rowsInFile;
+    }
+    rowsInFile += batch.numTraces();
+
+    AppendRows(eventSet, tableEntries.data(), EventTableType(), eventsInFile, tableEntries.size());
+    eventsInFile += tableEntries.size();
+}
+
+void HDFDataStore::AppendRows(H5::DataSet& dset, const void* data, const H5::DataType& memType,
+                              const hsize_t oldRows, const hsize_t newRows)
+{
+    H5::DataSpace space = dset.getSpace();
+    const int rank = space.getSimpleExtentNdims();
+    hsize_t dims[2] = {0, 0};
+    space.getSimpleExtentDims(dims);
+
+    dims[0] = oldRows + newRows;
+    dset.extend(dims);
+
+    H5::DataSpace fileSpace = dset.getSpace();
+    const hsize_t start[2] = {oldRows, 0};
+    const hsize_t count[2] = {newRows, dims[1]};
+    fileSpace.selectHyperslab(H5S_SELECT_SET, count, start);
+
+    H5::DataSpace memSpace (rank, count);
+    dset.write(data, memType, memSpace, fileSpace);
+}
+
+H5::DSetCreatPropList HDFDataStore::MakeCreateProps(const hsize_t nTraces, const hsize_t nColumns) const
+{
+    H5::DSetCreatPropList props;
+
+    // A chunk can't be larger than a fixed-size dataset, or empty, so small events get one smaller chunk and empty
+    // ones aren't chunked at all.
+    if (!opts.IsChunked() || nTraces == 0) return props;
+
+    const hsize_t chunkDims[2] = {std::min(std::max<hsize_t>(1, opts.chunkTraces), nTraces), nColumns};
+    props.setChunk(2, chunkDims);
+    AddFilters(props);
+
+    return props;
+}
+
+void HDFDataStore::AddFilters(H5::DSetCreatPropList& props) const
+{
+    if (opts.scaleOffset) {
+        // Not all versions of the C++ API wrap this one
+        if (H5Pset_scaleoffset(props.getId(), H5Z_SO_INT, H5Z_SO_INT_MINBITS_DEFAULT) < 0) {
+            throw H5::PropListIException("HDFDataStore::MakeCreateProps", "H5Pset_scaleoffset failed");
+        }
+    }
+    if (opts.nbitPrecision > 0) {
+        props.setNbit();
+    }
+    if (opts.shuffle) {
+        props.setShuffle();
+    }
+    if (opts.deflateLevel > 0) {
+        props.setDeflate(opts.deflateLevel);
+    }
+}
+
+// --------
+// Reading
+// --------
+
+void HDFDataStore::openForReading()
+{
+    if (H5Lexists(gp.getId(), "runs", H5P_DEFAULT) > 0) {
+        opts.layout = HDFLayout::Sparse;
+        runSet = gp.openDataSet("runs");
+    }
+    else if (H5Lexists(gp.getId(), "events", H5P_DEFAULT) > 0) {
+        opts.layout = HDFLayout::Table;
+    }
+    else {
+        opts.layout = HDFLayout::PerEvent;
+    }
+
+    if (opts.layout != HDFLayout::PerEvent) {
+        traceSet = gp.openDataSet("traces");
+        eventSet = gp.openDataSet("events");
+
+        hsize_t nEvents = 0;
+        eventSet.getSpace().getSimpleExtentDims(&nEvents);
+        eventTable.resize(nEvents);
+        if (nEvents > 0) {
+            eventSet.read(eventTable.data(), EventTableType());
+        }
+        eventsInFile = eventTable.size();
+    }
+    else {
+        std::vector<std::pair<evtid_t, std::string>> names;
+        for (hsize_t i = 0; i < gp.getNumObjs(); i++) {
+            std::string name = gp.getObjnameByIdx(i);
+            if (name.empty() || name.find_first_not_of("0123456789") != std::string::npos) continue;
+            names.emplace_back(static_cast<evtid_t>(std::stoul(name)), name);
+        }
+        std::sort(names.begin(), names.end());
+        for (auto& name : names) {
+            datasetNames.push_back(std::move(name.second));
+        }
+        eventsInFile = datasetNames.size();
+    }
+}
+
+size_t HDFDataStore::numEvents() const
+{
+    return eventsInFile + pending.events.size();
+}
+
+HDFDataStore::EventRecord HDFDataStore::readEvent(const size_t n) const
+{
+    if (writable) {
+        throw std::logic_error("HDFDataStore::readEvent: the store was opened for writing");
+    }
+    if (n >= eventsInFile) {
+        throw std::out_of_range("HDFDataStore::readEvent: there are only " + std::to_string(eventsInFile)
+                                + " events");
+    }
+
+    EventRecord record;
+
+    if (opts.layout == HDFLayout::Sparse) {
+        readSparseEvent(eventTable[n], record);
+    }
+    else if (opts.layout == HDFLayout::Table) {
+        const EventTableEntry& entry = eventTable[n];
+        record.eventId = static_cast<evtid_t>(entry.eventId);
+        record.eventTime = entry.eventTime;
+        record.nTraces = entry.nRows;
+        record.data.resize(entry.nRows * traceColumns);
+        if (entry.nRows == 0) return record;
+
+        H5::DataSpace fileSpace = traceSet.getSpace();
+        const hsize_t start[2] = {entry.firstRow, 0};
+        const hsize_t count[2] = {entry.nRows, traceColumns};
+        fileSpace.selectHyperslab(H5S_SELECT_SET, count, start);
+
+        H5::DataSpace memSpace (2, count);
+        traceSet.read(record.data.data(), H5::PredType::NATIVE_INT16, memSpace, fileSpace);
+    }
+    else {
+        H5::DataSet dset = gp.openDataSet(datasetNames[n]);
+        hsize_t dims[2] = {0, 0};
+        dset.getSpace().getSimpleExtentDims(dims);
+
+        record.eventId = static_cast<evtid_t>(std::stoul(datasetNames[n]));
+        record.nTraces = dims[0];
+        record.data.resize(dims[0] * dims[1]);
+        if (!record.data.empty()) {
+            dset.read(record.data.data(), H5::PredType::NATIVE_INT16);
+        }
+    }
+
+    return record;
+}
+
+void HDFDataStore::readSparseEvent(const EventTableEntry& entry, EventRecord& record) const
+{
+    record.eventId = static_cast<evtid_t>(entry.eventId);
+    record.eventTime = entry.eventTime;
+    record.nTraces = entry.nRows;
+    record.data.assign(entry.nRows * traceColumns, 0);
+    if (entry.nRows == 0) return;
+
+    // Read the event's trace entries, then all of its runs at once, since they were written one after the other
+    std::vector<SparseTraceEntry> traces (entry.nRows);
+    {
+        H5::DataSpace fileSpace = traceSet.getSpace();
+        const hsize_t start[1] = {entry.firstRow};
+        const hsize_t count[1] = {entry.nRows};
+        fileSpace.selectHyperslab(H5S_SELECT_SET, count, start);
+
+        H5::DataSpace memSpace (1, count);
+        traceSet.read(traces.data(), SparseTraceType(), memSpace, fileSpace);
+    }
+
+    const uint64_t firstValue = traces.front().firstValue;
+    const uint64_t endValue = traces.back().firstValue + traces.back().nValues;
+    std::vector<sample_t> runs (endValue - firstValue);
+    if (!runs.empty()) {
+        H5::DataSpace fileSpace = runSet.getSpace();
+        const hsize_t start[1] = {firstValue};
+        const hsize_t count[1] = {runs.size()};
+        fileSpace.selectHyperslab(H5S_SELECT_SET, count, start);
+
+        H5::DataSpace memSpace (1, count);
+        runSet.read(runs.data(), H5::PredType::NATIVE_INT16, memSpace, fileSpace);
+    }
+
+    for (size_t i = 0; i < traces.size(); i++) {
+        const SparseTraceEntry& trace = traces[i];
+        if (trace.firstValue < firstValue || trace.firstValue + trace.nValues > endValue) {
+            throw Exceptions::Bad_Data("Sparse trace refers to runs outside its event");
+        }
+
+        sample_t* row = record.data.data() + i * traceColumns;
+        row[0] = static_cast<sample_t>(trace.cobo);
+        row[1] = static_cast<sample_t>(trace.asad);
+        row[2] = static_cast<sample_t>(trace.aget);
+        row[3] = static_cast<sample_t>(trace.channel);
+        row[4] = static_cast<sample_t>(trace.pad);
+        ExpandRuns(runs.data() + (trace.firstValue - firstValue), trace.nValues, row + 5);
+    }
 }
@@ -0,0 +1,296 @@
+#include "ItemDecoder.h"
+#include "GRAWFrame.h"
+
+#include <cstring>
+#include <boost/log/trivial.hpp>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define ITEMDECODER_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+// --------
+// DecodedItems
+// --------
+
+void DecodedItems::clear()
+{
+    aget.clear();
+    channel.clear();
+    tb.clear();
+    sample.clear();
+    nBadAget = 0;
+    nBadChannel = 0;
+    nBadTB = 0;
+}
+
+void DecodedItems::resize(const size_t n)
+{
+    aget.resize(n);
+    channel.resize(n);
+    tb.resize(n);
+    sample.resize(n);
+}
+
+void DecodedItems::push_back(const addr_t agetId, const addr_t chan, const tb_t tbid, const sample_t samp)
+{
+    aget.push_back(agetId);
+    channel.push_back(chan);
+    tb.push_back(tbid);
+    sample.push_back(samp);
+}
+
+// --------
+// Decoders
+// --------
+//
+// Each decoder writes the valid items to `out` starting at position `n`, and returns the position after the last
+// item it wrote. The arrays in `out` must already be large enough to hold every item.
+
+namespace {
+
+    size_t DecodeScalar(const uint8_t* data, const size_t begin, const size_t end, DecodedItems& out, size_t n)
+    {
+        for (size_t i = begin; i < end; i++) {
+            const uint8_t* ptr = data + 4*i;
+            const uint32_t item = (uint32_t(ptr[0]) << 24) | (uint32_t(ptr[1]) << 16)
+                                  | (uint32_t(ptr[2]) << 8) | uint32_t(ptr[3]);
+
+            const addr_t aget = GRAWFrame::ExtractAgetId(item);
+            if (aget >= Constants::num_agets) {
+                out.nBadAget++;
+                continue;
+            }
+
+            const addr_t channel = GRAWFrame::ExtractChannel(item);
+            if (channel >= Constants::num_channels) {
+                out.nBadChannel++;
+                continue;
+            }
+
+            const tb_t tbid = GRAWFrame::ExtractTBid(item);
+            if (tbid >= Constants::num_tbs) {
+                out.nBadTB++;
+                continue;
+            }
+
+            out.aget[n] = aget;
+            out.channel[n] = channel;
+            out.tb[n] = tbid;
+            out.sample[n] = GRAWFrame::ExtractSample(item);
+            n++;
+        }
+        return n;
+    }
+
+#ifdef ITEMDECODER_HAVE_X86
+
+    __attribute__((target("sse4.1")))
+    size_t DecodeSSE41(const uint8_t* data, const size_t nItems, DecodedItems& out)
+    {
+        const __m128i byteSwap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        const __m128i channelMask = _mm_set1_epi32(0x7F);
+        const __m128i tbMask = _mm_set1_epi32(0x1FF);
+        const __m128i sampleMask = _mm_set1_epi32(0xFFF);
+        const __m128i maxAget = _mm_set1_epi32(Constants::num_agets - 1);
+        const __m128i maxChannel = _mm_set1_epi32(Constants::num_channels - 1);
+        const __m128i maxTB = _mm_set1_epi32(Constants::num_tbs - 1);
+
+        size_t n = 0;
+        size_t i = 0;
+        for ( ; i + 4 <= nItems; i += 4) {
+            __m128i items = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 4*i));
+            items = _mm_shuffle_epi8(items, byteSwap);
+
+            const __m128i aget = _mm_srli_epi32(items, 30);
+            const __m128i channel = _mm_and_si128(_mm_srli_epi32(items, 23), channelMask);
+            const __m128i tb = _mm_and_si128(_mm_srli_epi32(items, 14), tbMask);
+            const __m128i sample = _mm_and_si128(items, sampleMask);
+
+            const __m128i bad = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(aget, maxAget),
+                                                          _mm_cmpgt_epi32(channel, maxChannel)),
+                                             _mm_cmpgt_epi32(tb, maxTB));
+            if (!_mm_testz_si128(bad, bad)) {
+                n = DecodeScalar(data, i, i + 4, out, n);
+                continue;
+            }
+
+            // Every field fits in 16 bits, and the addresses in 8, so narrow them with saturating packs.
+            const __m128i agetChannel = _mm_packus_epi16(_mm_packus_epi32(aget, channel), _mm_setzero_si128());
+            const uint32_t agets = static_cast<uint32_t>(_mm_cvtsi128_si32(agetChannel));
+            const uint32_t channels = static_cast<uint32_t>(_mm_extract_epi32(agetChannel, 1));
+            std::memcpy(out.aget.data() + n, &agets, 4);
+            std::memcpy(out.channel.data() + n, &channels, 4);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out.tb.data() + n), _mm_packus_epi32(tb, tb));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out.sample.data() + n), _mm_packus_epi32(sample, sample));
+            n += 4;
+        }
+
+        return DecodeScalar(data, i, nItems, out, n);
+    }
+
+    //! \brief Narrow eight 32-bit values (that fit in 16 bits) to 16 bits, keeping their order.
+    __attribute__((target("avx2")))
+    inline __m128i Narrow16(const __m256i vals)
+    {
+        return _mm_packus_epi32(_mm256_castsi256_si128(vals), _mm256_extracti128_si256(vals, 1));
+    }
+
+    __attribute__((target("avx2")))
+    size_t DecodeAVX2(const uint8_t* data, const size_t nItems, DecodedItems& out)
+    {
+        const __m256i byteSwap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                                  3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        const __m256i channelMask = _mm256_set1_epi32(0x7F);
+        const __m256i tbMask = _mm256_set1_epi32(0x1FF);
+        const __m256i sampleMask = _mm256_set1_epi32(0xFFF);
+        const __m256i maxAget = _mm256_set1_epi32(Constants::num_agets - 1);
+        const __m256i maxChannel = _mm256_set1_epi32(Constants::num_channels - 1);
+        const __m256i maxTB = _mm256_set1_epi32(Constants::num_tbs - 1);
+
+        size_t n = 0;
+        size_t i = 0;
+        for ( ; i + 8 <= nItems; i += 8) {
+            __m256i items = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 4*i));
+            items = _mm256_shuffle_epi8(items, byteSwap);
+
+            const __m256i aget = _mm256_srli_epi32(items, 30);
+            const __m256i channel = _mm256_and_si256(_mm256_srli_epi32(items, 23), channelMask);
+            const __m256i tb = _mm256_and_si256(_mm256_srli_epi32(items, 14), tbMask);
+            const __m256i sample = _mm256_and_si256(items, sampleMask);
+
+            const __m256i bad = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(aget, maxAget),
+                                                                _mm256_cmpgt_epi32(channel, maxChannel)),
+                                                _mm256_cmpgt_epi32(tb, maxTB));
+            if (!_mm256_testz_si256(bad, bad)) {
+                n = DecodeScalar(data, i, i + 8, out, n);
+                continue;
+            }
+
+            // Low 8 bytes are the AGETs, high 8 bytes are the channels
+            const __m128i agetChannel = _mm_packus_epi16(Narrow16(aget), Narrow16(channel));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out.aget.data() + n), agetChannel);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out.channel.data() + n),
+                             _mm_unpackhi_epi64(agetChannel, agetChannel));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out.tb.data() + n), Narrow16(tb));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out.sample.data() + n), Narrow16(sample));
+            n += 8;
+        }
+
+        return DecodeScalar(data, i, nItems, out, n);
+    }
+
+#endif /* ITEMDECODER_HAVE_X86 */
+}
+
+// --------
+// Dispatch
+// --------
+
+bool ItemDecoder::IsSupported(const Impl impl)
+{
+    switch (impl) {
+        case Impl::Scalar:
+            return true;
+#ifdef ITEMDECODER_HAVE_X86
+        case Impl::SSE41:
+            return __builtin_cpu_supports("sse4.1");
+        case Impl::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+ItemDecoder::Impl ItemDecoder::BestSupported()
+{
+    static const Impl best = IsSupported(Impl::AVX2) ? Impl::AVX2
+                             : IsSupported(Impl::SSE41) ? Impl::SSE41
+                             : Impl::Scalar;
+    return best;
+}
+
+const char* ItemDecoder::ImplName(const Impl impl)
+{
+    switch (impl) {
+        case Impl::Scalar: return "scalar";
+        case Impl::SSE41: return "SSE4.1";
+        case Impl::AVX2: return "AVX2";
+    }
+    return "unknown";
+}
+
+void ItemDecoder::DecodePartialReadout(const uint8_t* data, const size_t nItems, DecodedItems& out)
+{
+    DecodePartialReadout(data, nItems, out, BestSupported());
+}
+
+void ItemDecoder::DecodePartialReadout(const uint8_t* data, const size_t nItems, DecodedItems& out, const Impl impl)
+{
+    out.clear();
+    out.resize(nItems);
+
+    size_t n = 0;
+    switch (impl) {
+#ifdef ITEMDECODER_HAVE_X86
+        case Impl::AVX2:
+            n = DecodeAVX2(data, nItems, out);
+            break;
+        case Impl::SSE41:
+            n = DecodeSSE41(data, nItems, out);
+            break;
+#endif
+        default:
+            n = DecodeScalar(data, 0, nItems, out, 0);
+            break;
+    }
+
+    out.resize(n);
+}
+
+void ItemDecoder::DecodeFullReadout(const uint8_t* data, const size_t nItems, sample_t* block,
+                                    size_t& nBadAget, size_t& nBadTB)
+{
+    // Keep a (channel, tb) cursor for each AGET and write each sample straight into its trace.
+
+    addr_t channel[Constants::num_agets] = {};
+    tb_t tbid[Constants::num_agets] = {};
+
+    for (size_t i = 0; i < nItems; i++) {
+        const uint16_t item = static_cast<uint16_t>((data[2*i] << 8) | data[2*i + 1]);
+
+        const addr_t aget = GRAWFrame::ExtractAgetIdFullReadout(item);
+        if (aget >= Constants::num_agets) {
+            nBadAget++;
+            continue;
+        }
+        if (tbid[aget] >= Constants::num_tbs) {
+            nBadTB++;
+            continue;
+        }
+
+        const size_t trace = aget * Constants::num_channels + channel[aget];
+        block[trace * Constants::num_tbs + tbid[aget]] = GRAWFrame::ExtractSampleFullReadout(item);
+
+        if (++channel[aget] == Constants::num_channels) {
+            channel[aget] = 0;
+            tbid[aget]++;
+        }
+    }
+}
+
+void ItemDecoder::WarnInvalidItems(const DecodedItems& items, const bool fullReadout)
+{
+    if (items.numInvalid() == 0) return;
+
+    if (fullReadout) {
+        BOOST_LOG_TRIVIAL(warning) << "Full-readout frame contains " << items.numInvalid() << " invalid items ("
+                                   << items.nBadAget << " AGET, " << items.nBadTB << " past the last TB)";
+    }
+    else {
+        BOOST_LOG_TRIVIAL(warning) << "Frame contains " << items.numInvalid() << " invalid items ("
+                                   << items.nBadAget << " AGET, " << items.nBadChannel << " channel, "
+                                   << items.nBadTB << " TB)";
+    }
+}
@@ -0,0 +1,276 @@
+#include "LookupTableFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "GMExceptions.h"
+
+namespace {
+
+    // --------
+    // CSV parsing
+    // --------
+
+    bool IsLineEnd(const char c)
+    {
+        return c == '\n' || c == '\r';
+    }
+
+    const char* SkipSpaces(const char* p, const char* end)
+    {
+        while (p != end && (*p == ' ' || *p == '\t')) p++;
+        return p;
+    }
+
+    /* Parse an integer field the way std::stoi does: leading spaces, an optional sign, and digits. Anything else up
+       to the end of the field is skipped, leaving `p` at the comma or line end. Returns false if there are no digits. */
+    bool ParseField(const char*& p, const char* end, long long& val)
+    {
+        p = SkipSpaces(p, end);
+
+        bool negative = false;
+        if (p != end && (*p == '-' || *p == '+')) {
+            negative = (*p == '-');
+            p++;
+        }
+        if (p == end || static_cast<unsigned>(*p - '0') >= 10) return false;
+
+        long long result = 0;
+        int nDigits = 0;
+        for (; p != end && static_cast<unsigned>(*p - '0') < 10; p++) {
+            if (nDigits++ < 18) result = result * 10 + (*p - '0');  // ignore digits that would overflow
+        }
+        while (p != end && *p != ',' && !IsLineEnd(*p)) p++;
+
+        val = negative ? -result : result;
+        return true;
+    }
+
+    // --------
+    // Cache format
+    // --------
+
+    const char cacheMagic[8] = {'G', 'M', 'L', 'U', 'T', 'C', '0', '1'};
+    const uint32_t byteOrderMark = 0x01020304;
+
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t byteOrder;
+        uint32_t valueSize;
+        uint8_t numCobos, numAsads, numAgets, numChannels;
+        uint32_t reserved;
+        uint64_t missingBits;
+        uint64_t sourceSize;
+        int64_t sourceModTime;
+        uint64_t numValues;
+        uint64_t numEntries;
+        uint64_t checksum;
+    };
+
+    //! FNV-1a, which is plenty to catch a damaged cache.
+    uint64_t Checksum(const uint8_t* data, const size_t len)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < len; i++) {
+            hash = (hash ^ data[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    CacheHeader MakeHeader(const LookupTableGeometry& geometry, const size_t valueSize, const uint64_t missingBits,
+                           const uint64_t sourceSize, const int64_t sourceModTime, const uint64_t numEntries,
+                           const uint64_t checksum)
+    {
+        CacheHeader header;
+        std::memset(&header, 0, sizeof(header));  // so headers can be compared with memcmp
+        std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+        header.byteOrder = byteOrderMark;
+        header.valueSize = static_cast<uint32_t>(valueSize);
+        header.numCobos = geometry.numCobos;
+        header.numAsads = geometry.numAsads;
+        header.numAgets = geometry.numAgets;
+        header.numChannels = geometry.numChannels;
+        header.missingBits = missingBits;
+        header.sourceSize = sourceSize;
+        header.sourceModTime = sourceModTime;
+        header.numValues = geometry.size() + 1;
+        header.numEntries = numEntries;
+        header.checksum = checksum;
+        return header;
+    }
+
+    //! Find the size and modification time of the CSV file. Returns false if it can't be read.
+    bool StatSource(const std::string& csvPath, uint64_t& size, int64_t& modTime)
+    {
+        boost::system::error_code ec;
+        size = boost::filesystem::file_size(csvPath, ec);
+        if (ec) return false;
+        modTime = static_cast<int64_t>(boost::filesystem::last_write_time(csvPath, ec));
+        return !ec;
+    }
+}
+
+// --------
+// CSV parsing
+// --------
+
+std::vector<LookupTableFile::Row> LookupTableFile::ParseCSV(const std::string& path)
+{
+    std::ifstream file (path, std::ios::in|std::ios::binary);
+    if (!file.good()) throw Exceptions::File_Open_Failed(path);
+
+    std::vector<char> text ((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (file.bad()) throw Exceptions::File_Open_Failed(path);
+
+    return ParseCSV(text.data(), text.data() + text.size());
+}
+
+std::vector<LookupTableFile::Row> LookupTableFile::ParseCSV(const char* begin, const char* end)
+{
+    std::vector<Row> rows;
+    size_t lineNum = 0;
+
+    const char* p = begin;
+    while (p != end) {
+        lineNum++;
+        const char* lineEnd = p;
+        while (lineEnd != end && !IsLineEnd(*lineEnd)) lineEnd++;
+
+        const char* next = lineEnd;
+        if (next != end) {
+            next += (*next == '\r' && next + 1 != end && next[1] == '\n') ? 2 : 1;
+        }
+
+        // Skip empty lines, and lines whose first field is empty or -1, like the old parser did
+        const char* first = SkipSpaces(p, lineEnd);
+        long long firstVal = 0;
+        const char* afterFirst = first;
+        if (first == lineEnd || *first == ','
+            || (ParseField(afterFirst, lineEnd, firstVal) && firstVal == -1)) {
+            p = next;
+            continue;
+        }
+
+        long long fields[5];
+        const char* q = p;
+        for (int i = 0; i < 5; i++) {
+            if (!ParseField(q, lineEnd, fields[i]) || (i < 4 && (q == lineEnd || *q++ != ','))) {
+                throw Exceptions::Bad_Data("Lookup table line " + std::to_string(lineNum)
+                                           + " doesn't have five integer fields.");
+            }
+        }
+        for (int i = 0; i < 4; i++) {
+            if (fields[i] < 0 || fields[i] > 255) {
+                throw Exceptions::Bad_Data("Lookup table line " + std::to_string(lineNum)
+                                           + " has an invalid address.");
+            }
+        }
+
+        rows.push_back({static_cast<addr_t>(fields[0]), static_cast<addr_t>(fields[1]),
+                        static_cast<addr_t>(fields[2]), static_cast<addr_t>(fields[3]), fields[4]});
+        p = next;
+    }
+
+    return rows;
+}
+
+// --------
+// Binary cache
+// --------
+
+std::string LookupTableFile::CachePath(const std::string& csvPath)
+{
+    return csvPath + ".bin";
+}
+
+bool LookupTableFile::LoadCache(const std::string& csvPath, const LookupTableGeometry& geometry,
+                                const size_t valueSize, const uint64_t missingBits, void* values, size_t& numEntries)
+{
+    uint64_t sourceSize;
+    int64_t sourceModTime;
+    if (!StatSource(csvPath, sourceSize, sourceModTime)) return false;
+
+    const std::string cachePath = CachePath(csvPath);
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    const size_t valuesSize = (geometry.size() + 1) * valueSize;
+    const size_t fileSize = sizeof(CacheHeader) + valuesSize;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != fileSize) {
+        close(fd);
+        BOOST_LOG_TRIVIAL(info) << "Lookup table cache " << cachePath << " doesn't match. Rebuilding it.";
+        return false;
+    }
+
+    void* addr = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    const uint8_t* mapped = static_cast<const uint8_t*>(addr);
+    const uint8_t* cachedValues = mapped + sizeof(CacheHeader);
+
+    CacheHeader header;
+    std::memcpy(&header, mapped, sizeof(header));
+    const CacheHeader expected = MakeHeader(geometry, valueSize, missingBits, sourceSize, sourceModTime,
+                                            header.numEntries, Checksum(cachedValues, valuesSize));
+
+    const bool valid = std::memcmp(&header, &expected, sizeof(header)) == 0;
+    if (valid) {
+        std::memcpy(values, cachedValues, valuesSize);
+        numEntries = header.numEntries;
+    }
+    munmap(addr, fileSize);
+
+    if (!valid) {
+        BOOST_LOG_TRIVIAL(info) << "Lookup table cache " << cachePath << " is out of date. Rebuilding it.";
+    }
+    return valid;
+}
+
+void LookupTableFile::SaveCache(const std::string& csvPath, const LookupTableGeometry& geometry,
+                                const size_t valueSize, const uint64_t missingBits, const void* values,
+                                const size_t numEntries)
+{
+    namespace fs = boost::filesystem;
+
+    uint64_t sourceSize;
+    int64_t sourceModTime;
+    if (!StatSource(csvPath, sourceSize, sourceModTime)) return;
+
+    const size_t valuesSize = (geometry.size() + 1) * valueSize;
+    const uint8_t* bytes = static_cast<const uint8_t*>(values);
+    const CacheHeader header = MakeHeader(geometry, valueSize, missingBits, sourceSize, sourceModTime, numEntries,
+                                          Checksum(bytes, valuesSize));
+
+    const fs::path cachePath {CachePath(csvPath)};
+    boost::system::error_code ec;
+    const fs::path tempPath = cachePath.parent_path()
+                              / fs::unique_path(cachePath.filename().string() + ".%%%%-%%%%.tmp", ec);
+    if (!ec) {
+        std::ofstream out (tempPath.string(), std::ios::out|std::ios::binary|std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(bytes), static_cast<std::streamsize>(valuesSize));
+        out.close();
+
+        // Renaming is atomic, so other jobs see either the old cache or the complete new one.
+        if (out.good()) fs::rename(tempPath, cachePath, ec);
+        else ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+    }
+
+    if (ec) {
+        boost::system::error_code ignored;
+        fs::remove(tempPath, ignored);
+        BOOST_LOG_TRIVIAL(warning) << "Could not write lookup table cache " << cachePath.string() << ": "
+                                   << ec.message();
+    }
+}
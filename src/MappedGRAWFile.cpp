@@ -0,0 +1,265 @@
+#include "MappedGRAWFile.h"
+
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const size_t MappedGRAWFile::prefetchWindow = 32*1024*1024;
+
+// --------
+// Constructors
+// --------
+
+MappedGRAWFile::MappedGRAWFile(const boost::filesystem::path& path)
+{
+    OpenFileForRead(path);
+}
+
+MappedGRAWFile::MappedGRAWFile(const std::string& path)
+{
+    boost::filesystem::path fp {path};
+    OpenFileForRead(fp);
+}
+
+// --------
+// Opening and Closing
+// --------
+
+void MappedGRAWFile::OpenFileForRead(const boost::filesystem::path& path)
+{
+    namespace fs = boost::filesystem;
+
+    if (isInitialized) throw Exceptions::Already_Init();
+
+    filePath = path;
+
+    if (!fs::exists(path)) {
+        throw Exceptions::Does_Not_Exist(path.string());
+    }
+    if (!fs::is_regular_file(path)) {
+        throw Exceptions::Wrong_File_Type(path.string());
+    }
+    if (path.extension() != ".graw") {
+        throw Exceptions::Wrong_File_Type(path.filename().string());
+    }
+
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw Exceptions::Bad_File(path.string());
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw Exceptions::Bad_File(path.string());
+    }
+
+    mappedSize = static_cast<size_t>(st.st_size);
+
+    if (mappedSize > 0) {
+        void* addr = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            throw Exceptions::Bad_File(path.string());
+        }
+
+        madvise(addr, mappedSize, MADV_SEQUENTIAL);
+
+        size_t len = mappedSize;
+        mapping = std::shared_ptr<uint8_t>(static_cast<uint8_t*>(addr), [len](uint8_t* p) { munmap(p, len); });
+    }
+
+    // The mapping holds its own reference to the file, so the descriptor isn't needed anymore.
+    close(fd);
+
+    cursor = 0;
+    adviseStart = 0;
+    nextAdviseAt = 0;
+    isEOF = (mappedSize == 0);
+    isOpen = true;
+    isInitialized = true;
+
+    AdviseAhead();
+}
+
+void MappedGRAWFile::OpenFileForRead(const std::string& path)
+{
+    boost::filesystem::path fp {path};
+    OpenFileForRead(fp);
+}
+
+void MappedGRAWFile::OpenFileForWrite(const boost::filesystem::path& path)
+{
+    throw Exceptions::File_Open_Failed(path.string());
+}
+
+void MappedGRAWFile::OpenFileForWrite(const std::string& path)
+{
+    throw Exceptions::File_Open_Failed(path);
+}
+
+void MappedGRAWFile::CloseFile()
+{
+    // Frames handed out earlier still hold references, so the memory is only unmapped once they're gone.
+    mapping.reset();
+    isOpen = false;
+}
+
+// --------
+// Getters for Raw Data and Properties
+// --------
+
+void MappedGRAWFile::AdviseAhead()
+{
+    // Nothing to do while the cursor is still in the first half of the last window
+    if (!mapping || (cursor >= adviseStart && cursor < nextAdviseAt)) return;
+
+    static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+    size_t start = cursor - (cursor % pageSize);
+    if (start >= mappedSize) return;
+
+    size_t len = std::min(prefetchWindow, mappedSize - start);
+    madvise(mapping.get() + start, len, MADV_WILLNEED);
+
+    adviseStart = start;
+    // Issue the next hint halfway through this window so the kernel stays ahead of us.
+    nextAdviseAt = start + len/2;
+}
+
+uint16_t MappedGRAWFile::GetNextFrameSize()
+{
+    if (!isOpen) {
+        throw Exceptions::Bad_File(filePath.filename().string());
+    }
+
+    if (!HaveBytes(4)) {
+        isEOF = true;
+        throw Exceptions::End_of_File();
+    }
+
+    const uint8_t* framePtr = mapping.get() + cursor;
+    uint8_t metaType = framePtr[0];
+
+    uint16_t size = Utilities::ExtractByteSwappedInt<uint16_t>(framePtr + 1, framePtr + 4);
+
+    if (size == 0) {
+        throw Exceptions::Frame_Read_Error();
+    }
+
+    // See if this size is right by checking if we get to the next frame
+
+    size_t frameBytes = size * static_cast<size_t>(GRAWFrame::sizeUnit);
+
+    if (cursor + frameBytes == mappedSize) {
+        // This is the last frame in the file.
+        isEOF = true;
+    }
+    else if (!HaveBytes(frameBytes)) {
+        // The last frame was truncated, so it can't be read.
+        isEOF = true;
+        throw Exceptions::Frame_Read_Error();
+    }
+    else if (framePtr[frameBytes] != metaType) {
+        throw Exceptions::Frame_Read_Error();
+    }
+
+    return size;
+}
+
+RawFrame MappedGRAWFile::ReadRawFrame()
+{
+    uint16_t sizeFromFile = GetNextFrameSize();
+    size_t dataSize = sizeFromFile * static_cast<size_t>(GRAWFrame::sizeUnit);
+
+    RawFrame frame_raw (mapping.get() + cursor, dataSize, mapping);
+    cursor += dataSize;
+
+    AdviseAhead();
+
+    return frame_raw;
+}
+
+GRAWFile::FrameMetadata MappedGRAWFile::ReadFrameMetadata()
+{
+    size_t startPos = cursor;
+    auto size = GetNextFrameSize();
+
+    const uint8_t* framePtr = mapping.get() + startPos;
+
+    // timestamp is 16 bytes from start, followed by the event ID, CoBo, and AsAd
+    ts_t timestamp = Utilities::ExtractByteSwappedInt<ts_t>(framePtr + 16, framePtr + 22);
+    evtid_t evtid = Utilities::ExtractByteSwappedInt<evtid_t>(framePtr + 22, framePtr + 26);
+
+    cursor = startPos + size*GRAWFrame::sizeUnit;  // move to start of next frame
+
+    AdviseAhead();
+
+    GRAWFile::FrameMetadata meta {};
+    meta.filePos = static_cast<std::streamoff>(startPos);
+    meta.evtId = evtid;
+    meta.evtTime = timestamp;
+    meta.size = size * static_cast<uint32_t>(GRAWFrame::sizeUnit);
+    meta.cobo = framePtr[26];
+    meta.asad = framePtr[27];
+
+    return meta;
+}
+
+evtid_t MappedGRAWFile::NextFrameEvtId()
+{
+    if (!isOpen || !HaveBytes(26)) {
+        isEOF = true;
+        throw Exceptions::End_of_File();
+    }
+
+    const uint8_t* framePtr = mapping.get() + cursor;
+    return Utilities::ExtractByteSwappedInt<evtid_t>(framePtr + 22, framePtr + 26);  // 22 bytes from start to id
+}
+
+bool MappedGRAWFile::eof() const
+{
+    if (!isInitialized) throw Exceptions::Not_Init();
+    return isEOF or cursor >= mappedSize;
+}
+
+bool MappedGRAWFile::is_open() const
+{
+    return isOpen;
+}
+
+std::streamoff MappedGRAWFile::GetPosition()
+{
+    if (!isInitialized) throw Exceptions::Not_Init();
+    return static_cast<std::streamoff>(cursor);
+}
+
+// --------
+// Moving the Read Cursor
+// --------
+
+void MappedGRAWFile::seek(const std::streampos pos)
+{
+    cursor = static_cast<size_t>(std::streamoff(pos));
+    isEOF = cursor >= mappedSize;
+    AdviseAhead();
+}
+
+void MappedGRAWFile::seek(const std::streamoff offset, std::ios_base::seekdir dir)
+{
+    std::streamoff base = 0;
+    if (dir == std::ios::cur) {
+        base = static_cast<std::streamoff>(cursor);
+    }
+    else if (dir == std::ios::end) {
+        base = static_cast<std::streamoff>(mappedSize);
+    }
+    seek(std::streampos(base + offset));
+}
+
+void MappedGRAWFile::Rewind()
+{
+    seek(std::streampos(0));
+}
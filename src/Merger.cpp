@@ -1,137 +1,520 @@
 #include "Merger.h"
 
-Merger::Merger(const std::vector<std::string>& filePaths, const std::shared_ptr<PadLookupTable>& lt)
-: lookupTable(lt)
+const size_t Merger::eventQueueCapacity = 16;
+const size_t Merger::builtQueueCapacity = 16;
+const double Merger::eventMemoryWarningMB = 1024;
+const size_t EventBuilder::frameBatchSize = 64;
+const size_t EventProcessor::eventBatchSize = 2;
+const size_t HDFWriter::eventBatchSize = 8;
+
+Merger::Merger(const std::vector<std::string>& filePaths, const std::shared_ptr<PadLookupTable>& lt,
+               const MergerOptions& opts)
+: lookupTable(lt), readerWindowWidth(std::max<size_t>(1, opts.maxPendingEvents / 2)),
+  maxPendingEvents(opts.maxPendingEvents), eventTimeout(opts.eventTimeout),
+  processThreads(std::max(1u, opts.processThreads)), processingOptions(opts.processing),
+  outputOptions(opts.output)
 {
     frameQueue = std::make_shared<SyncQueue<RawFrame>>();
-    eventQueue = std::make_shared<SyncQueue<Event>>();
+    builtQueue = std::make_shared<SyncQueue<SequencedEvent>>(builtQueueCapacity);
+    eventQueue = std::make_shared<SyncQueue<Event>>(eventQueueCapacity);
+
+    // The processors may each get a batch ahead of the slowest one before they have to wait for it.
+    const size_t inProcessing = processThreads * EventProcessor::eventBatchSize;
+    reorderBuffer = std::make_shared<ReorderBuffer<Event>>(eventQueue, 2 * inProcessing);
+
+    // Every event that can be in flight at once: pending in the builder, waiting in one of the queues, being processed
+    // or reordered, or being written. The pool keeps that many spares.
+    const size_t maxEventsInFlight = maxPendingEvents + builtQueueCapacity + 3 * inProcessing + eventQueueCapacity
+                                     + HDFWriter::eventBatchSize;
+    eventPool = std::make_shared<EventPool>(maxEventsInFlight);
+
+    auto indexBegin = std::chrono::steady_clock::now();
 
     for (const auto& path : filePaths) {
-        files.emplace_back(std::make_shared<GRAWFile>(path, std::ios::in));
+        if (opts.useMappedFiles) {
+            files.emplace_back(std::make_shared<MappedGRAWFile>(path));
+        }
+        else {
+            files.emplace_back(std::make_shared<GRAWFile>(path, std::ios::in));
+        }
     }
 
-    findex.indexFiles(files);
+    findex.indexFiles(files, opts.indexThreads);
+
+    indexSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - indexBegin).count();
+    BOOST_LOG_TRIVIAL(info) << "Indexing took " << indexSeconds << " s using up to " << opts.indexThreads << " threads";
+
+    // Each event holds a block of samples for every AsAd the index found, which the pool keeps once it's allocated
+    const size_t numSources = findex.getSources().size();
+    const double eventMB = numSources * Event::BytesPerAsad() / (1024.0 * 1024.0);
+    const double inFlightMB = eventMB * maxEventsInFlight;
+    BOOST_LOG_TRIVIAL(info) << "Each event takes " << eventMB << " MB for " << numSources << " AsAds, so the "
+                            << maxEventsInFlight << " events that can be in flight take up to " << inFlightMB << " MB";
+    if (inFlightMB > eventMemoryWarningMB) {
+        BOOST_LOG_TRIVIAL(warning) << "The events in flight may take up to " << inFlightMB << " MB of memory. "
+                                   << "Lower --max-pending-events to use less.";
+    }
 }
 
 void Merger::MergeByEvtId(const std::string &outfilename)
 {
     BOOST_LOG_TRIVIAL(info) << "Beginning merge";
 
-    EventBuilder builder (frameQueue, eventQueue, lookupTable);
-    HDFWriter writer (outfilename, eventQueue);
+    auto mergeBegin = std::chrono::steady_clock::now();
+
+    EventBuilder builder (frameQueue, builtQueue, lookupTable, eventPool, findex.getSources(), maxPendingEvents,
+                          eventTimeout);
+    HDFWriter writer (outfilename, eventQueue, eventPool, outputOptions);
+
+    std::vector<std::unique_ptr<EventProcessor>> processors;
+    for (unsigned i = 0; i < processThreads; i++) {
+        processors.emplace_back(new EventProcessor(builtQueue, reorderBuffer, processingOptions));
+    }
 
     builder.start();
+    for (auto& processor : processors) {
+        processor->start();
+    }
     writer.start();
 
-    for (evtid_t currentEvt = 0; files.size() > 0; currentEvt++) {
-        std::vector<std::shared_ptr<GRAWFile>> thisEvtFiles = findex.findFilesForEvtId(currentEvt);
-        for (auto& file : thisEvtFiles) {
-            try {
-                for (int i = 0; i < 4*2; i++) {
-                    RawFrame fr = file->ReadRawFrame();
-                    frameQueue->put(std::move(fr));
-                }
-            }
-            catch (const std::exception& err) {
-                BOOST_LOG_TRIVIAL(error) << "Error reading " << file->GetFilename() << ": " << err.what()
-                                         << ". File will be closed.";
+    // Start one reader per file. They are kept within a few events of each other so that
+    // the builder sees the frames of each event close together.
 
-                // Find the file in *our* list and erase it
-                auto doneFileIter = std::find(files.begin(), files.end(), file);
-                (*doneFileIter)->CloseFile();  // This should prevent findFilesForEvtId from returning this file again
-                files.erase(doneFileIter);
-            }
-        }
+    const auto& indexedFiles = findex.getIndexedFiles();
+    ReaderWindow window (indexedFiles.size(), readerWindowWidth);
+
+    std::vector<std::unique_ptr<FileReader>> readers;
+    for (size_t i = 0; i < indexedFiles.size(); i++) {
+        readers.emplace_back(new FileReader(indexedFiles[i], findex.getFrameList(i), findex.getEventIds(),
+                                            frameQueue, window, i));
+    }
+
+    for (auto& reader : readers) {
+        reader->start();
+    }
+    for (auto& reader : readers) {
+        reader->join();
     }
 
     // Now we're done reading frames, so cause the frame queue and threads to finish.
-    // The event queue will be finished by the EventBuilder.
+    // The built event queue will be finished by the EventBuilder.
 
     frameQueue->finish();
 
     builder.join();
+    for (auto& processor : processors) {
+        processor->join();
+    }
+
+    // Every processed event has gone through the reorder buffer by now
+    eventQueue->finish();
     writer.join();
+
+    const auto& stats = builder.getStats();
+    BOOST_LOG_TRIVIAL(info) << "Built " << stats.eventsEmitted << " events (" << stats.incompleteEvents
+                            << " incomplete, " << stats.lateFrames << " late frames dropped). Emit latency: mean "
+                            << stats.meanEmitLatency() * 1000 << " ms, max " << stats.maxEmitLatency * 1000 << " ms";
+    if (stats.hitPatternMismatchFrames > 0) {
+        BOOST_LOG_TRIVIAL(warning) << "The hit patterns of " << stats.hitPatternMismatchFrames
+                                   << " frames disagreed with their data: " << stats.missingHitChannels
+                                   << " hit channels had no data, and " << stats.unexpectedHitChannels
+                                   << " channels had data without being hit";
+    }
+    uint64_t eventsProcessed = 0;
+    double processSeconds = 0;
+    for (const auto& processor : processors) {
+        eventsProcessed += processor->numProcessed();
+        processSeconds += processor->processSeconds();
+    }
+    BOOST_LOG_TRIVIAL(info) << "Processed " << eventsProcessed << " events using " << processThreads
+                            << " threads in " << processSeconds << " s of CPU time. At most "
+                            << reorderBuffer->maxItemsHeld() << " events waited to be put back in order";
+    const auto& writerStats = writer.getStats();
+    BOOST_LOG_TRIVIAL(info) << "Writer spent " << writerStats.hdfSeconds << " s in HDF5 writing "
+                            << writerStats.buffersWritten << " buffers, " << writerStats.inputWaitSeconds
+                            << " s waiting for events, and " << writerStats.bufferWaitSeconds
+                            << " s waiting for HDF5 to finish with a buffer";
+    if (writerStats.eventsFailed > 0) {
+        BOOST_LOG_TRIVIAL(warning) << writerStats.eventsFailed << " events could not be written to the file";
+    }
+    BOOST_LOG_TRIVIAL(info) << "Event storage was allocated " << eventPool->numCreated() << " times and reused "
+                            << eventPool->numReused() << " times";
+
+    double mergeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mergeBegin).count();
+    BOOST_LOG_TRIVIAL(info) << "Merge took " << mergeSeconds << " s (indexing took " << indexSeconds << " s)";
 }
 
-bool EventBuilder::eventWasAlreadyWritten(const evtid_t evtid) const
+size_t ReaderWindow::lowestPosition() const
+{
+    return *std::min_element(positions.begin(), positions.end());
+}
+
+void ReaderWindow::advance(const size_t reader, const size_t ordinal)
+{
+    std::unique_lock<std::mutex> lock {mtx};
+
+    size_t oldLowest = lowestPosition();
+    positions.at(reader) = ordinal;
+    if (lowestPosition() != oldLowest) {
+        cond.notify_all();
+    }
+
+    cond.wait(lock, [this, ordinal]{ return ordinal < lowestPosition() + width; });
+}
+
+void ReaderWindow::finish(const size_t reader)
 {
-    return finishedEventIds.find(evtid) != finishedEventIds.end();
+    std::unique_lock<std::mutex> lock {mtx};
+    positions.at(reader) = std::numeric_limits<size_t>::max() - width;
+    cond.notify_all();
 }
 
-Event* EventBuilder::makeNewEvent(const evtid_t evtid)
+void FileReader::run()
 {
-    Event newevt;
-    newevt.SetLookupTable(lookupTable);
-    eventCache.insert(evtid, std::move(newevt));
-    return eventCache.get(evtid);
+    // Read in event order, even if the file isn't quite in that order
+    std::stable_sort(frames.begin(), frames.end(),
+                     [] (const GRAWFile::FrameMetadata& a, const GRAWFile::FrameMetadata& b) {
+                         return a.evtId < b.evtId;
+                     });
+
+    std::vector<RawFrame> batch;
+
+    for (auto iter = frames.begin(); iter != frames.end(); ) {
+        const evtid_t evtid = iter->evtId;
+        auto ordinal = static_cast<size_t>(std::lower_bound(eventIds.begin(), eventIds.end(), evtid)
+                                           - eventIds.begin());
+        window.advance(readerId, ordinal);
+
+        try {
+            for ( ; iter != frames.end() && iter->evtId == evtid; iter++) {
+                // Frames are usually stored in event order, so only seek if this one isn't next in the file.
+                if (file->GetPosition() != iter->filePos) {
+                    file->seek(iter->filePos);
+                }
+                batch.push_back(file->ReadRawFrame());
+            }
+            rawFrameQueue->putBatch(batch);
+        }
+        catch (const std::exception& err) {
+            BOOST_LOG_TRIVIAL(error) << "Error reading " << file->GetFilename() << ": " << err.what()
+                                     << ". File will be closed.";
+            // Pass on the frames that were read before the error
+            rawFrameQueue->putBatch(batch);
+            file->CloseFile();
+            break;
+        }
+    }
+
+    window.finish(readerId);
+}
+
+EventBuilder::EventBuilder(const std::shared_ptr<SyncQueue<RawFrame>>& rawFrameQueue,
+                           const std::shared_ptr<SyncQueue<SequencedEvent>>& outputQueue,
+                           const std::shared_ptr<PadLookupTable>& lookupTable,
+                           const std::shared_ptr<EventPool>& eventPool,
+                           const std::set<std::pair<addr_t, addr_t>>& sources,
+                           const size_t maxPendingEvents, const double timeout)
+: rawFrameQueue(rawFrameQueue), outputQueue(outputQueue), lookupTable(lookupTable), eventPool(eventPool),
+  nextSeq(0), expectedSources(0),
+  maxPendingEvents(std::max<size_t>(1, maxPendingEvents)),
+  timeout(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timeout))),
+  blockedTime(Clock::duration::zero())
+{
+    for (const auto& src : sources) {
+        expectedSources |= SourceBit(src.first, src.second);
+    }
+    numExpectedSources = sources.size();
+}
+
+EventBuilder::SourceMask EventBuilder::SourceBit(const addr_t cobo, const addr_t asad)
+{
+    const unsigned bit = cobo * Constants::num_asads + asad;
+    if (asad >= Constants::num_asads || bit >= 64) return 0;
+    return SourceMask(1) << bit;
+}
+
+bool EventBuilder::eventWasAlreadyWritten(const evtid_t evtid) const
+{
+    return finishedEventIds.contains(evtid);
 }
 
 void EventBuilder::run()
 {
+    std::vector<RawFrame> batch;
+
     while (true) {
-        // Get a raw frame from the input queue
-        RawFrame raw;
+        // Get a batch of raw frames from the input queue
         try {
-            rawFrameQueue->get(raw);
+            rawFrameQueue->getBatch(batch, frameBatchSize);
         }
         catch (const NoMoreTasks&) {
-            // There won't be more frames, so write all pending events to disk and return
-            eventCache.flush();
+            // There won't be more frames, so send on all pending events and return
+            while (!pendingEvents.empty()) {
+                emitEvent(pendingEvents.begin());
+            }
+            flushOutputBatch();
             outputQueue->finish();
             return;
         }
 
-        GRAWFrame frame (raw);  // Parse the raw frame
-        evtid_t evtid = frame.eventId;
-
-        // Try to get this event from the event cache
-        Event* evtPtr = nullptr;
-        try {
-            evtPtr = eventCache.get(evtid);
-        }
-        catch (const std::out_of_range&) {
-            // Event was not in the cache. Was it already evicted?
-            if (eventWasAlreadyWritten(evtid)) {
-                // This event was already evicted. This is a problem.
-                BOOST_LOG_TRIVIAL(warning) << "Found frame for event " << evtid << ", but this event was already written!";
-                continue;
+        for (const auto& raw : batch) {
+            try {
+                addFrame(raw);
             }
-            else {
-                // This must be an event we haven't seen yet, so make a new one.
-                evtPtr = makeNewEvent(evtid);
+            catch (const std::exception& err) {
+                BOOST_LOG_TRIVIAL(error) << "Skipping bad frame: " << err.what();
             }
         }
-        assert(evtPtr != nullptr);
 
-        evtPtr->AppendFrame(frame);
+        emitStaleEvents();
+        flushOutputBatch();
+    }
+}
+
+void EventBuilder::addFrame(const RawFrame& raw)
+{
+    // Only the header is parsed here. The data items are decoded into the reused scratch buffer, then into the event.
+    const GRAWFrameView frame (raw);
+    evtid_t evtid = frame.eventId();
+
+    auto iter = pendingEvents.find(evtid);
+    if (iter == pendingEvents.end()) {
+        if (eventWasAlreadyWritten(evtid)) {
+            // This event was already emitted, so it's too late to add this frame to it.
+            BOOST_LOG_TRIVIAL(warning) << "Found frame for event " << evtid << ", but this event was already written!";
+            stats.lateFrames++;
+            return;
+        }
+
+        // This must be an event we haven't seen yet, so make a new one.
+        PendingEvent pending {eventPool->acquire(), 0, Clock::now(), blockedTime};
+        pending.evt.SetLookupTable(lookupTable);
+        pending.evt.Reserve(numExpectedSources);
+        iter = pendingEvents.emplace(evtid, std::move(pending)).first;
+    }
+
+    const HitPatternMismatch mismatch = iter->second.evt.AppendRawFrame(frame, decodedItems);
+    if (mismatch.any()) {
+        stats.hitPatternMismatchFrames++;
+        stats.missingHitChannels += mismatch.nMissing;
+        stats.unexpectedHitChannels += mismatch.nUnexpected;
+    }
+    iter->second.sourcesSeen |= SourceBit(frame.coboId(), frame.asadId());
+
+    if ((iter->second.sourcesSeen & expectedSources) == expectedSources) {
+        emitEvent(iter);
+    }
+}
+
+void EventBuilder::emitEvent(const PendingMap::iterator& iter)
+{
+    PendingEvent& pending = iter->second;
+
+    if ((pending.sourcesSeen & expectedSources) != expectedSources) {
+        stats.incompleteEvents++;
+        BOOST_LOG_TRIVIAL(debug) << "Emitting event " << iter->first << " without all of its frames";
+    }
+
+    double latency = std::chrono::duration<double>(Clock::now() - pending.firstFrameTime).count();
+    stats.eventsEmitted++;
+    stats.totalEmitLatency += latency;
+    stats.maxEmitLatency = std::max(stats.maxEmitLatency, latency);
+
+    outputEvent(std::move(pending.evt));
+    pendingEvents.erase(iter);
+}
+
+void EventBuilder::emitStaleEvents()
+{
+    auto now = Clock::now();
+    for (auto iter = pendingEvents.begin(); iter != pendingEvents.end(); ) {
+        auto current = iter++;
+        const PendingEvent& pending = current->second;
+        if (now - pending.firstFrameTime - (blockedTime - pending.blockedBefore) > timeout) {
+            emitEvent(current);
+        }
+    }
+
+    while (pendingEvents.size() > maxPendingEvents) {
+        emitEvent(pendingEvents.begin());
+    }
+}
+
+void EventBuilder::outputEvent(Event&& evt)
+{
+    finishedEventIds.insert(evt.eventId);
+
+    SequencedEvent sequenced;
+    sequenced.seq = nextSeq++;
+    sequenced.evt = std::move(evt);
+    outputBatch.push_back(std::move(sequenced));
+}
+
+void EventBuilder::flushOutputBatch()
+{
+    if (!outputBatch.empty()) {
+        const auto begin = Clock::now();
+        outputQueue->putBatch(outputBatch);
+        blockedTime += Clock::now() - begin;
     }
 }
 
-void EventBuilder::processAndOutputEvent(Event&& evt)
+void EventProcessor::process(Event& evt, const ProcessingOptions& opts)
 {
     evt.SubtractFPN();
-    finishedEventIds.emplace(evt.eventId);
-    outputQueue->put(std::forward<Event&&>(evt));
+    if (opts.pedestals) {
+        evt.SubtractPedestals(*opts.pedestals);
+    }
+    if (opts.applyThreshold) {
+        evt.ApplyThreshold(opts.threshold);
+    }
 }
 
-void HDFWriter::run()
+void EventProcessor::run()
 {
+    std::vector<SequencedEvent> batch;
+
     while (true) {
         try {
-            Event evt;
-            eventQueue->get(evt);
-            BOOST_LOG_TRIVIAL(trace) << "Event " << evt.eventId << " was written";
-            hfile.writeEvent(evt);
-            numEvtsWritten++;
-            if (numEvtsWritten % 100 == 0) {
-                BOOST_LOG_TRIVIAL(info) << numEvtsWritten << " events have been written";
-            }
+            inputQueue->getBatch(batch, eventBatchSize);
         }
         catch (const NoMoreTasks&) {
             return;
         }
-        catch (std::exception& e) {
-            BOOST_LOG_TRIVIAL(error) << "Error in writer: " << e.what() << std::endl;
+
+        for (auto& item : batch) {
+            auto begin = std::chrono::steady_clock::now();
+            try {
+                process(item.evt, opts);
+            }
+            catch (const std::exception& err) {
+                BOOST_LOG_TRIVIAL(error) << "Error processing event " << item.evt.eventId << ": " << err.what();
+            }
+            busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            eventsProcessed++;
+
+            // Every event must go through the buffer, or the ones after it would wait forever.
+            reorderBuffer->put(item.seq, std::move(item.evt));
+        }
+    }
+}
+
+HDFWriter::HDFWriter(const std::string& filePath,
+                     const std::shared_ptr<SyncQueue<Event>>& outputQueue,
+                     const std::shared_ptr<EventPool>& eventPool,
+                     const HDFWriteOptions& opts)
+: hfile(filePath, true, opts), eventQueue(outputQueue), eventPool(eventPool),
+  bufferTraces(std::max<hsize_t>(1, opts.batchTraces)), numEvtsWritten(0), fullBuffers(2), emptyBuffers(2)
+{
+    // The second buffer, for when the first one is being written
+    HDFDataStore::EventBatch spare;
+    emptyBuffers.put(std::move(spare));
+}
+
+void HDFWriter::run()
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::thread hdfThread ([this]{ writeBuffers(); });
+
+    try {
+        std::vector<Event> batch;
+
+        while (true) {
+            auto waitBegin = Clock::now();
+            try {
+                eventQueue->getBatch(batch, eventBatchSize);
+            }
+            catch (const NoMoreTasks&) {
+                break;
+            }
+            stats.inputWaitSeconds += std::chrono::duration<double>(Clock::now() - waitBegin).count();
+
+            for (auto& evt : batch) {
+                filling.add(evt);
+                BOOST_LOG_TRIVIAL(trace) << "Event " << evt.eventId << " was staged";
+
+                // Hand the storage back so the builder can use it for another event
+                eventPool->release(std::move(evt));
+
+                if (filling.numTraces() >= bufferTraces) {
+                    swapBuffers();
+                }
+            }
+        }
+
+        // Write what's left
+        if (!filling.empty()) {
+            fullBuffers.put(std::move(filling));
+        }
+    }
+    catch (...) {
+        // The HDF5 thread must be joined before it goes out of scope, or the program terminates. Let it write the
+        // buffers it already has and stop, then pass the error on.
+        fullBuffers.finish();
+        hdfThread.join();
+        throw;
+    }
+
+    // Wait for the HDF5 thread to finish
+    fullBuffers.finish();
+    hdfThread.join();
+}
+
+void HDFWriter::swapBuffers()
+{
+    fullBuffers.put(std::move(filling));
+
+    auto waitBegin = std::chrono::steady_clock::now();
+    emptyBuffers.get(filling);
+    stats.bufferWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitBegin).count();
+}
+
+void HDFWriter::writeBuffers()
+{
+    HDFDataStore::EventBatch buffer;
+
+    while (true) {
+        try {
+            fullBuffers.get(buffer);
+        }
+        catch (const NoMoreTasks&) {
+            break;
+        }
+
+        // In the PerEvent layout, the store skips an event that fails and writes the rest. The other layouts append
+        // the whole buffer at once, so if that fails, none of its events are written.
+        auto begin = std::chrono::steady_clock::now();
+        const size_t eventsBefore = hfile.numEvents();
+        try {
+            hfile.writeBatch(buffer);
+        }
+        catch (const std::exception& e) {
+            BOOST_LOG_TRIVIAL(error) << "Error in writer: " << e.what();
+        }
+        catch (const H5::Exception& e) {
+            BOOST_LOG_TRIVIAL(error) << "Error in writer: " << e.getDetailMsg();
         }
+        stats.hdfSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        stats.buffersWritten++;
+
+        const size_t written = hfile.numEvents() - eventsBefore;
+        if (written < buffer.events.size()) {
+            const size_t failed = buffer.events.size() - written;
+            BOOST_LOG_TRIVIAL(error) << failed << " of the " << buffer.events.size() << " events from "
+                                     << buffer.events.front().eventId << " to " << buffer.events.back().eventId
+                                     << " could not be written";
+            stats.eventsFailed += failed;
+        }
+
+        const uint64_t previous = numEvtsWritten;
+        numEvtsWritten += written;
+        if (numEvtsWritten / 100 != previous / 100) {
+            BOOST_LOG_TRIVIAL(info) << numEvtsWritten << " events have been written";
+        }
+
+        // Send the buffer back, keeping its memory, to be filled again
+        buffer.clear();
+        emptyBuffers.put(std::move(buffer));
     }
 }
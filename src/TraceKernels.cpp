@@ -0,0 +1,147 @@
+#include "TraceKernels.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Each function handles as many whole vectors of 8 samples as it can with SSE2, then finishes the rest one at a time.
+
+namespace {
+#ifdef __SSE2__
+    const size_t lanes = 8;
+
+    __m128i Load(const sample_t* ptr)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    }
+
+    void Store(sample_t* ptr, const __m128i vals)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), vals);
+    }
+#endif
+}
+
+void TraceKernels::AccumulateWithCount(sample_t* sum, int16_t* count, const sample_t* trace, const size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    for ( ; i + lanes <= n; i += lanes) {
+        const __m128i tr = Load(trace + i);
+        Store(sum + i, _mm_add_epi16(Load(sum + i), tr));
+        const __m128i isNonzero = _mm_andnot_si128(_mm_cmpeq_epi16(tr, zero), one);
+        Store(count + i, _mm_add_epi16(Load(count + i), isNonzero));
+    }
+#endif
+    for ( ; i < n; i++) {
+        sum[i] = static_cast<sample_t>(sum[i] + trace[i]);
+        if (trace[i] != 0) count[i]++;
+    }
+}
+
+void TraceKernels::DivideByCount(sample_t* vals, const int16_t* count, const size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    // Divide in single precision. The quotients are exact enough for truncation to give the integer result, since
+    // the values have at most 16 bits and the fractional part of a quotient is at least 1/count from an integer.
+    const __m128i one = _mm_set1_epi16(1);
+    for ( ; i + lanes <= n; i += lanes) {
+        const __m128i v = Load(vals + i);
+        const __m128i c = _mm_max_epi16(Load(count + i), one);  // a zero count means the value is zero too
+
+        // Sign-extend each half to 32 bits
+        const __m128i vLo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        const __m128i vHi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        const __m128i cLo = _mm_srai_epi32(_mm_unpacklo_epi16(c, c), 16);
+        const __m128i cHi = _mm_srai_epi32(_mm_unpackhi_epi16(c, c), 16);
+
+        const __m128i qLo = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(vLo), _mm_cvtepi32_ps(cLo)));
+        const __m128i qHi = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(vHi), _mm_cvtepi32_ps(cHi)));
+        Store(vals + i, _mm_packs_epi32(qLo, qHi));
+    }
+#endif
+    for ( ; i < n; i++) {
+        if (count[i] != 0) {
+            vals[i] = static_cast<sample_t>(vals[i] / count[i]);
+        }
+    }
+}
+
+void TraceKernels::SumNonzero(const sample_t* vals, const size_t n, int64_t& total, int64_t& numNonzero)
+{
+    total = 0;
+    numNonzero = 0;
+
+    size_t i = 0;
+#ifdef __SSE2__
+    // 32-bit partial sums are plenty for a trace: 512 samples of at most 2^15 each need 24 bits.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i sums = zero;
+    __m128i counts = zero;
+    for ( ; i + lanes <= n; i += lanes) {
+        const __m128i v = Load(vals + i);
+        sums = _mm_add_epi32(sums, _mm_madd_epi16(v, one));
+        const __m128i isNonzero = _mm_andnot_si128(_mm_cmpeq_epi16(v, zero), one);
+        counts = _mm_add_epi32(counts, _mm_madd_epi16(isNonzero, one));
+    }
+
+    int32_t sumParts[4];
+    int32_t countParts[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sumParts), sums);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(countParts), counts);
+    for (int j = 0; j < 4; j++) {
+        total += sumParts[j];
+        numNonzero += countParts[j];
+    }
+#endif
+    for ( ; i < n; i++) {
+        total += vals[i];
+        if (vals[i] != 0) numNonzero++;
+    }
+}
+
+void TraceKernels::SubtractScalar(sample_t* vals, const sample_t offset, const size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i off = _mm_set1_epi16(offset);
+    for ( ; i + lanes <= n; i += lanes) {
+        Store(vals + i, _mm_sub_epi16(Load(vals + i), off));
+    }
+#endif
+    for ( ; i < n; i++) {
+        vals[i] = static_cast<sample_t>(vals[i] - offset);
+    }
+}
+
+void TraceKernels::Subtract(sample_t* trace, const sample_t* vals, const size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for ( ; i + lanes <= n; i += lanes) {
+        Store(trace + i, _mm_sub_epi16(Load(trace + i), Load(vals + i)));
+    }
+#endif
+    for ( ; i < n; i++) {
+        trace[i] = static_cast<sample_t>(trace[i] - vals[i]);
+    }
+}
+
+void TraceKernels::ZeroBelow(sample_t* vals, const sample_t threshold, const size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i thresh = _mm_set1_epi16(threshold);
+    for ( ; i + lanes <= n; i += lanes) {
+        const __m128i v = Load(vals + i);
+        Store(vals + i, _mm_andnot_si128(_mm_cmplt_epi16(v, thresh), v));
+    }
+#endif
+    for ( ; i < n; i++) {
+        if (vals[i] < threshold) vals[i] = 0;
+    }
+}
@@ -53,11 +53,25 @@ std::vector<std::string> FindGRAWFilesInDir(boost::filesystem::path eventRoot)
 
 void MergeFiles(boost::filesystem::path input_path,
                 boost::filesystem::path output_path,
-                boost::filesystem::path lookup_path)
+                boost::filesystem::path lookup_path,
+                boost::filesystem::path pedestals_path,
+                const bool useLookupCache,
+                MergerOptions opts)
 {
-    // Import the lookup table
-
-    std::shared_ptr<PadLookupTable> lookupTable = std::make_shared<PadLookupTable>(lookup_path.string());
+    // Import the lookup table, and the pedestals if there are any
+
+    std::shared_ptr<PadLookupTable> lookupTable = std::make_shared<PadLookupTable>(lookup_path.string(),
+                                                                                   LookupTableGeometry(),
+                                                                                   useLookupCache);
+
+    if (!pedestals_path.empty()) {
+        opts.processing.pedestals = std::make_shared<LookupTable<sample_t>>(pedestals_path.string(),
+                                                                            LookupTableGeometry(),
+                                                                            useLookupCache);
+        if (opts.processing.pedestals->Empty()) {
+            throw Exceptions::Bad_File(pedestals_path.string());
+        }
+    }
 
     // Find files in the provided directory
 
@@ -68,7 +82,7 @@ void MergeFiles(boost::filesystem::path input_path,
         throw Exceptions::Dir_is_Empty(input_path.string());
     }
 
-    Merger mg (filePaths, lookupTable);
+    Merger mg (filePaths, lookupTable, opts);
 
     mg.MergeByEvtId(output_path.string());
 
@@ -85,7 +99,11 @@ int main(int argc, const char * argv[])
     std::string usage =
         "graw2hdf (v2.0): A tool for merging GRAW files into HDF5 files.\n"
         "\n"
-        "usage: graw2hdf [-v] --lookup <path> <input_path> [<output_path>]\n"
+        "usage: graw2hdf [-v] [--mmap] [--index-threads N] [--max-pending-events N] [--event-timeout S]\n"
+        "                [--process-threads N] [--chunk-traces N] [--shuffle] [--deflate N]\n"
+        "                [--scale-offset | --nbit N] [--layout per-event|table|sparse] [--write-buffer-traces N]\n"
+        "                [--pedestals <path>] [--threshold N] [--no-lookup-cache]\n"
+        "                --lookup <path> <input_path> [<output_path>]\n"
         "\n"
         "If output file is not specified, default is based on input path.\n"
         "Ex: /data/run_0001/ as input produces /data/run_0001.h5 as output.";
@@ -98,8 +116,33 @@ int main(int argc, const char * argv[])
         ("help,h", "Output a help message")
         ("verbose,v", "Show more output")
         ("lookup,l", po::value<fs::path>(), "Lookup table")
+        ("no-lookup-cache", "Parse the lookup table every time instead of caching it in binary form next to it")
+        ("pedestals", po::value<fs::path>(), "Subtract the pedestals in this table (csv, like the lookup table)")
+        ("threshold", po::value<int>(), "Set samples below this value to zero, after subtracting the pedestals")
         ("input,i", po::value<fs::path>(), "Input directory")
         ("output,o", po::value<fs::path>(), "Output file")
+        ("mmap", "Read GRAW files through a memory mapping instead of a filestream")
+        ("index-threads", po::value<unsigned>()->default_value(4), "Number of threads used to index the GRAW files")
+        ("max-pending-events", po::value<size_t>()->default_value(10),
+         "Number of incomplete events to hold before writing the oldest one. Each one costs about 280 kB of memory "
+         "per AsAd in the run")
+        ("event-timeout", po::value<double>()->default_value(1.0),
+         "Seconds to wait for the missing frames of an event before writing it anyway")
+        ("process-threads", po::value<unsigned>()->default_value(1),
+         "Number of threads used to process events (e.g. subtract the FPN) before they are written")
+        ("layout", po::value<std::string>()->default_value("per-event"),
+         "Store each event as its own dataset (per-event), all traces in one dataset with an event table (table), "
+         "or only the nonzero samples of each trace with an event table (sparse)")
+        ("write-buffer-traces", po::value<hsize_t>()->default_value(4096),
+         "Number of traces collected in each of the writer's two buffers before they are written together")
+        ("chunk-traces", po::value<hsize_t>()->default_value(64),
+         "Number of traces per chunk when the output is compressed")
+        ("shuffle", "Shuffle the bytes of the samples before compressing them")
+        ("deflate", po::value<unsigned>()->default_value(0), "Compress the output with deflate at this level (1-9)")
+        ("scale-offset", "Pack each chunk of the output into as few bits as it needs (lossless)")
+        ("nbit", po::value<unsigned>()->default_value(0),
+         "Store the samples with this many bits, including the sign: 11-16, with --layout sparse only. "
+         "Samples that don't fit are clipped")
     ;
 
     po::positional_options_description pos_opts;
@@ -144,6 +187,15 @@ int main(int argc, const char * argv[])
             return 1;
         }
 
+        fs::path pedestalsPath {};
+        if (vm.count("pedestals")) {
+            pedestalsPath = vm["pedestals"].as<fs::path>();
+            if (not fs::exists(pedestalsPath)) {
+                BOOST_LOG_TRIVIAL(fatal) << "Error: Provided pedestals table path does not exist.";
+                return 1;
+            }
+        }
+
         // Build the output path
         fs::path outputFilePath {};
         if (vm.count("output")) {
@@ -162,8 +214,75 @@ int main(int argc, const char * argv[])
             }
         }
 
+        MergerOptions opts;
+        opts.useMappedFiles = vm.count("mmap") > 0;
+        opts.indexThreads = vm["index-threads"].as<unsigned>();
+        opts.maxPendingEvents = vm["max-pending-events"].as<size_t>();
+        opts.eventTimeout = vm["event-timeout"].as<double>();
+        if (!(opts.eventTimeout > 0)) {
+            BOOST_LOG_TRIVIAL(fatal) << "Error: The event timeout must be more than zero seconds.";
+            return 1;
+        }
+        opts.processThreads = vm["process-threads"].as<unsigned>();
+        if (vm.count("threshold")) {
+            const int threshold = vm["threshold"].as<int>();
+            if (threshold < Constants::min_sample || threshold > Constants::max_sample) {
+                BOOST_LOG_TRIVIAL(fatal) << "Error: The threshold must fit in a sample (" << Constants::min_sample
+                                         << " to " << Constants::max_sample << ").";
+                return 1;
+            }
+            opts.processing.applyThreshold = true;
+            opts.processing.threshold = static_cast<sample_t>(threshold);
+        }
+        const std::string layout = vm["layout"].as<std::string>();
+        if (layout == "per-event") {
+            opts.output.layout = HDFLayout::PerEvent;
+        }
+        else if (layout == "table") {
+            opts.output.layout = HDFLayout::Table;
+        }
+        else if (layout == "sparse") {
+            opts.output.layout = HDFLayout::Sparse;
+        }
+        else {
+            BOOST_LOG_TRIVIAL(fatal) << "Error: Unknown layout " << layout
+                                     << ". It must be per-event, table, or sparse.";
+            return 1;
+        }
+
+        opts.output.batchTraces = vm["write-buffer-traces"].as<hsize_t>();
+        opts.output.chunkTraces = vm["chunk-traces"].as<hsize_t>();
+        opts.output.shuffle = vm.count("shuffle") > 0;
+        opts.output.deflateLevel = vm["deflate"].as<unsigned>();
+        opts.output.scaleOffset = vm.count("scale-offset") > 0;
+        opts.output.nbitPrecision = vm["nbit"].as<unsigned>();
+
+        if (opts.output.deflateLevel > 9) {
+            BOOST_LOG_TRIVIAL(fatal) << "Error: The deflate level must be between 0 and 9.";
+            return 1;
+        }
+        if (opts.output.nbitPrecision > 0
+            && (opts.output.nbitPrecision < opts.output.MinNbitPrecision() || opts.output.nbitPrecision > 16)) {
+            BOOST_LOG_TRIVIAL(fatal) << "Error: The n-bit precision must be between "
+                                     << opts.output.MinNbitPrecision() << " and 16 bits for the " << layout
+                                     << " layout, so that only the samples can be clipped.";
+            return 1;
+        }
+        if (opts.output.scaleOffset && opts.output.nbitPrecision > 0) {
+            BOOST_LOG_TRIVIAL(fatal) << "Error: Only one of --scale-offset and --nbit can be used.";
+            return 1;
+        }
+        if (opts.output.batchTraces == 0) {
+            BOOST_LOG_TRIVIAL(fatal) << "Error: The write buffers must hold at least one trace.";
+            return 1;
+        }
+        if (opts.output.chunkTraces == 0) {
+            BOOST_LOG_TRIVIAL(fatal) << "Error: There must be at least one trace per chunk.";
+            return 1;
+        }
+
         try {
-            MergeFiles(rootDir, outputFilePath, lookupTablePath);
+            MergeFiles(rootDir, outputFilePath, lookupTablePath, pedestalsPath, vm.count("no-lookup-cache") == 0, opts);
         }
         catch (std::exception& e) {
             BOOST_LOG_TRIVIAL(fatal) << "Error: " << e.what();
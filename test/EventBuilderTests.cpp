@@ -0,0 +1,101 @@
+//
+//  EventBuilderTests.cpp
+//  graw-merger
+//
+
+#include "gtest/gtest.h"
+#include "Merger.h"
+#include "FakeRawFrame.h"
+
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <boost/filesystem.hpp>
+
+class EventBuilderTestFixture : public testing::Test
+{
+public:
+    virtual void SetUp();
+    virtual void TearDown();
+
+    //! \brief A frame for the given event from CoBo 0, with one data item.
+    RawFrame MakeFrame(const evtid_t evtId, const uint8_t asad);
+
+protected:
+    boost::filesystem::path lookupPath;
+    std::shared_ptr<PadLookupTable> lookupTable;
+};
+
+void EventBuilderTestFixture::SetUp()
+{
+    lookupPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+
+    std::ofstream csv (lookupPath.string());
+    for (int asad = 0; asad < 2; asad++) {
+        csv << 0 << "," << asad << "," << 0 << "," << 0 << "," << asad << "\n";
+    }
+    csv.close();
+
+    lookupTable = std::make_shared<PadLookupTable>(lookupPath.string());
+}
+
+void EventBuilderTestFixture::TearDown()
+{
+    boost::filesystem::remove(lookupPath);
+}
+
+RawFrame EventBuilderTestFixture::MakeFrame(const evtid_t evtId, const uint8_t asad)
+{
+    FakeRawFrame fake (1000 + evtId, evtId, 0, asad);
+    fake.ClearDataItems();
+    fake.AppendDataItem(0, 0, 0, 1);
+    return fake.GenerateRawFrame();
+}
+
+TEST_F(EventBuilderTestFixture, EventsDontAgeWhileOutputIsBlocked)
+{
+    auto rawQueue = std::make_shared<SyncQueue<RawFrame>>(4096);
+    auto outQueue = std::make_shared<SyncQueue<SequencedEvent>>(2);
+    auto pool = std::make_shared<EventPool>(4);
+    const double timeout = 0.1;
+    EventBuilder builder (rawQueue, outQueue, lookupTable, pool, {{0, 0}, {0, 1}}, 1000, timeout);
+
+    // Fill the output queue, so the builder blocks as soon as it emits an event
+    for (int i = 0; i < 2; i++) {
+        SequencedEvent dummy;
+        outQueue->put(std::move(dummy));
+    }
+
+    // Event 1 is waiting for its second frame when event 2 is emitted and the builder blocks
+    rawQueue->put(MakeFrame(1, 0));
+    rawQueue->put(MakeFrame(2, 0));
+    rawQueue->put(MakeFrame(2, 1));
+    builder.start();
+    std::this_thread::sleep_for(std::chrono::duration<double>(5 * timeout));
+
+    // Event 1's last frame comes after more than a batch of other frames
+    for (evtid_t evtId = 3; evtId < 3 + EventBuilder::frameBatchSize; evtId++) {
+        rawQueue->put(MakeFrame(evtId, 0));
+        rawQueue->put(MakeFrame(evtId, 1));
+    }
+    rawQueue->put(MakeFrame(1, 1));
+
+    // finish() waits for the builder to take every frame, which it can only do once the output is drained
+    std::thread finisher ([&rawQueue] { rawQueue->finish(); });
+
+    size_t nOutput = 0;
+    try {
+        SequencedEvent out;
+        while (true) {
+            outQueue->get(out);
+            nOutput++;
+        }
+    }
+    catch (const NoMoreTasks&) {}
+    finisher.join();
+    builder.join();
+
+    EXPECT_EQ(2 + 2 + EventBuilder::frameBatchSize, nOutput);
+    EXPECT_EQ(0u, builder.getStats().incompleteEvents);
+    EXPECT_EQ(0u, builder.getStats().lateFrames);
+}
@@ -0,0 +1,113 @@
+//
+//  EventIdWindowTests.cpp
+//  graw-merger
+//
+
+#include "gtest/gtest.h"
+#include "EventIdWindow.h"
+
+#include <limits>
+
+TEST(EventIdWindowTests, WidthRoundsUp)
+{
+    EXPECT_EQ(64u, EventIdWindow(1).width());
+    EXPECT_EQ(128u, EventIdWindow(100).width());
+    EXPECT_EQ(65536u, EventIdWindow().width());
+}
+
+TEST(EventIdWindowTests, InOrderMovesWatermark)
+{
+    EventIdWindow win (64);
+    for (evtid_t i = 0; i < 10; i++) {
+        EXPECT_FALSE(win.contains(i));
+        win.insert(i);
+        EXPECT_TRUE(win.contains(i));
+    }
+    EXPECT_EQ(10u, win.lowWatermark());
+    EXPECT_FALSE(win.contains(10));
+}
+
+TEST(EventIdWindowTests, OutOfOrder)
+{
+    EventIdWindow win (64);
+    win.insert(3);
+    win.insert(1);
+
+    EXPECT_FALSE(win.contains(0));
+    EXPECT_TRUE(win.contains(1));
+    EXPECT_FALSE(win.contains(2));
+    EXPECT_TRUE(win.contains(3));
+    EXPECT_EQ(0u, win.lowWatermark());
+
+    win.insert(0);
+    EXPECT_EQ(2u, win.lowWatermark());
+
+    win.insert(2);
+    EXPECT_EQ(4u, win.lowWatermark());
+    for (evtid_t i = 0; i < 4; i++) {
+        EXPECT_TRUE(win.contains(i));
+    }
+}
+
+TEST(EventIdWindowTests, WrapsAroundRing)
+{
+    // Go around the ring several times, finishing IDs in pairs with the odd one first
+    EventIdWindow win (64);
+    for (evtid_t i = 0; i < 1000; i += 2) {
+        win.insert(i + 1);
+        EXPECT_FALSE(win.contains(i));
+        EXPECT_TRUE(win.contains(i + 1));
+        win.insert(i);
+        EXPECT_EQ(uint64_t(i + 2), win.lowWatermark());
+    }
+
+    for (evtid_t i = 0; i < 1000; i++) {
+        EXPECT_TRUE(win.contains(i));
+    }
+    EXPECT_FALSE(win.contains(1000));
+    EXPECT_FALSE(win.contains(1063));
+}
+
+TEST(EventIdWindowTests, SlidesForwardOnJump)
+{
+    EventIdWindow win (64);
+    win.insert(5);
+    win.insert(100);  // Beyond the window, so it slides to [37, 100]
+
+    EXPECT_EQ(37u, win.lowWatermark());
+    EXPECT_TRUE(win.contains(0));   // below the watermark, so assumed finished
+    EXPECT_TRUE(win.contains(36));
+    EXPECT_FALSE(win.contains(37));
+    EXPECT_FALSE(win.contains(99));
+    EXPECT_TRUE(win.contains(100));
+
+    // Slots reused from the old part of the window must start out clear
+    for (evtid_t i = 37; i < 100; i++) {
+        EXPECT_FALSE(win.contains(i)) << "id " << i;
+    }
+}
+
+TEST(EventIdWindowTests, SlidesFarForward)
+{
+    EventIdWindow win (64);
+    for (evtid_t i = 0; i < 64; i += 2) win.insert(i + 1);
+
+    win.insert(10000);
+    EXPECT_EQ(10000u - 63, win.lowWatermark());
+    for (evtid_t i = 10000 - 63; i < 10000; i++) {
+        EXPECT_FALSE(win.contains(i));
+    }
+    EXPECT_TRUE(win.contains(10000));
+}
+
+TEST(EventIdWindowTests, HandlesLargestIds)
+{
+    const evtid_t maxId = std::numeric_limits<evtid_t>::max();
+    EventIdWindow win (64);
+    win.insert(maxId);
+    win.insert(maxId - 1);
+
+    EXPECT_TRUE(win.contains(maxId));
+    EXPECT_TRUE(win.contains(maxId - 1));
+    EXPECT_FALSE(win.contains(maxId - 2));
+}
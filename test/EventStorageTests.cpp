@@ -0,0 +1,709 @@
+//
+//  EventStorageTests.cpp
+//  graw-merger
+//
+
+#include "gtest/gtest.h"
+#include "Event.h"
+#include "EventPool.h"
+#include "FakeRawFrame.h"
+
+#include <fstream>
+#include <random>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+class EventStorageTestFixture : public testing::Test
+{
+public:
+    virtual void SetUp();
+    virtual void TearDown();
+
+    //! \brief Makes an empty fake frame for the given AsAd. Add data items to it with AppendDataItem.
+    FakeRawFrame MakeFrame(uint8_t cobo, uint8_t asad);
+
+    //! \brief Parse a fake frame and append it to `evt`.
+    void Append(Event& evt, FakeRawFrame& fake);
+
+protected:
+    boost::filesystem::path lookupPath;
+    std::shared_ptr<PadLookupTable> lookupTable;
+};
+
+void EventStorageTestFixture::SetUp()
+{
+    lookupPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+
+    // Pads are numbered 1000*cobo + 100*asad + 68*aget + channel for CoBo 0-1, and missing elsewhere
+    std::ofstream csv (lookupPath.string());
+    for (int cobo = 0; cobo < 2; cobo++) {
+        for (int asad = 0; asad < 4; asad++) {
+            for (int aget = 0; aget < 4; aget++) {
+                for (int ch = 0; ch < 68; ch++) {
+                    csv << cobo << "," << asad << "," << aget << "," << ch << ","
+                        << 1000*cobo + 100*asad + 68*aget + ch << "\n";
+                }
+            }
+        }
+    }
+    csv.close();
+
+    lookupTable = std::make_shared<PadLookupTable>(lookupPath.string());
+}
+
+void EventStorageTestFixture::TearDown()
+{
+    boost::filesystem::remove(lookupPath);
+}
+
+FakeRawFrame EventStorageTestFixture::MakeFrame(uint8_t cobo, uint8_t asad)
+{
+    FakeRawFrame fake (1234, 5, cobo, asad);
+    fake.ClearDataItems();
+    return fake;
+}
+
+void EventStorageTestFixture::Append(Event& evt, FakeRawFrame& fake)
+{
+    GRAWFrame frame (fake.GenerateRawFrame());
+    evt.AppendFrame(frame);
+}
+
+TEST_F(EventStorageTestFixture, AppendFrameStoresSamples)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    auto fake = MakeFrame(1, 2);
+    fake.AppendDataItem(0, 5, 10, 100);
+    fake.AppendDataItem(0, 5, 11, 101);
+    fake.AppendDataItem(3, 67, 511, 7);
+    Append(evt, fake);
+
+    ASSERT_EQ(2u, evt.numTraces());
+    EXPECT_EQ(5u, evt.eventId);
+
+    auto tr = evt.GetTrace(1, 2, 0, 5);
+    ASSERT_EQ(arma::uword(Constants::num_tbs), tr.n_elem);
+    EXPECT_EQ(100, tr(10));
+    EXPECT_EQ(101, tr(11));
+    EXPECT_EQ(0, tr(12));  // samples that weren't in the frame are zero
+
+    EXPECT_EQ(7, evt.GetTrace(1, 2, 3, 67)(511));
+
+    EXPECT_TRUE(evt.HasTrace(1, 2, 0, 5));
+    EXPECT_FALSE(evt.HasTrace(1, 2, 0, 6));
+    EXPECT_FALSE(evt.HasTrace(1, 3, 0, 5));
+    EXPECT_THROW(evt.GetTrace(1, 2, 0, 6), std::out_of_range);
+}
+
+TEST_F(EventStorageTestFixture, IteratesInAddressOrder)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    // Append the later AsAd first to make sure the order doesn't depend on arrival order
+    auto fake1 = MakeFrame(1, 3);
+    fake1.AppendDataItem(2, 0, 0, 1);
+    Append(evt, fake1);
+
+    auto fake2 = MakeFrame(0, 1);
+    fake2.AppendDataItem(3, 66, 0, 2);
+    fake2.AppendDataItem(0, 64, 0, 3);  // first channel of the second presence word
+    fake2.AppendDataItem(0, 63, 0, 4);
+    Append(evt, fake2);
+
+    std::vector<HardwareAddress> expected {
+        {0, 1, 0, 63, 100 + 63},
+        {0, 1, 0, 64, 100 + 64},
+        {0, 1, 3, 66, 100 + 3*68 + 66},
+        {1, 3, 2, 0, 1000 + 300 + 2*68},
+    };
+
+    std::vector<HardwareAddress> found;
+    for (const auto& trace : evt) {
+        found.push_back(trace.first);
+    }
+
+    ASSERT_EQ(expected.size(), found.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_TRUE(expected[i] == found[i]) << "at position " << i;
+    }
+}
+
+TEST_F(EventStorageTestFixture, MissingPadGetsMissingValue)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    auto fake = MakeFrame(5, 0);  // CoBo 5 is not in the lookup table
+    fake.AppendDataItem(0, 0, 0, 1);
+    Append(evt, fake);
+
+    ASSERT_EQ(1u, evt.numTraces());
+    EXPECT_EQ(lookupTable->missingValue, evt.cbegin()->first.pad);
+}
+
+TEST_F(EventStorageTestFixture, TracesAreViewsOfTheEvent)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    auto fake = MakeFrame(0, 0);
+    fake.AppendDataItem(1, 2, 3, 40);
+    Append(evt, fake);
+
+    evt.GetTrace(0, 0, 1, 2)(3) += 2;
+    EXPECT_EQ(42, evt.GetTrace(0, 0, 1, 2)(3));
+
+    for (auto trace : evt) {
+        trace.second -= 2;
+    }
+    EXPECT_EQ(40, evt.GetTrace(0, 0, 1, 2)(3));
+    EXPECT_EQ(-2, evt.GetTrace(0, 0, 1, 2)(0));
+}
+
+TEST_F(EventStorageTestFixture, RemoveTrace)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    auto fake = MakeFrame(0, 0);
+    fake.AppendDataItem(0, 1, 0, 10);
+    fake.AppendDataItem(0, 2, 0, 20);
+    Append(evt, fake);
+
+    evt.RemoveTrace(0, 0, 0, 1);
+    evt.RemoveTrace(0, 0, 0, 1);  // removing twice is harmless
+    evt.RemoveTrace(9, 3, 3, 67);  // so is removing something that was never there
+
+    ASSERT_EQ(1u, evt.numTraces());
+    EXPECT_FALSE(evt.HasTrace(0, 0, 0, 1));
+    EXPECT_EQ(2, evt.cbegin()->first.channel);
+}
+
+TEST_F(EventStorageTestFixture, CopyIsDeepAndMoveEmptiesSource)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    auto fake = MakeFrame(0, 0);
+    fake.AppendDataItem(0, 1, 0, 10);
+    Append(evt, fake);
+
+    Event copy {evt};
+    copy.GetTrace(0, 0, 0, 1)(0) = 99;
+    EXPECT_EQ(10, evt.GetTrace(0, 0, 0, 1)(0));
+
+    Event moved {std::move(evt)};
+    EXPECT_EQ(1u, moved.numTraces());
+    EXPECT_EQ(10, moved.GetTrace(0, 0, 0, 1)(0));
+    EXPECT_EQ(0u, evt.numTraces());
+    EXPECT_TRUE(evt.cbegin() == evt.cend());
+}
+
+TEST_F(EventStorageTestFixture, SubtractFPN)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    // The FPN channels alternate between 10 and 14, so their mean renormalized to zero alternates between -2 and 2.
+    auto fake = MakeFrame(0, 0);
+    for (uint32_t tb = 0; tb < Constants::num_tbs; tb++) {
+        for (uint32_t ch : {11, 22, 45, 56}) {
+            fake.AppendDataItem(1, ch, tb, tb % 2 == 0 ? 10 : 14);
+        }
+        fake.AppendDataItem(1, 3, tb, 100);
+        fake.AppendDataItem(2, 3, tb, 100);  // no FPN on this AGET, so this is left alone
+    }
+    Append(evt, fake);
+
+    evt.SubtractFPN();
+
+    ASSERT_EQ(2u, evt.numTraces());
+    for (auto ch : {11, 22, 45, 56}) {
+        EXPECT_FALSE(evt.HasTrace(0, 0, 1, ch));
+    }
+
+    auto tr = evt.GetTrace(0, 0, 1, 3);
+    auto untouched = evt.GetTrace(0, 0, 2, 3);
+    for (arma::uword tb = 0; tb < Constants::num_tbs; tb++) {
+        EXPECT_EQ(tb % 2 == 0 ? 102 : 98, tr(tb)) << "at TB " << tb;
+        EXPECT_EQ(100, untouched(tb));
+    }
+}
+
+TEST_F(EventStorageTestFixture, SubtractFPNPinnedValues)
+{
+    // Pins the values SubtractFPN produces. Before the dense store, the subtraction was done on copies of the
+    // traces, so it only removed the FPN channels and left every other sample as it was.
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    // On AGET 0, the mean FPN over TBs 0-3 is {11, 21, 31, 41}, and its mean over the nonzero TBs is 26. The
+    // renormalized FPN is then {-15, -5, 5, 15} in TBs 0-3, and -26 in the TBs the FPN channels don't cover.
+    // On AGET 1, the FPN channels are all zero, so there is nothing to renormalize or subtract.
+    auto fake = MakeFrame(0, 0);
+    const sample_t fpn11[] = {10, 20, 30, 40};
+    const sample_t fpn22[] = {12, 22, 32, 42};
+    for (uint32_t tb = 0; tb < 4; tb++) {
+        fake.AppendDataItem(0, 11, tb, fpn11[tb]);
+        fake.AppendDataItem(0, 22, tb, fpn22[tb]);
+        fake.AppendDataItem(0, 3, tb, 100);
+        fake.AppendDataItem(1, 45, tb, 0);
+        fake.AppendDataItem(1, 3, tb, 100);
+    }
+    Append(evt, fake);
+
+    evt.SubtractFPN();
+
+    ASSERT_EQ(2u, evt.numTraces());
+    EXPECT_FALSE(evt.HasTrace(0, 0, 0, 11));
+    EXPECT_FALSE(evt.HasTrace(0, 0, 0, 22));
+    EXPECT_FALSE(evt.HasTrace(0, 0, 1, 45));
+
+    auto tr = evt.GetTrace(0, 0, 0, 3);
+    const sample_t expected[] = {115, 105, 95, 85};
+    for (arma::uword tb = 0; tb < Constants::num_tbs; tb++) {
+        EXPECT_EQ(tb < 4 ? expected[tb] : 26, tr(tb)) << "at TB " << tb;
+    }
+
+    auto noFpn = evt.GetTrace(0, 0, 1, 3);
+    for (arma::uword tb = 0; tb < Constants::num_tbs; tb++) {
+        EXPECT_EQ(tb < 4 ? 100 : 0, noFpn(tb)) << "at TB " << tb;
+    }
+}
+
+TEST_F(EventStorageTestFixture, SubtractPedestals)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    auto fake = MakeFrame(1, 2);
+    for (uint32_t tb = 0; tb < Constants::num_tbs; tb++) {
+        fake.AppendDataItem(0, 5, tb, tb);
+        fake.AppendDataItem(3, 67, tb, 200);
+        fake.AppendDataItem(3, 66, tb, 200);  // no pedestal for this channel
+    }
+    Append(evt, fake);
+
+    auto pedsPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+    {
+        std::ofstream csv (pedsPath.string());
+        csv << "1,2,0,5,10\n" << "1,2,3,67,-30\n" << "0,2,3,66,50\n";
+    }
+    LookupTable<sample_t> peds (pedsPath.string());
+    boost::filesystem::remove(pedsPath);
+
+    evt.SubtractPedestals(peds);
+
+    auto first = evt.GetTrace(1, 2, 0, 5);
+    auto second = evt.GetTrace(1, 2, 3, 67);
+    auto third = evt.GetTrace(1, 2, 3, 66);
+    for (arma::uword tb = 0; tb < Constants::num_tbs; tb++) {
+        EXPECT_EQ(static_cast<sample_t>(tb) - 10, first(tb)) << "at TB " << tb;
+        EXPECT_EQ(230, second(tb));
+        EXPECT_EQ(200, third(tb));
+    }
+}
+
+TEST_F(EventStorageTestFixture, ApplyThreshold)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    auto fake = MakeFrame(0, 1);
+    for (uint32_t tb = 0; tb < Constants::num_tbs; tb++) {
+        fake.AppendDataItem(2, 7, tb, tb * 4);
+        fake.AppendDataItem(2, 8, tb, 10);
+    }
+    Append(evt, fake);
+
+    evt.ApplyThreshold(500);
+
+    ASSERT_EQ(2u, evt.numTraces());
+    auto ramp = evt.GetTrace(0, 1, 2, 7);
+    auto low = evt.GetTrace(0, 1, 2, 8);
+    for (arma::uword tb = 0; tb < Constants::num_tbs; tb++) {
+        const sample_t val = static_cast<sample_t>(tb * 4);
+        EXPECT_EQ(val < 500 ? 0 : val, ramp(tb)) << "at TB " << tb;
+        EXPECT_EQ(0, low(tb));
+    }
+}
+
+TEST_F(EventStorageTestFixture, ClearedEventStartsEmpty)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    auto fake1 = MakeFrame(0, 1);
+    fake1.AppendDataItem(0, 5, 10, 100);
+    Append(evt, fake1);
+    ASSERT_EQ(1u, evt.numTraces());
+
+    evt.Clear();
+    EXPECT_EQ(0u, evt.numTraces());
+    EXPECT_EQ(0u, evt.eventId);
+    EXPECT_FALSE(evt.HasTrace(0, 1, 0, 5));
+    EXPECT_TRUE(evt.begin() == evt.end());
+
+    // Samples left over from before the clear must not show up in a new trace at the same address
+    auto fake2 = MakeFrame(0, 1);
+    fake2.AppendDataItem(0, 5, 11, 7);
+    Append(evt, fake2);
+
+    ASSERT_EQ(1u, evt.numTraces());
+    auto tr = evt.GetTrace(0, 1, 0, 5);
+    EXPECT_EQ(0, tr(10));
+    EXPECT_EQ(7, tr(11));
+}
+
+TEST_F(EventStorageTestFixture, PoolReusesReleasedEvents)
+{
+    EventPool pool (2);
+
+    Event evt = pool.acquire();
+    evt.SetLookupTable(lookupTable);
+    auto fake = MakeFrame(1, 2);
+    fake.AppendDataItem(0, 5, 10, 100);
+    Append(evt, fake);
+
+    pool.release(std::move(evt));
+
+    Event reused = pool.acquire();
+    EXPECT_EQ(0u, reused.numTraces());
+    EXPECT_EQ(1u, pool.numCreated());
+    EXPECT_EQ(1u, pool.numReused());
+
+    // The pool is empty again, so this one is new
+    Event fresh = pool.acquire();
+    EXPECT_EQ(2u, pool.numCreated());
+}
+
+TEST_F(EventStorageTestFixture, FullReadoutFillsEveryTrace)
+{
+    // Interleave the AGETs, as the hardware does
+    auto fake = MakeFrame(1, 3);
+    fake.frameType = GRAWFrame::Expected_frameTypeFullReadout;
+    fake.itemSize = GRAWFrame::Expected_itemSizeFullReadout;
+    for (uint32_t tb = 0; tb < 512; tb++) {
+        for (uint32_t ch = 0; ch < 68; ch++) {
+            for (uint32_t aget = 0; aget < 4; aget++) {
+                fake.dataItems.push_back((aget << 14) | ((7*tb + 3*ch + aget) & 0xFFF));
+            }
+        }
+    }
+    fake.UpdateSizes();
+
+    GRAWFrame frame (fake.GenerateRawFrame());
+    ASSERT_TRUE(frame.IsFullReadout());
+    EXPECT_EQ(GRAWFrame::fullReadoutBlockSize, frame.numItems());
+    EXPECT_EQ(0u, frame.GetItems().numInvalid());
+
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+    evt.AppendFrame(frame);
+
+    ASSERT_EQ(4u*68u, evt.numTraces());
+    for (addr_t aget = 0; aget < 4; aget++) {
+        for (addr_t ch = 0; ch < 68; ch += 13) {
+            auto tr = evt.GetTrace(1, 3, aget, ch);
+            for (tb_t tb = 0; tb < 512; tb += 37) {
+                EXPECT_EQ((7*tb + 3*ch + aget) & 0xFFF, tr(tb));
+            }
+        }
+    }
+
+    // The frame's iterator presents the same samples as items
+    size_t nItems = 0;
+    for (auto iter = frame.cbegin(); iter != frame.cend(); ++iter, ++nItems) {
+        GRAWDataItem item = *iter;
+        ASSERT_EQ((7*item.timeBucketId + 3*item.channel + item.agetId) & 0xFFF, item.sample);
+    }
+    EXPECT_EQ(GRAWFrame::fullReadoutBlockSize, nItems);
+}
+
+static void ExpectSameEvents(const Event& expected, const Event& actual)
+{
+    EXPECT_EQ(expected.eventId, actual.eventId);
+    EXPECT_EQ(expected.eventTime, actual.eventTime);
+    ASSERT_EQ(expected.numTraces(), actual.numTraces());
+
+    auto actualIter = actual.cbegin();
+    for (const auto& trace : expected) {
+        ASSERT_TRUE(actualIter != actual.cend());
+        const auto actualTrace = *actualIter;  // holds a view of the samples
+        EXPECT_TRUE(trace.first == actualTrace.first);
+        const arma::Col<sample_t>& actualSamples = actualTrace.second;
+        ASSERT_EQ(trace.second.n_elem, actualSamples.n_elem);
+        for (arma::uword i = 0; i < trace.second.n_elem; i++) {
+            ASSERT_EQ(trace.second(i), actualSamples(i)) << "at TB " << i;
+        }
+        ++actualIter;
+    }
+}
+
+TEST_F(EventStorageTestFixture, RawFrameMatchesParsedFrame)
+{
+    auto fake1 = MakeFrame(0, 2);
+    fake1.AppendDataItem(0, 5, 10, 100);
+    fake1.AppendDataItem(3, 67, 511, 7);
+    fake1.AppendFPN();
+    fake1.dataItems.push_back((1u << 30) | (100u << 23) | (4u << 14) | 9u);  // invalid channel
+    fake1.UpdateSizes();
+
+    auto fake2 = MakeFrame(1, 0);
+    fake2.frameType = GRAWFrame::Expected_frameTypeFullReadout;
+    fake2.itemSize = GRAWFrame::Expected_itemSizeFullReadout;
+    for (uint32_t i = 0; i < 4*68*300; i++) {  // shorter than a full block
+        fake2.dataItems.push_back(((i % 4) << 14) | (i & 0xFFF));
+    }
+    fake2.UpdateSizes();
+
+    Event parsed;
+    parsed.SetLookupTable(lookupTable);
+    Event fused;
+    fused.SetLookupTable(lookupTable);
+
+    for (FakeRawFrame* fake : {&fake1, &fake2}) {
+        RawFrame raw = fake->GenerateRawFrame();
+        parsed.AppendFrame(GRAWFrame(raw));
+        fused.AppendRawFrame(raw);
+    }
+
+    ExpectSameEvents(parsed, fused);
+}
+
+TEST_F(EventStorageTestFixture, ReusedScratchMatchesParsedFrames)
+{
+    // A big frame with an invalid item, then a full-readout frame, then a smaller frame, all through one buffer
+    auto big = MakeFrame(0, 1);
+    for (uint32_t tb = 0; tb < 512; tb++) {
+        big.AppendDataItem(1, 20, tb, 50);
+        big.AppendDataItem(2, 40, tb, 60);
+    }
+    big.dataItems.push_back((0u << 30) | (3u << 23) | (600u << 14) | 9u);  // invalid time bucket
+    big.UpdateSizes();
+
+    auto full = MakeFrame(1, 0);
+    full.frameType = GRAWFrame::Expected_frameTypeFullReadout;
+    full.itemSize = GRAWFrame::Expected_itemSizeFullReadout;
+    for (uint32_t i = 0; i < 4*68*10; i++) {
+        full.dataItems.push_back(((i % 4) << 14) | (i & 0xFFF));
+    }
+    full.UpdateSizes();
+
+    auto small = MakeFrame(0, 3);
+    small.AppendDataItem(3, 1, 7, 70);
+
+    Event parsed;
+    parsed.SetLookupTable(lookupTable);
+    Event fused;
+    fused.SetLookupTable(lookupTable);
+    DecodedItems scratch;
+
+    for (FakeRawFrame* fake : {&big, &full, &small}) {
+        RawFrame raw = fake->GenerateRawFrame();
+        parsed.AppendFrame(GRAWFrame(raw));
+        fused.AppendRawFrame(GRAWFrameView(raw), scratch);
+    }
+
+    EXPECT_EQ(1u, scratch.size());
+    EXPECT_EQ(0u, scratch.numInvalid());
+    ExpectSameEvents(parsed, fused);
+}
+
+TEST_F(EventStorageTestFixture, MatchingHitPatternsReportNoMismatch)
+{
+    FakeRawFrame fake = MakeFrame(1, 2);
+    for (uint32_t tb = 0; tb < 512; tb++) {
+        fake.AppendDataItem(0, 5, tb, 100);
+        fake.AppendDataItem(3, 67, tb, 200);
+    }
+    RawFrame raw = fake.GenerateRawFrame();
+
+    Event parsed;
+    parsed.SetLookupTable(lookupTable);
+    GRAWFrame frame (raw);
+    EXPECT_FALSE(frame.hitPatternMismatch.any());
+    EXPECT_FALSE(parsed.AppendFrame(frame).any());
+
+    Event fused;
+    fused.SetLookupTable(lookupTable);
+    EXPECT_FALSE(fused.AppendRawFrame(raw).any());
+
+    // The pads were looked up from the hit patterns
+    EXPECT_EQ(2u, fused.numTraces());
+    std::vector<pad_t> pads;
+    for (const auto& trace : fused) pads.push_back(trace.first.pad);
+    EXPECT_EQ((std::vector<pad_t> {1205, 1200 + 68*3 + 67}), pads);
+    ExpectSameEvents(parsed, fused);
+}
+
+TEST_F(EventStorageTestFixture, HitPatternMismatchesAreCounted)
+{
+    FakeRawFrame fake = MakeFrame(1, 2);
+    for (uint32_t tb = 0; tb < 512; tb++) {
+        fake.AppendDataItem(0, 5, tb, 100);
+        fake.AppendDataItem(2, 30, tb, 300);
+    }
+    fake.hitPatterns.at(2).reset(67 - 30);  // has data, but isn't marked
+    fake.hitPatterns.at(1).set(67 - 7);     // is marked, but has no data
+    fake.hitPatterns.at(3).set(67 - 0);
+    RawFrame raw = fake.GenerateRawFrame();
+
+    GRAWFrame frame (raw);
+    EXPECT_EQ(2u, frame.hitPatternMismatch.nMissing);
+    EXPECT_EQ(1u, frame.hitPatternMismatch.nUnexpected);
+
+    Event parsed;
+    parsed.SetLookupTable(lookupTable);
+    Event fused;
+    fused.SetLookupTable(lookupTable);
+    for (const HitPatternMismatch& mismatch : {parsed.AppendFrame(frame), fused.AppendRawFrame(raw)}) {
+        EXPECT_EQ(2u, mismatch.nMissing);
+        EXPECT_EQ(1u, mismatch.nUnexpected);
+    }
+
+    // The event holds the channels with data, whatever the hit patterns say
+    for (Event* evt : {&parsed, &fused}) {
+        EXPECT_EQ(2u, evt->numTraces());
+        EXPECT_TRUE(evt->HasTrace(1, 2, 0, 5));
+        EXPECT_TRUE(evt->HasTrace(1, 2, 2, 30));
+        EXPECT_FALSE(evt->HasTrace(1, 2, 1, 7));
+        EXPECT_FALSE(evt->HasTrace(1, 2, 3, 0));
+        EXPECT_EQ(300, evt->GetTrace(1, 2, 2, 30)(511));
+    }
+    ExpectSameEvents(parsed, fused);
+}
+
+TEST_F(EventStorageTestFixture, MissingHitChannelKeepsEarlierTrace)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    FakeRawFrame first = MakeFrame(0, 1);
+    first.AppendDataItem(1, 7, 10, 42);
+    evt.AppendRawFrame(first.GenerateRawFrame());
+
+    // A second frame from the same AsAd whose hit pattern marks the channel without sending data for it
+    FakeRawFrame second = MakeFrame(0, 1);
+    second.AppendDataItem(0, 3, 0, 1);
+    second.hitPatterns.at(1).set(67 - 7);
+    auto mismatch = evt.AppendRawFrame(second.GenerateRawFrame());
+
+    EXPECT_EQ(1u, mismatch.nMissing);
+    EXPECT_EQ(0u, mismatch.nUnexpected);
+    EXPECT_EQ(2u, evt.numTraces());
+    ASSERT_TRUE(evt.HasTrace(0, 1, 1, 7));
+    EXPECT_EQ(42, evt.GetTrace(0, 1, 1, 7)(10));
+}
+
+TEST_F(EventStorageTestFixture, RawFrameRejectsShortFrame)
+{
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+
+    RawFrame raw (10);
+    EXPECT_THROW(evt.AppendRawFrame(raw), Exceptions::Bad_Data);
+}
+
+//! \brief The FPN subtraction as it was before it was vectorized, built on the public interface of Event.
+static void ReferenceSubtractFPN(Event& evt)
+{
+    std::vector<addr_t> fpn_channels {11,22,45,56};
+
+    for (addr_t cobo = 0; cobo < Constants::num_cobos; cobo++) {
+        for (addr_t asad = 0; asad < Constants::num_asads; asad++) {
+            for (addr_t aget = 0; aget < Constants::num_agets; aget++) {
+                arma::Col<sample_t> mean_fpn (Constants::num_tbs, arma::fill::zeros);
+                arma::Col<int> tb_multip (Constants::num_tbs, arma::fill::zeros);
+                int num_fpns = 0;
+
+                for (auto ch : fpn_channels) {
+                    if (!evt.HasTrace(cobo, asad, aget, ch)) continue;
+                    arma::Col<sample_t> tr = evt.GetTrace(cobo, asad, aget, ch);
+                    mean_fpn += tr;
+                    for (arma::uword i = 0; i < mean_fpn.n_elem; i++) {
+                        if (tr(i) != 0) tb_multip(i) += 1;
+                    }
+                    num_fpns++;
+                }
+
+                if (num_fpns == 0) continue;
+
+                for (arma::uword i = 0; i < mean_fpn.n_elem; i++) {
+                    if (tb_multip(i) != 0) mean_fpn(i) /= tb_multip(i);
+                }
+
+                int64_t total = 0;
+                int64_t nzCount = 0;
+                for (arma::uword i = 0; i < mean_fpn.n_elem; i++) {
+                    if (mean_fpn(i) != 0) {
+                        total += mean_fpn(i);
+                        nzCount++;
+                    }
+                }
+                if (nzCount != 0) mean_fpn -= static_cast<sample_t>(total / nzCount);
+
+                for (addr_t ch = 0; ch < Constants::num_channels; ch++) {
+                    if (!evt.HasTrace(cobo, asad, aget, ch)) continue;
+                    arma::Col<sample_t> tr = evt.GetTrace(cobo, asad, aget, ch);
+                    tr -= mean_fpn;
+                }
+
+                for (auto ch : fpn_channels) {
+                    evt.RemoveTrace(cobo, asad, aget, ch);
+                }
+            }
+        }
+    }
+}
+
+TEST_F(EventStorageTestFixture, SubtractFPNMatchesReference)
+{
+    std::mt19937 rng (2718);
+    std::uniform_int_distribution<uint32_t> sampleDist (0, 4095);
+    std::bernoulli_distribution coin (0.5);
+    std::bernoulli_distribution rarely (0.1);
+
+    for (int trial = 0; trial < 20; trial++) {
+        SCOPED_TRACE("trial " + std::to_string(trial));
+
+        // Each AGET gets a random subset of the FPN channels and some other channels. Each trace covers a random
+        // range of time buckets, and some samples are zero, so the multiplicity of the mean varies by TB.
+        auto partial = MakeFrame(0, trial % 4);
+        for (uint32_t aget = 0; aget < 4; aget++) {
+            for (uint32_t ch = 0; ch < 68; ch++) {
+                const bool isFpn = (ch == 11 || ch == 22 || ch == 45 || ch == 56);
+                if (isFpn ? !coin(rng) : !rarely(rng)) continue;
+
+                const uint32_t firstTB = coin(rng) ? 0 : sampleDist(rng) % 256;
+                const uint32_t lastTB = coin(rng) ? 512 : 256 + sampleDist(rng) % 256;
+                for (uint32_t tb = firstTB; tb < lastTB; tb++) {
+                    partial.AppendDataItem(aget, ch, tb, rarely(rng) ? 0 : sampleDist(rng));
+                }
+            }
+        }
+
+        auto full = MakeFrame(1, trial % 4);
+        full.frameType = GRAWFrame::Expected_frameTypeFullReadout;
+        full.itemSize = GRAWFrame::Expected_itemSizeFullReadout;
+        for (uint32_t i = 0; i < 4*68*512; i++) {
+            full.dataItems.push_back(((i % 4) << 14) | (rarely(rng) ? 0 : sampleDist(rng)));
+        }
+        full.UpdateSizes();
+
+        Event expected;
+        expected.SetLookupTable(lookupTable);
+        for (FakeRawFrame* fake : {&partial, &full}) {
+            expected.AppendRawFrame(fake->GenerateRawFrame());
+        }
+        Event actual {expected};
+
+        ReferenceSubtractFPN(expected);
+        actual.SubtractFPN();
+
+        ExpectSameEvents(expected, actual);
+    }
+}
@@ -7,19 +7,21 @@
 //
 
 #include <cmath>
+#include <algorithm>
 
 #include "FakeRawFrame.h"
 
 FakeRawFrame::FakeRawFrame(uint64_t eventTime_in, uint32_t eventId_in,
                            uint8_t cobo, uint8_t asad)
-: eventTime(eventTime_in),eventId(eventId_in),coboId(cobo),asadId(asad)
+: eventTime(eventTime_in),eventId(eventId_in),coboId(cobo),asadId(asad),
+  hitPatterns(4),multiplicities(4)
 {
     AppendFPN();
     UpdateSizes();
 }
 
 FakeRawFrame::FakeRawFrame()
-: eventTime(0),eventId(0),coboId(0),asadId(0)
+: eventTime(0),eventId(0),coboId(0),asadId(0),hitPatterns(4),multiplicities(4)
 {
     AppendFPN();
     UpdateSizes();
@@ -38,12 +40,27 @@ void FakeRawFrame::AppendDataItem(uint32_t aget, uint32_t ch,
     item |= (aget << 30);
     
     dataItems.push_back(item);
+
+    // The hit pattern is in the reverse order of the bitset's accessor
+    if (!hitPatterns.at(aget).test(67-ch)) {
+        hitPatterns.at(aget).set(67-ch);
+        multiplicities.at(aget)++;
+    }
+
+    UpdateSizes();
+}
+
+void FakeRawFrame::ClearDataItems()
+{
+    dataItems.clear();
+    hitPatterns.assign(4, 0);
+    multiplicities.assign(4, 0);
     UpdateSizes();
 }
 
 void FakeRawFrame::AppendFPN()
 {
-    std::vector<uint8_t> fpn_chans {12,23,46,57};
+    std::vector<uint8_t> fpn_chans {11,22,45,56};
     
     for (uint8_t aget = 0; aget < 4; aget++) {
         for (auto ch : fpn_chans) {
@@ -58,7 +75,7 @@ template<typename T>
 void FakeRawFrame::AppendBytes(std::vector<uint8_t>& vec, T val, int nBytes)
 {
     for (int i = nBytes-1; i >= 0; i--) {
-        vec.push_back((val & (0xFF << i*8)) >> i*8);
+        vec.push_back(static_cast<uint8_t>((val >> (i*8)) & 0xFF));
     }
 }
 
@@ -81,7 +98,10 @@ std::vector<uint8_t> FakeRawFrame::GenerateRawFrameVector()
     res.push_back(status);
     
     for (auto item : hitPatterns) {
-        AppendBytes(res, item.to_ullong(), 9);
+        // 72 bits is too wide for to_ullong, so write it a byte at a time
+        for (int byte = 8; byte >= 0; byte--) {
+            res.push_back(static_cast<uint8_t>(((item >> (byte*8)) & std::bitset<72>(0xFF)).to_ulong()));
+        }
     }
     
     for (auto item : multiplicities) {
@@ -90,22 +110,34 @@ std::vector<uint8_t> FakeRawFrame::GenerateRawFrameVector()
     
     // Pad it out
     
-    while (res.size() < headerSize * 64) {
+    while (res.size() < headerSize * 256u) {
         res.push_back(0x00);
     }
     
     for (auto item : dataItems) {
-        AppendBytes(res, item, 4);
+        AppendBytes(res, item, itemSize);
+    }
+
+    while (res.size() < frameSize * 256u) {
+        res.push_back(0x00);
     }
     
     return res;
 }
 
+RawFrame FakeRawFrame::GenerateRawFrame()
+{
+    std::vector<uint8_t> bytes = GenerateRawFrameVector();
+    RawFrame raw (bytes.size());
+    std::copy(bytes.begin(), bytes.end(), raw.getWritablePointer());
+    return raw;
+}
+
 void FakeRawFrame::UpdateSizes()
 {
     nItems = static_cast<uint32_t> (dataItems.size());
     
-    // frame size is in units of 64 Bytes
-    uint32_t rawSize = (headerSize * 64) + itemSize * nItems;
-    frameSize = ceil(rawSize / 64);
+    // frame size is in units of 256 Bytes
+    uint32_t rawSize = (headerSize * 256) + itemSize * nItems;
+    frameSize = (rawSize + 255) / 256;
 }
\ No newline at end of file
@@ -11,16 +11,19 @@
 
 #include <vector>
 #include <bitset>
+#include <cstdint>
+
+#include "RawFrame.h"
 
 class FakeRawFrame
 {
 public:
-    uint8_t metatype {0x06};
-    uint32_t frameSize {}; // actually 3 bytes
+    uint8_t metatype {0x08};
+    uint32_t frameSize {}; // actually 3 bytes, in units of 256 bytes
     uint8_t dataSource {0x0};
     uint16_t frameType {0x1};
     uint8_t revision {0x4};
-    uint16_t headerSize {0x4};
+    uint16_t headerSize {0x1};  // in units of 256 bytes
     uint16_t itemSize {0x4};
     uint32_t nItems {};
     uint64_t eventTime {}; // actually 6 bytes
@@ -32,7 +35,7 @@ public:
     std::vector<std::bitset<9*8>> hitPatterns;
     std::vector<uint16_t> multiplicities;
     
-    std::vector<uint32_t> dataItems;
+    std::vector<uint32_t> dataItems;  // written using itemSize bytes each, so 2 for full readout
     
     FakeRawFrame(uint64_t eventTime_in, uint32_t eventId_in,
                  uint8_t cobo, uint8_t asad);
@@ -40,8 +43,12 @@ public:
     
     void AppendDataItem(uint32_t aget, uint32_t ch, uint32_t tb, uint32_t sample);
     void AppendFPN();
+    void ClearDataItems();
     
     std::vector<uint8_t> GenerateRawFrameVector();
+
+    //! Generates the frame and copies it into a RawFrame, ready to be parsed
+    RawFrame GenerateRawFrame();
     
     template<typename T>
     void AppendBytes(std::vector<uint8_t>& vec, T val, int nBytes);
@@ -0,0 +1,162 @@
+//
+//  FileIndexTests.cpp
+//  graw-merger
+//
+
+#include "gtest/gtest.h"
+#include "FileIndex.h"
+#include "GRAWFile.h"
+#include "MappedGRAWFile.h"
+
+#include <fstream>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+class FileIndexTestFixture : public testing::Test
+{
+public:
+    virtual void SetUp();
+    virtual void TearDown();
+
+    // Writes a header-only frame (one size unit long) with the given properties
+    void WriteFrame(std::ofstream& file, uint32_t evtId, uint64_t evtTime, uint8_t cobo, uint8_t asad);
+
+    void WriteFile(const std::vector<uint32_t>& evtIds) { WriteFile(grawPath, evtIds); }
+    void WriteFile(const boost::filesystem::path& path, const std::vector<uint32_t>& evtIds);
+
+protected:
+    boost::filesystem::path tempDir;
+    boost::filesystem::path grawPath;
+};
+
+void FileIndexTestFixture::SetUp()
+{
+    tempDir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(tempDir);
+    grawPath = tempDir / "CoBo_AsAd1_0000.graw";
+}
+
+void FileIndexTestFixture::TearDown()
+{
+    boost::filesystem::remove_all(tempDir);
+}
+
+void FileIndexTestFixture::WriteFrame(std::ofstream& file, uint32_t evtId, uint64_t evtTime, uint8_t cobo, uint8_t asad)
+{
+    std::vector<uint8_t> frame (GRAWFrame::sizeUnit, 0);
+    frame[0] = GRAWFrame::Expected_metaType;
+    frame[3] = 1;  // frameSize
+    for (int i = 0; i < 6; i++) frame[16 + i] = static_cast<uint8_t>(evtTime >> (8*(5-i)));
+    for (int i = 0; i < 4; i++) frame[22 + i] = static_cast<uint8_t>(evtId >> (8*(3-i)));
+    frame[26] = cobo;
+    frame[27] = asad;
+    file.write(reinterpret_cast<const char*>(frame.data()), static_cast<std::streamsize>(frame.size()));
+}
+
+void FileIndexTestFixture::WriteFile(const boost::filesystem::path& path, const std::vector<uint32_t>& evtIds)
+{
+    std::ofstream file (path.string(), std::ios::out|std::ios::trunc|std::ios::binary);
+    for (auto id : evtIds) {
+        WriteFrame(file, id, 1000*id + 5, 3, 1);
+    }
+}
+
+TEST_F(FileIndexTestFixture, IndexesEveryFrame)
+{
+    WriteFile({0, 1, 2, 4, 3});
+
+    auto file = std::make_shared<GRAWFile>(grawPath, std::ios::in);
+    FileIndex index ({file});
+
+    ASSERT_EQ(5u, index.numFrames());
+    ASSERT_EQ((std::vector<evtid_t> {0, 1, 2, 3, 4}), index.getEventIds());
+
+    auto locs = index.findFramesForEvtId(3);
+    ASSERT_EQ(1u, locs.size());
+    EXPECT_EQ(4*GRAWFrame::sizeUnit, locs[0].meta.filePos);
+    EXPECT_EQ(uint32_t(GRAWFrame::sizeUnit), locs[0].meta.size);
+    EXPECT_EQ(3005u, locs[0].meta.evtTime);
+    EXPECT_EQ(3, locs[0].meta.cobo);
+    EXPECT_EQ(1, locs[0].meta.asad);
+
+    EXPECT_TRUE(index.findFramesForEvtId(7).empty());
+}
+
+TEST_F(FileIndexTestFixture, SidecarRoundTrip)
+{
+    WriteFile({10, 11, 12});
+
+    auto file = std::make_shared<MappedGRAWFile>(grawPath);
+    FileIndex index ({file});
+
+    ASSERT_TRUE(boost::filesystem::exists(FileIndex::SidecarPath(grawPath)));
+
+    FileIndex::FrameList frames;
+    ASSERT_TRUE(FileIndex::ReadSidecar(grawPath, frames));
+    ASSERT_EQ(3u, frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        EXPECT_EQ(evtid_t(10 + i), frames[i].evtId);
+        EXPECT_EQ(std::streamoff(i * GRAWFrame::sizeUnit), frames[i].filePos);
+        EXPECT_EQ(ts_t(1000*(10 + i) + 5), frames[i].evtTime);
+    }
+}
+
+TEST_F(FileIndexTestFixture, SidecarRejectedWhenFileChanges)
+{
+    WriteFile({0, 1});
+    FileIndex index ({std::make_shared<GRAWFile>(grawPath, std::ios::in)});
+
+    FileIndex::FrameList frames;
+    ASSERT_TRUE(FileIndex::ReadSidecar(grawPath, frames));
+
+    WriteFile({0, 1, 2});
+    EXPECT_FALSE(FileIndex::ReadSidecar(grawPath, frames));
+}
+
+TEST_F(FileIndexTestFixture, SidecarRejectedWhenFramesPassEndOfFile)
+{
+    WriteFile({0, 1});
+    FileIndex index ({std::make_shared<GRAWFile>(grawPath, std::ios::in)});
+
+    FileIndex::FrameList frames;
+    ASSERT_TRUE(FileIndex::ReadSidecar(grawPath, frames));
+
+    // The last frame now runs one unit past the end of the file
+    frames.back().size += GRAWFrame::sizeUnit;
+    FileIndex::WriteSidecar(grawPath, frames);
+    EXPECT_FALSE(FileIndex::ReadSidecar(grawPath, frames));
+    EXPECT_TRUE(frames.empty());
+
+    // Indexing the file again replaces the bad sidecar
+    FileIndex rebuilt ({std::make_shared<MappedGRAWFile>(grawPath)});
+    EXPECT_TRUE(FileIndex::ReadSidecar(grawPath, frames));
+    EXPECT_EQ(2u, frames.size());
+}
+
+TEST_F(FileIndexTestFixture, ParallelIndexMatchesSerial)
+{
+    std::vector<std::shared_ptr<GRAWFile>> files;
+    for (uint32_t i = 0; i < 7; i++) {
+        auto path = tempDir / ("file" + std::to_string(i) + ".graw");
+        WriteFile(path, {i, i + 1, i + 2});
+        files.push_back(std::make_shared<GRAWFile>(path, std::ios::in));
+    }
+
+    FileIndex serial (files, 1);
+    for (const auto& file : files) {
+        boost::filesystem::remove(FileIndex::SidecarPath(file->GetPath()));
+    }
+    FileIndex parallel (files, 3);
+
+    ASSERT_EQ(serial.numFrames(), parallel.numFrames());
+    ASSERT_EQ(serial.getEventIds(), parallel.getEventIds());
+    for (auto evtid : serial.getEventIds()) {
+        auto a = serial.findFramesForEvtId(evtid);
+        auto b = parallel.findFramesForEvtId(evtid);
+        ASSERT_EQ(a.size(), b.size());
+        for (size_t i = 0; i < a.size(); i++) {
+            EXPECT_EQ(a[i].file, b[i].file);
+            EXPECT_EQ(a[i].meta.filePos, b[i].meta.filePos);
+        }
+    }
+}
@@ -28,7 +28,7 @@ protected:
     uint8_t  GetCoboId(GRAWFrame& fr) {return fr.coboId;};
     uint8_t  GetAsadId(GRAWFrame& fr) {return fr.asadId;};
     
-    unsigned long GetSizeOfDataVec(GRAWFrame& fr) {return fr.data.size();};
+    unsigned long GetNumDecodedItems(GRAWFrame& fr) {return fr.GetItems().size();};
     
 public:
     
@@ -96,9 +96,7 @@ TEST(GRAWFrameTests,DISABLED_DataExtractionCombined)
 
 void GRAWFrameTestFixture::TestConstructor(FakeRawFrame& fr, uint8_t cobo, uint8_t asad)
 {
-    auto fakeData = fr.GenerateRawFrameVector();
-    
-    GRAWFrame frame {fakeData};
+    GRAWFrame frame {fr.GenerateRawFrame()};
     EXPECT_EQ(fr.metatype,GetMetaType(frame));
     EXPECT_EQ(fr.frameSize,GRAWFrameSize(frame));
     EXPECT_EQ(fr.headerSize,GetHeaderSize(frame));
@@ -106,9 +104,9 @@ void GRAWFrameTestFixture::TestConstructor(FakeRawFrame& fr, uint8_t cobo, uint8
     EXPECT_EQ(fr.nItems, GetNItems(frame));
     EXPECT_EQ(fr.eventTime, GetEventTime(frame));
     EXPECT_EQ(fr.eventId, GetEventId(frame));
-    EXPECT_EQ(fr.coboId, GetCoboId(frame));
-    EXPECT_EQ(fr.asadId, GetAsadId(frame));
-    EXPECT_EQ(fr.nItems, GetSizeOfDataVec(frame));
+    EXPECT_EQ(cobo, GetCoboId(frame));
+    EXPECT_EQ(asad, GetAsadId(frame));
+    EXPECT_EQ(fr.nItems, GetNumDecodedItems(frame));
 }
 
 TEST_F(GRAWFrameTestFixture, Constructor)
@@ -117,11 +115,42 @@ TEST_F(GRAWFrameTestFixture, Constructor)
     TestConstructor(fr, 3, 2);
 }
 
+TEST_F(GRAWFrameTestFixture, DecodedItems)
+{
+    FakeRawFrame fr {1234567890, 12, 3, 2};
+    fr.ClearDataItems();
+    fr.AppendDataItem(0, 5, 10, 100);
+    fr.AppendDataItem(3, 67, 511, 4095);
+    fr.AppendDataItem(1, 0, 0, 0);
+
+    GRAWFrame frame {fr.GenerateRawFrame()};
+    ASSERT_FALSE(frame.IsFullReadout());
+
+    const DecodedItems& items = frame.GetItems();
+    ASSERT_EQ(3u, items.size());
+    EXPECT_EQ(std::vector<addr_t>({0, 3, 1}), items.aget);
+    EXPECT_EQ(std::vector<addr_t>({5, 67, 0}), items.channel);
+    EXPECT_EQ(std::vector<tb_t>({10, 511, 0}), items.tb);
+    EXPECT_EQ(std::vector<sample_t>({100, 4095, 0}), items.sample);
+
+    // Iteration presents the same items as GRAWDataItems
+    size_t i = 0;
+    for (const GRAWDataItem item : frame) {
+        ASSERT_LT(i, items.size());
+        EXPECT_EQ(items.aget[i], item.agetId);
+        EXPECT_EQ(items.channel[i], item.channel);
+        EXPECT_EQ(items.tb[i], item.timeBucketId);
+        EXPECT_EQ(items.sample[i], item.sample);
+        i++;
+    }
+    EXPECT_EQ(items.size(), i);
+}
+
 TEST_F(GRAWFrameTestFixture, Constructor_BadCobo)
 {
     FakeRawFrame fakeData {1234567890, 12, 0, 2};
     
-    GRAWFrame frame {fakeData.GenerateRawFrameVector()};
+    GRAWFrame frame {fakeData.GenerateRawFrame()};
     ASSERT_EQ(GetCoboId(frame), 3);
 }
 
@@ -129,7 +158,7 @@ TEST_F(GRAWFrameTestFixture, Constructor_BadAsad)
 {
     FakeRawFrame fakeData {1234567890, 12, 3, 0};
     
-    GRAWFrame frame {fakeData.GenerateRawFrameVector()};
+    GRAWFrame frame {fakeData.GenerateRawFrame()};
     ASSERT_EQ(GetAsadId(frame), 2);
 }
 
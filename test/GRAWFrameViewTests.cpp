@@ -0,0 +1,123 @@
+//
+//  GRAWFrameViewTests.cpp
+//  graw-merger
+//
+
+#include "gtest/gtest.h"
+#include "GRAWFrameView.h"
+#include "GRAWFrame.h"
+#include "FakeRawFrame.h"
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+using ItemTuple = std::tuple<int, int, int, int>;
+
+static std::vector<ItemTuple> SortedItems(const GRAWFrame& frame)
+{
+    std::vector<ItemTuple> items;
+    for (auto iter = frame.cbegin(); iter != frame.cend(); ++iter) {
+        GRAWDataItem item = *iter;
+        items.emplace_back(item.agetId, item.channel, item.timeBucketId, item.sample);
+    }
+    std::sort(items.begin(), items.end());
+    return items;
+}
+
+static std::vector<ItemTuple> SortedItems(const GRAWFrameView& view)
+{
+    std::vector<ItemTuple> items;
+    for (auto iter = view.begin(); iter != view.end(); ++iter) {
+        GRAWDataItem item = *iter;
+        items.emplace_back(item.agetId, item.channel, item.timeBucketId, item.sample);
+    }
+    std::sort(items.begin(), items.end());
+    return items;
+}
+
+TEST(GRAWFrameViewTests, HeaderMatchesFrame)
+{
+    FakeRawFrame fake (123456789, 42, 7, 3);
+    fake.AppendDataItem(1, 60, 3, 99);
+    fake.AppendDataItem(2, 0, 511, 4095);
+    RawFrame raw = fake.GenerateRawFrame();
+
+    GRAWFrame frame (raw);
+    GRAWFrameView view (raw);
+
+    EXPECT_EQ(frame.eventId, view.eventId());
+    EXPECT_EQ(frame.eventTime, view.eventTime());
+    EXPECT_EQ(frame.coboId, view.coboId());
+    EXPECT_EQ(frame.asadId, view.asadId());
+    EXPECT_EQ(frame.nItems, view.GetHeader().nItems);
+    EXPECT_TRUE(view.IsPartialReadout());
+
+    for (addr_t aget = 0; aget < 4; aget++) {
+        EXPECT_EQ(frame.hitPatterns.at(aget), view.GetHitPattern(aget)) << "AGET " << int(aget);
+        EXPECT_EQ(frame.multiplicity.at(aget), view.GetMultiplicity(aget));
+        for (addr_t ch = 0; ch < 68; ch++) {
+            EXPECT_EQ(frame.hitPatterns.at(aget).test(67 - ch), view.IsChannelHit(aget, ch));
+        }
+    }
+
+    EXPECT_TRUE(view.IsChannelHit(1, 60));
+    EXPECT_TRUE(view.IsChannelHit(2, 0));
+    EXPECT_TRUE(view.IsChannelHit(0, 11));  // FPN
+    EXPECT_FALSE(view.IsChannelHit(1, 61));
+
+    // The masks are in trace order, aget*68 + channel
+    const HitMask mask = view.GetHitMask();
+    EXPECT_EQ(frame.GetHitMask(), mask);
+    EXPECT_TRUE((mask[(68 + 60) / 64] >> ((68 + 60) % 64)) & 1);
+    EXPECT_TRUE((mask[136 / 64] >> (136 % 64)) & 1);
+    EXPECT_FALSE((mask[(68 + 61) / 64] >> ((68 + 61) % 64)) & 1);
+}
+
+TEST(GRAWFrameViewTests, PartialReadoutItemsMatchFrame)
+{
+    FakeRawFrame fake (1, 2, 0, 1);
+    fake.AppendDataItem(3, 67, 100, 12);
+    fake.dataItems.push_back((1u << 30) | (90u << 23) | (5u << 14) | 1u);  // invalid channel, skipped
+    fake.AppendDataItem(0, 1, 2, 3);
+    fake.UpdateSizes();
+    RawFrame raw = fake.GenerateRawFrame();
+
+    GRAWFrameView view (raw);
+    EXPECT_EQ(SortedItems(GRAWFrame(raw)), SortedItems(view));
+
+    // Items come out in frame order
+    GRAWDataItem last = *std::next(view.begin(), 16*512 + 1);
+    EXPECT_EQ(0, last.agetId);
+    EXPECT_EQ(1, last.channel);
+    EXPECT_EQ(3, last.sample);
+}
+
+TEST(GRAWFrameViewTests, FullReadoutItemsMatchFrame)
+{
+    FakeRawFrame fake (1, 2, 0, 1);
+    fake.ClearDataItems();
+    fake.frameType = GRAWFrame::Expected_frameTypeFullReadout;
+    fake.itemSize = GRAWFrame::Expected_itemSizeFullReadout;
+    for (uint32_t i = 0; i < 4*68*20; i++) {
+        fake.dataItems.push_back(((i % 4) << 14) | ((i / 3) & 0xFFF));
+    }
+    fake.UpdateSizes();
+    RawFrame raw = fake.GenerateRawFrame();
+
+    GRAWFrameView view (raw);
+    EXPECT_TRUE(view.IsFullReadout());
+
+    // The frame fills in zeros for the samples that weren't in it, so only compare the ones that were
+    auto fromFrame = SortedItems(GRAWFrame(raw));
+    fromFrame.erase(std::remove_if(fromFrame.begin(), fromFrame.end(),
+                                   [] (const ItemTuple& item) { return std::get<2>(item) >= 20; }),
+                    fromFrame.end());
+    EXPECT_EQ(fromFrame, SortedItems(view));
+}
+
+TEST(GRAWFrameViewTests, ShortFrameThrows)
+{
+    RawFrame raw (20);
+    EXPECT_THROW(GRAWFrameView view (raw), Exceptions::Bad_Data);
+}
@@ -0,0 +1,316 @@
+//
+//  HDFDataStoreTests.cpp
+//  graw-merger
+//
+
+#include "gtest/gtest.h"
+#include "HDFDataStore.h"
+#include "FakeRawFrame.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+class HDFDataStoreTestFixture : public testing::TestWithParam<HDFLayout>
+{
+public:
+    virtual void SetUp();
+    virtual void TearDown();
+
+    //! \brief Makes an event with `nTraces` traces on one AsAd, with samples that depend on the event ID.
+    Event MakeEvent(const evtid_t evtId, const int nTraces);
+
+    //! \brief Checks that a record read from the file holds the same traces as the event.
+    void ExpectSameTraces(const Event& evt, const HDFDataStore::EventRecord& record);
+
+protected:
+    boost::filesystem::path lookupPath;
+    boost::filesystem::path h5Path;
+    std::shared_ptr<PadLookupTable> lookupTable;
+};
+
+void HDFDataStoreTestFixture::SetUp()
+{
+    lookupPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+    h5Path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.h5");
+
+    // AsAd 2 has the largest pad numbers that fit in 15 bits
+    std::ofstream csv (lookupPath.string());
+    for (int aget = 0; aget < 4; aget++) {
+        for (int ch = 0; ch < 68; ch++) {
+            csv << 0 << "," << 1 << "," << aget << "," << ch << "," << 68*aget + ch << "\n";
+            csv << 0 << "," << 2 << "," << aget << "," << ch << "," << 16383 - (68*aget + ch) << "\n";
+        }
+    }
+    csv.close();
+
+    lookupTable = std::make_shared<PadLookupTable>(lookupPath.string());
+}
+
+void HDFDataStoreTestFixture::TearDown()
+{
+    boost::filesystem::remove(lookupPath);
+    boost::filesystem::remove(h5Path);
+}
+
+Event HDFDataStoreTestFixture::MakeEvent(const evtid_t evtId, const int nTraces)
+{
+    FakeRawFrame fake (1000 + evtId, evtId, 0, 1);
+    fake.ClearDataItems();
+    for (int i = 0; i < nTraces; i++) {
+        for (uint32_t tb = 0; tb < 512; tb += 3) {
+            fake.AppendDataItem(i % 4, i / 4, tb, (evtId * 100 + i * 7 + tb) & 0xFFF);
+        }
+    }
+
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+    evt.AppendRawFrame(fake.GenerateRawFrame());
+    return evt;
+}
+
+void HDFDataStoreTestFixture::ExpectSameTraces(const Event& evt, const HDFDataStore::EventRecord& record)
+{
+    EXPECT_EQ(evt.eventId, record.eventId);
+    ASSERT_EQ(evt.numTraces(), record.nTraces);
+    ASSERT_EQ(record.nTraces * HDFDataStore::traceColumns, record.data.size());
+
+    size_t row = 0;
+    for (const auto& trace : evt) {
+        const sample_t* values = record.data.data() + row * HDFDataStore::traceColumns;
+        EXPECT_EQ(trace.first.aget, values[2]);
+        EXPECT_EQ(trace.first.channel, values[3]);
+        EXPECT_EQ(trace.first.pad, values[4]);
+        for (arma::uword tb = 0; tb < trace.second.n_elem; tb++) {
+            ASSERT_EQ(trace.second(tb), values[5 + tb]) << "in row " << row << " at TB " << tb;
+        }
+        row++;
+    }
+}
+
+TEST_P(HDFDataStoreTestFixture, ReadsBackWhatWasWritten)
+{
+    std::vector<Event> events;
+    events.push_back(MakeEvent(3, 10));
+    events.push_back(MakeEvent(7, 0));
+    events.push_back(MakeEvent(8, 25));
+    events.push_back(MakeEvent(12, 1));
+
+    HDFWriteOptions opts;
+    opts.layout = GetParam();
+    opts.chunkTraces = 8;
+    opts.batchTraces = 16;  // so the Table layout is appended to several times
+    opts.shuffle = true;
+    opts.deflateLevel = 1;
+    {
+        HDFDataStore store (h5Path.string(), true, opts);
+        for (const auto& evt : events) {
+            store.writeEvent(evt);
+        }
+        EXPECT_EQ(events.size(), store.numEvents());
+    }
+
+    HDFDataStore store (h5Path.string());
+    ASSERT_EQ(events.size(), store.numEvents());
+    for (size_t i = 0; i < events.size(); i++) {
+        SCOPED_TRACE("event " + std::to_string(i));
+        ExpectSameTraces(events[i], store.readEvent(i));
+    }
+    EXPECT_THROW(store.readEvent(events.size()), std::out_of_range);
+}
+
+TEST_P(HDFDataStoreTestFixture, WritesBatches)
+{
+    std::vector<Event> events;
+    events.push_back(MakeEvent(1, 4));
+    events.push_back(MakeEvent(2, 9));
+    events.push_back(MakeEvent(4, 2));
+
+    HDFWriteOptions opts;
+    opts.layout = GetParam();
+    {
+        HDFDataStore store (h5Path.string(), true, opts);
+
+        // One event written on its own, which may be held in memory, then two batches after it
+        store.writeEvent(events[0]);
+
+        HDFDataStore::EventBatch batch;
+        batch.add(events[1]);
+        store.writeBatch(batch);
+        EXPECT_EQ(2u, store.numEvents());
+
+        batch.clear();
+        batch.add(events[2]);
+        EXPECT_EQ(0u, batch.events[0].firstRow);
+        EXPECT_EQ(2u, batch.numTraces());
+        store.writeBatch(batch);
+    }
+
+    HDFDataStore store (h5Path.string());
+    ASSERT_EQ(events.size(), store.numEvents());
+    for (size_t i = 0; i < events.size(); i++) {
+        SCOPED_TRACE("event " + std::to_string(i));
+        ExpectSameTraces(events[i], store.readEvent(i));
+    }
+}
+
+TEST_F(HDFDataStoreTestFixture, PerEventSkipsEventsThatFailToWrite)
+{
+    // The second event 2 can't be written, since there is already a dataset with its name
+    std::vector<Event> events;
+    events.push_back(MakeEvent(1, 3));
+    events.push_back(MakeEvent(2, 5));
+    events.push_back(MakeEvent(2, 4));
+    events.push_back(MakeEvent(3, 2));
+
+    HDFWriteOptions opts;
+    {
+        HDFDataStore store (h5Path.string(), true, opts);
+        HDFDataStore::EventBatch batch;
+        for (const auto& evt : events) {
+            batch.add(evt);
+        }
+        EXPECT_NO_THROW(store.writeBatch(batch));
+        EXPECT_EQ(3u, store.numEvents());
+    }
+
+    HDFDataStore store (h5Path.string());
+    ASSERT_EQ(3u, store.numEvents());
+    ExpectSameTraces(events[0], store.readEvent(0));
+    ExpectSameTraces(events[1], store.readEvent(1));
+    ExpectSameTraces(events[3], store.readEvent(2));
+}
+
+TEST_F(HDFDataStoreTestFixture, TableKeepsEventTime)
+{
+    HDFWriteOptions opts;
+    opts.layout = HDFLayout::Table;
+    {
+        HDFDataStore store (h5Path.string(), true, opts);
+        store.writeEvent(MakeEvent(5, 3));
+    }
+
+    HDFDataStore store (h5Path.string());
+    auto record = store.readEvent(0);
+    EXPECT_EQ(5u, record.eventId);
+    EXPECT_EQ(1005u, record.eventTime);
+}
+
+TEST_F(HDFDataStoreTestFixture, SparseKeepsEmptyTraces)
+{
+    HDFWriteOptions opts;
+    opts.layout = HDFLayout::Sparse;
+
+    Event partial = MakeEvent(6, 5);
+    partial.ApplyThreshold(300);
+    Event empty = MakeEvent(7, 3);
+    empty.ApplyThreshold(0x1000);  // every sample is zeroed, so the traces have no runs
+    {
+        HDFDataStore store (h5Path.string(), true, opts);
+        store.writeEvent(partial);
+        store.writeEvent(empty);
+    }
+
+    HDFDataStore store (h5Path.string());
+    ExpectSameTraces(partial, store.readEvent(0));
+    auto record = store.readEvent(1);
+    EXPECT_EQ(1007u, record.eventTime);
+    ExpectSameTraces(empty, record);
+}
+
+TEST_P(HDFDataStoreTestFixture, RoundTripsAtMinimumNbitPrecision)
+{
+    HDFWriteOptions opts;
+    opts.layout = GetParam();
+    opts.nbitPrecision = opts.MinNbitPrecision();
+
+    // The largest pads, a channel with no pad, and a run as long as a trace. The samples are kept small enough to fit.
+    const sample_t maxSample = static_cast<sample_t>((1 << (opts.nbitPrecision - 1)) - 1);
+    FakeRawFrame fake (1009, 9, 0, 2);
+    fake.ClearDataItems();
+    for (uint32_t tb = 0; tb < 512; tb++) {
+        fake.AppendDataItem(0, 0, tb, 1 + tb % std::min<sample_t>(maxSample, 4095));
+    }
+    fake.AppendDataItem(3, 67, 100, 7);
+    fake.AppendDataItem(3, 67, 101, std::min<sample_t>(maxSample, 4095));
+
+    FakeRawFrame unmapped (1009, 9, 0, 3);
+    unmapped.ClearDataItems();
+    unmapped.AppendDataItem(1, 2, 50, 11);
+
+    Event evt;
+    evt.SetLookupTable(lookupTable);
+    evt.AppendRawFrame(fake.GenerateRawFrame());
+    evt.AppendRawFrame(unmapped.GenerateRawFrame());
+    {
+        HDFDataStore store (h5Path.string(), true, opts);
+        store.writeEvent(evt);
+    }
+
+    HDFDataStore store (h5Path.string());
+    auto record = store.readEvent(0);
+    ASSERT_EQ(3u, record.nTraces);
+    EXPECT_EQ(16383, record.data[4]);
+    EXPECT_EQ(lookupTable->missingValue, record.data[2 * HDFDataStore::traceColumns + 4]);
+    ExpectSameTraces(evt, record);
+}
+
+TEST_P(HDFDataStoreTestFixture, RejectsNbitPrecisionThatClipsMoreThanSamples)
+{
+    HDFWriteOptions opts;
+    opts.layout = GetParam();
+    opts.nbitPrecision = opts.MinNbitPrecision() - 1;
+    EXPECT_THROW(HDFDataStore(h5Path.string(), true, opts), std::invalid_argument);
+}
+
+TEST(HDFDataStoreRunTests, EncodesRunsOfNonzeroSamples)
+{
+    std::vector<sample_t> trace (Constants::num_tbs, 0);
+    trace[0] = 5;
+    trace[1] = -3;
+    trace[10] = 7;
+    trace[Constants::num_tbs - 1] = 9;
+
+    std::vector<sample_t> runs {42};  // encoding appends
+    EXPECT_EQ(10u, HDFDataStore::EncodeRuns(trace.data(), runs));
+    const std::vector<sample_t> expected {42, 0, 2, 5, -3, 10, 1, 7, 511, 1, 9};
+    ASSERT_EQ(expected.size(), runs.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(expected[i], runs[i]) << "at " << i;
+    }
+
+    std::vector<sample_t> expanded (Constants::num_tbs, 0);
+    HDFDataStore::ExpandRuns(runs.data() + 1, runs.size() - 1, expanded.data());
+    for (size_t tb = 0; tb < trace.size(); tb++) {
+        EXPECT_EQ(trace[tb], expanded[tb]) << "at TB " << tb;
+    }
+}
+
+TEST(HDFDataStoreRunTests, EncodesFullAndEmptyTraces)
+{
+    std::vector<sample_t> full (Constants::num_tbs, 1);
+    std::vector<sample_t> runs;
+    EXPECT_EQ(Constants::num_tbs + 2u, HDFDataStore::EncodeRuns(full.data(), runs));
+    EXPECT_EQ(0, runs[0]);
+    EXPECT_EQ(Constants::num_tbs, runs[1]);
+
+    std::vector<sample_t> empty (Constants::num_tbs, 0);
+    runs.clear();
+    EXPECT_EQ(0u, HDFDataStore::EncodeRuns(empty.data(), runs));
+}
+
+TEST(HDFDataStoreRunTests, RejectsRunsThatDontFit)
+{
+    std::vector<sample_t> trace (Constants::num_tbs, 0);
+    const std::vector<sample_t> pastEnd {510, 3, 1, 2, 3};
+    const std::vector<sample_t> truncated {4, 3, 1};
+    const std::vector<sample_t> halfHeader {4};
+    EXPECT_THROW(HDFDataStore::ExpandRuns(pastEnd.data(), pastEnd.size(), trace.data()), Exceptions::Bad_Data);
+    EXPECT_THROW(HDFDataStore::ExpandRuns(truncated.data(), truncated.size(), trace.data()), Exceptions::Bad_Data);
+    EXPECT_THROW(HDFDataStore::ExpandRuns(halfHeader.data(), halfHeader.size(), trace.data()), Exceptions::Bad_Data);
+}
+
+INSTANTIATE_TEST_CASE_P(Layouts, HDFDataStoreTestFixture,
+                        testing::Values(HDFLayout::PerEvent, HDFLayout::Table, HDFLayout::Sparse));
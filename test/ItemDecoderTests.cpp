@@ -0,0 +1,131 @@
+//
+//  ItemDecoderTests.cpp
+//  graw-merger
+//
+
+#include "gtest/gtest.h"
+#include "ItemDecoder.h"
+#include "GRAWFrame.h"
+#include "FakeRawFrame.h"
+
+#include <random>
+#include <vector>
+
+class ItemDecoderTestFixture : public testing::Test
+{
+public:
+    //! \brief Makes a frame with `nValid` random valid items, with an invalid one after every `badEvery` items.
+    void FillFrame(const size_t nValid, const size_t badEvery);
+
+    //! \brief Decodes the data items of `fake` with the given implementation.
+    DecodedItems Decode(const ItemDecoder::Impl impl);
+
+protected:
+    FakeRawFrame fake;
+    std::vector<uint8_t> bytes;
+};
+
+void ItemDecoderTestFixture::FillFrame(const size_t nValid, const size_t badEvery)
+{
+    std::mt19937 rng (1234);
+    std::uniform_int_distribution<uint32_t> agetDist (0, 3);
+    std::uniform_int_distribution<uint32_t> chanDist (0, 67);
+    std::uniform_int_distribution<uint32_t> tbDist (0, 511);
+    std::uniform_int_distribution<uint32_t> sampleDist (0, 4095);
+    std::uniform_int_distribution<uint32_t> badChanDist (68, 127);
+
+    fake.ClearDataItems();
+    for (size_t i = 0; i < nValid; i++) {
+        fake.AppendDataItem(agetDist(rng), chanDist(rng), tbDist(rng), sampleDist(rng));
+
+        if (badEvery > 0 && i % badEvery == badEvery - 1) {
+            // Not in the hit pattern, so add the raw item directly
+            uint32_t bad = (agetDist(rng) << 30) | (badChanDist(rng) << 23) | (tbDist(rng) << 14) | sampleDist(rng);
+            fake.dataItems.push_back(bad);
+        }
+    }
+    fake.UpdateSizes();
+
+    bytes = fake.GenerateRawFrameVector();
+}
+
+DecodedItems ItemDecoderTestFixture::Decode(const ItemDecoder::Impl impl)
+{
+    DecodedItems items;
+    const uint8_t* data = bytes.data() + fake.headerSize * GRAWFrame::sizeUnit;
+    ItemDecoder::DecodePartialReadout(data, fake.dataItems.size(), items, impl);
+    return items;
+}
+
+static void ExpectSameItems(const DecodedItems& expected, const DecodedItems& actual)
+{
+    EXPECT_EQ(expected.aget, actual.aget);
+    EXPECT_EQ(expected.channel, actual.channel);
+    EXPECT_EQ(expected.tb, actual.tb);
+    EXPECT_EQ(expected.sample, actual.sample);
+    EXPECT_EQ(expected.nBadAget, actual.nBadAget);
+    EXPECT_EQ(expected.nBadChannel, actual.nBadChannel);
+    EXPECT_EQ(expected.nBadTB, actual.nBadTB);
+}
+
+TEST_F(ItemDecoderTestFixture, ScalarMatchesItems)
+{
+    FillFrame(100, 0);
+    DecodedItems items = Decode(ItemDecoder::Impl::Scalar);
+
+    ASSERT_EQ(fake.dataItems.size(), items.size());
+    EXPECT_EQ(0u, items.numInvalid());
+    for (size_t i = 0; i < items.size(); i++) {
+        uint32_t raw = fake.dataItems[i];
+        EXPECT_EQ(GRAWFrame::ExtractAgetId(raw), items.aget[i]);
+        EXPECT_EQ(GRAWFrame::ExtractChannel(raw), items.channel[i]);
+        EXPECT_EQ(GRAWFrame::ExtractTBid(raw), items.tb[i]);
+        EXPECT_EQ(GRAWFrame::ExtractSample(raw), items.sample[i]);
+    }
+}
+
+TEST_F(ItemDecoderTestFixture, ScalarCountsInvalidItems)
+{
+    FillFrame(30, 3);
+    DecodedItems items = Decode(ItemDecoder::Impl::Scalar);
+
+    EXPECT_EQ(30u, items.size());
+    EXPECT_EQ(10u, items.nBadChannel);
+    EXPECT_EQ(10u, items.numInvalid());
+}
+
+TEST_F(ItemDecoderTestFixture, VectorImplsMatchScalar)
+{
+    // Odd sizes make sure the leftover items at the end are handled, and the invalid items land in
+    // different positions within the vector blocks.
+    for (size_t nValid : {0, 1, 7, 8, 9, 1001, 34816}) {
+        for (size_t badEvery : {0, 1, 5, 13}) {
+            FillFrame(nValid, badEvery);
+            DecodedItems expected = Decode(ItemDecoder::Impl::Scalar);
+
+            for (auto impl : {ItemDecoder::Impl::SSE41, ItemDecoder::Impl::AVX2}) {
+                if (!ItemDecoder::IsSupported(impl)) continue;
+                SCOPED_TRACE(std::string(ItemDecoder::ImplName(impl)) + " with " + std::to_string(nValid)
+                             + " items, bad every " + std::to_string(badEvery));
+                ExpectSameItems(expected, Decode(impl));
+            }
+        }
+    }
+}
+
+TEST_F(ItemDecoderTestFixture, FrameUsesDecodedItems)
+{
+    FillFrame(50, 7);
+    GRAWFrame frame (fake.GenerateRawFrame());
+
+    DecodedItems expected = Decode(ItemDecoder::Impl::Scalar);
+    ExpectSameItems(expected, frame.GetItems());
+
+    size_t i = 0;
+    for (auto iter = frame.cbegin(); iter != frame.cend(); iter++, i++) {
+        GRAWDataItem item = *iter;
+        EXPECT_EQ(expected.channel[i], item.channel);
+        EXPECT_EQ(expected.sample[i], item.sample);
+    }
+    EXPECT_EQ(expected.size(), i);
+}
@@ -0,0 +1,188 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <boost/filesystem.hpp>
+
+#include "gtest/gtest.h"
+#include "PadLookupTable.h"
+#include "LookupTableFile.h"
+
+namespace fs = boost::filesystem;
+
+// --------
+// CSV parsing
+// --------
+
+static std::vector<LookupTableFile::Row> Parse(const std::string& text)
+{
+    return LookupTableFile::ParseCSV(text.data(), text.data() + text.size());
+}
+
+TEST(LookupTableFileTests, ParsesRows)
+{
+    auto rows = Parse("0,1,2,3,4\n9,3,3,67,10239\n");
+    ASSERT_EQ(2u, rows.size());
+    EXPECT_EQ(0, rows[0].cobo);
+    EXPECT_EQ(1, rows[0].asad);
+    EXPECT_EQ(2, rows[0].aget);
+    EXPECT_EQ(3, rows[0].channel);
+    EXPECT_EQ(4, rows[0].value);
+    EXPECT_EQ(9, rows[1].cobo);
+    EXPECT_EQ(10239, rows[1].value);
+}
+
+TEST(LookupTableFileTests, HandlesLineEndings)
+{
+    for (std::string eol : {"\n", "\r\n", "\r"}) {
+        auto rows = Parse("0,0,0,0,1" + eol + "0,0,0,1,2" + eol + eol + "0,0,0,2,3");
+        ASSERT_EQ(3u, rows.size()) << "line ending " << int(eol.back());
+        EXPECT_EQ(3, rows[2].value);
+        EXPECT_EQ(2, rows[2].channel);
+    }
+}
+
+TEST(LookupTableFileTests, SkipsPlaceholderLines)
+{
+    auto rows = Parse("-1,-1,-1,-1,-1\n,,,,\n  \n1,2,3,4,-5\n");
+    ASSERT_EQ(1u, rows.size());
+    EXPECT_EQ(-5, rows[0].value);
+}
+
+TEST(LookupTableFileTests, IgnoresTextAfterDigitsLikeStoi)
+{
+    auto rows = Parse(" 1, 2 ,3,4,  12.75\n");
+    ASSERT_EQ(1u, rows.size());
+    EXPECT_EQ(1, rows[0].cobo);
+    EXPECT_EQ(2, rows[0].asad);
+    EXPECT_EQ(12, rows[0].value);
+}
+
+TEST(LookupTableFileTests, RejectsMalformedLines)
+{
+    EXPECT_THROW(Parse("0,0,0,0\n"), Exceptions::Bad_Data);
+    EXPECT_THROW(Parse("0,0,x,0,1\n"), Exceptions::Bad_Data);
+    EXPECT_THROW(Parse("0,0,0,0,\n"), Exceptions::Bad_Data);
+    EXPECT_THROW(Parse("0,300,0,0,1\n"), Exceptions::Bad_Data);
+}
+
+TEST(LookupTableFileTests, ThrowsIfFileIsMissing)
+{
+    EXPECT_THROW(LookupTableFile::ParseCSV("/nonexistent/lookup.csv"), Exceptions::File_Open_Failed);
+}
+
+// --------
+// Binary cache
+// --------
+
+class LookupTableCacheTests : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        csvPath = (fs::temp_directory_path() / fs::unique_path("%%%%-%%%%.csv")).string();
+        cachePath = LookupTableFile::CachePath(csvPath);
+        WriteCSV(0);
+    }
+
+    void TearDown() override
+    {
+        fs::remove(csvPath);
+        fs::remove(cachePath);
+    }
+
+    //! \brief Write a table covering every channel of the first two CoBos, with the pads offset by `offset`.
+    void WriteCSV(const int offset)
+    {
+        std::ofstream csv (csvPath);
+        int pad = offset;
+        for (int cobo = 0; cobo < 2; cobo++)
+            for (int asad = 0; asad < Constants::num_asads; asad++)
+                for (int aget = 0; aget < Constants::num_agets; aget++)
+                    for (int ch = 0; ch < Constants::num_channels; ch++)
+                        csv << cobo << "," << asad << "," << aget << "," << ch << "," << pad++ << "\n";
+    }
+
+    static void ExpectPads(const PadLookupTable& table, const int offset)
+    {
+        EXPECT_EQ(offset, table.Find(0, 0, 0, 0));
+        EXPECT_EQ(offset + 2*Constants::num_asads*Constants::num_agets*Constants::num_channels - 1,
+                  table.Find(1, 3, 3, 67));
+        EXPECT_EQ(table.missingValue, table.Find(2, 0, 0, 0));
+    }
+
+    std::string csvPath;
+    std::string cachePath;
+};
+
+TEST_F(LookupTableCacheTests, IsOnlyWrittenWhenAskedFor)
+{
+    PadLookupTable table (csvPath);
+    ExpectPads(table, 0);
+    EXPECT_FALSE(fs::exists(cachePath));
+}
+
+TEST_F(LookupTableCacheTests, IsWrittenAndReused)
+{
+    {
+        PadLookupTable table (csvPath, LookupTableGeometry(), true);
+        ExpectPads(table, 0);
+    }
+    ASSERT_TRUE(fs::exists(cachePath));
+
+    // Remove the csv's contents without changing its size or time, so the table can only come from the cache
+    auto size = fs::file_size(csvPath);
+    auto time = fs::last_write_time(csvPath);
+    {
+        std::ofstream csv (csvPath, std::ios::trunc);
+        csv << std::string(size, '\n');
+    }
+    fs::last_write_time(csvPath, time);
+
+    PadLookupTable table (csvPath, LookupTableGeometry(), true);
+    ExpectPads(table, 0);
+}
+
+TEST_F(LookupTableCacheTests, IsRebuiltWhenCSVChanges)
+{
+    PadLookupTable first (csvPath, LookupTableGeometry(), true);
+
+    WriteCSV(1000);  // more of the pads have four digits now, so the file is bigger
+    PadLookupTable table (csvPath, LookupTableGeometry(), true);
+    ExpectPads(table, 1000);
+}
+
+TEST_F(LookupTableCacheTests, IsRebuiltWhenGeometryChanges)
+{
+    PadLookupTable first (csvPath, LookupTableGeometry(), true);
+
+    LookupTableGeometry small;
+    small.numCobos = 2;
+    PadLookupTable table (csvPath, small, true);
+    ExpectPads(table, 0);
+
+    PadLookupTable full (csvPath, LookupTableGeometry(), true);
+    ExpectPads(full, 0);
+}
+
+TEST_F(LookupTableCacheTests, IsRebuiltWhenCorrupted)
+{
+    PadLookupTable first (csvPath, LookupTableGeometry(), true);
+
+    {
+        std::fstream cache (cachePath, std::ios::in|std::ios::out|std::ios::binary);
+        cache.seekp(-16, std::ios::end);
+        cache.put('\x7f');
+    }
+
+    PadLookupTable table (csvPath, LookupTableGeometry(), true);
+    ExpectPads(table, 0);
+}
+
+TEST_F(LookupTableCacheTests, DependsOnValueType)
+{
+    PadLookupTable first (csvPath, LookupTableGeometry(), true);
+
+    LookupTable<int32_t> wide (csvPath, LookupTableGeometry(), true);
+    EXPECT_EQ(0, wide.Find(0, 0, 0, 0));
+    EXPECT_EQ(1091, wide.Find(1, 0, 0, 3));
+}
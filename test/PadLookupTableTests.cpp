@@ -7,35 +7,42 @@
 //
 
 #include <stdio.h>
+#include <fstream>
 #include "PadLookupTable.h"
 #include "gtest/gtest.h"
-#include <unordered_map>
+#include <boost/filesystem.hpp>
 
 class PadLookupTableTestFixture : public testing::Test
 {
 public:
-    void TestCalculateHash();
+    void TestIndex();
     void TestFindPadNumber();
+    void TestOutOfRange();
+    void TestGeometry();
+    void TestFirstEntryWins();
 };
 
-void PadLookupTableTestFixture::TestCalculateHash()
+void PadLookupTableTestFixture::TestIndex()
 {
+    auto lt = PadLookupTable {};
+    size_t trueIndex = 0;
     for (int cobo = 0; cobo < 10; cobo++) {
         for (int asad = 0; asad < 4; asad++) {
             for (int aget = 0; aget < 4; aget++) {
                 for (int ch = 0; ch < 68; ch++) {
-                    uint32_t trueHash = ch + 100*aget + 10000*asad + 1000000*cobo;
-                    auto resHash = PadLookupTable::CalculateHash(cobo, asad, aget, ch);
-                    ASSERT_EQ(trueHash, resHash);
+                    auto resIndex = lt.Index(cobo, asad, aget, ch);
+                    ASSERT_EQ(trueIndex, resIndex);
+                    trueIndex++;
                 }
             }
         }
     }
+    EXPECT_EQ(trueIndex, lt.values.size() - 1);
 }
 
-TEST_F(PadLookupTableTestFixture, TestCalculateHash)
+TEST_F(PadLookupTableTestFixture, TestIndex)
 {
-    TestCalculateHash();
+    TestIndex();
 }
 
 void PadLookupTableTestFixture::TestFindPadNumber()
@@ -46,8 +53,7 @@ void PadLookupTableTestFixture::TestFindPadNumber()
         for (int asad = 0; asad < 4; asad++) {
             for (int aget = 0; aget < 4; aget++) {
                 for (int ch = 0; ch < 68; ch++) {
-                    auto hash = PadLookupTable::CalculateHash(cobo, asad, aget, ch);
-                    auto result = lt.table.emplace(hash, pad);
+                    lt.Set(cobo, asad, aget, ch, pad);
                     pad++;
                 }
             }
@@ -71,4 +77,104 @@ void PadLookupTableTestFixture::TestFindPadNumber()
 TEST_F(PadLookupTableTestFixture, TestFindPadNumber)
 {
     TestFindPadNumber();
-}
\ No newline at end of file
+}
+
+void PadLookupTableTestFixture::TestOutOfRange()
+{
+    auto lt = PadLookupTable {};
+    lt.Set(0, 0, 0, 0, 42);
+
+    EXPECT_EQ(42, lt.Find(0, 0, 0, 0));
+    EXPECT_EQ(lt.missingValue, lt.Find(0, 0, 0, 1));
+    EXPECT_EQ(lt.missingValue, lt.Find(10, 0, 0, 0));
+    EXPECT_EQ(lt.missingValue, lt.Find(0, 4, 0, 0));
+    EXPECT_EQ(lt.missingValue, lt.Find(0, 0, 4, 0));
+    EXPECT_EQ(lt.missingValue, lt.Find(0, 0, 0, 68));
+    EXPECT_EQ(lt.missingValue, lt.Find(255, 255, 255, 255));
+
+    // Out-of-range addresses are skipped rather than stored or counted
+    EXPECT_FALSE(lt.Set(0, 0, 0, 68, 1));
+    EXPECT_EQ(lt.missingValue, lt.Find(0, 0, 0, 68));
+    EXPECT_EQ(1u, lt.numEntries);
+}
+
+TEST_F(PadLookupTableTestFixture, TestOutOfRange)
+{
+    TestOutOfRange();
+}
+
+TEST_F(PadLookupTableTestFixture, TestFindThrowsWhenEmpty)
+{
+    auto lt = PadLookupTable {};
+    EXPECT_TRUE(lt.Empty());
+    EXPECT_THROW(lt.Find(0, 0, 0, 0), Exceptions::Not_Init);
+}
+
+void PadLookupTableTestFixture::TestGeometry()
+{
+    LookupTableGeometry geom;
+    geom.numCobos = 2;
+    geom.numAsads = 1;
+
+    auto lt = PadLookupTable {geom};
+    EXPECT_EQ(2u * 4 * 68 + 1, lt.values.size());
+
+    lt.Set(1, 0, 3, 67, 7);
+    EXPECT_EQ(7, lt.Find(1, 0, 3, 67));
+    EXPECT_EQ(lt.missingValue, lt.Find(1, 1, 3, 67));
+    EXPECT_EQ(lt.missingValue, lt.Find(2, 0, 0, 0));
+}
+
+TEST_F(PadLookupTableTestFixture, TestGeometry)
+{
+    TestGeometry();
+}
+
+void PadLookupTableTestFixture::TestFirstEntryWins()
+{
+    auto lt = PadLookupTable {};
+    EXPECT_TRUE(lt.Set(1, 2, 3, 4, 100));
+    EXPECT_FALSE(lt.Set(1, 2, 3, 4, 200));
+    EXPECT_EQ(100, lt.Find(1, 2, 3, 4));
+    EXPECT_EQ(1u, lt.numEntries);
+}
+
+TEST_F(PadLookupTableTestFixture, TestFirstEntryWins)
+{
+    TestFirstEntryWins();
+}
+
+TEST_F(PadLookupTableTestFixture, TestReadFile)
+{
+    auto path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+    {
+        std::ofstream csv (path.string());
+        csv << "0,0,0,0,5\n" << "9,3,3,67,10239\n" << "-1,-1,-1,-1,-1\n" << "2,1,0,11,300\n";
+    }
+
+    PadLookupTable lt (path.string());
+    boost::filesystem::remove(path);
+
+    EXPECT_FALSE(lt.Empty());
+    EXPECT_EQ(5, lt.Find(0, 0, 0, 0));
+    EXPECT_EQ(10239, lt.Find(9, 3, 3, 67));
+    EXPECT_EQ(300, lt.Find(2, 1, 0, 11));
+    EXPECT_EQ(lt.missingValue, lt.Find(2, 1, 0, 12));
+}
+
+TEST_F(PadLookupTableTestFixture, TestReadFileSkipsDuplicateAndOutOfRangeRows)
+{
+    auto path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.csv");
+    {
+        std::ofstream csv (path.string());
+        csv << "0,0,0,0,5\n" << "10,0,0,0,7\n" << "0,0,0,68,8\n" << "0,0,0,0,6\n" << "0,0,0,1,9\n";
+    }
+
+    PadLookupTable lt (path.string());
+    boost::filesystem::remove(path);
+
+    EXPECT_EQ(5, lt.Find(0, 0, 0, 0));
+    EXPECT_EQ(9, lt.Find(0, 0, 0, 1));
+    EXPECT_EQ(lt.missingValue, lt.Find(10, 0, 0, 0));
+    EXPECT_EQ(lt.missingValue, lt.Find(0, 0, 0, 68));
+}
@@ -0,0 +1,75 @@
+//
+//  ReorderBufferTests.cpp
+//  graw-merger
+//
+
+#include "gtest/gtest.h"
+#include "ReorderBuffer.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+TEST(ReorderBufferTests, HoldsItemsUntilTheGapIsFilled)
+{
+    auto output = std::make_shared<SyncQueue<int>>(16);
+    ReorderBuffer<int> buffer (output, 8);
+
+    buffer.put(2, 20);
+    buffer.put(1, 10);
+    EXPECT_TRUE(output->empty());
+
+    buffer.put(0, 0);
+    buffer.put(3, 30);
+
+    std::vector<int> result;
+    output->getBatch(result, 16);
+    EXPECT_EQ((std::vector<int> {0, 10, 20, 30}), result);
+    EXPECT_EQ(3u, buffer.maxItemsHeld());
+}
+
+TEST(ReorderBufferTests, ManyThreadsComeOutInOrder)
+{
+    const int numItems = 10000;
+    const int numThreads = 4;
+
+    auto output = std::make_shared<SyncQueue<std::unique_ptr<int>>>(64);
+    ReorderBuffer<std::unique_ptr<int>> buffer (output, 16);
+
+    // Each thread takes every numThreads-th item, and some are slower than others, so items arrive out of order.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&buffer, t] {
+            std::mt19937 rng (t);
+            std::uniform_int_distribution<int> delay (0, 20);
+            for (int i = t; i < numItems; i += numThreads) {
+                std::this_thread::sleep_for(std::chrono::microseconds(delay(rng)));
+                buffer.put(i, std::unique_ptr<int>(new int(i)));
+            }
+        });
+    }
+
+    std::thread finisher ([&threads, &output] {
+        for (auto& thr : threads) thr.join();
+        output->finish();
+    });
+
+    std::vector<int> result;
+    std::vector<std::unique_ptr<int>> batch;
+    try {
+        while (true) {
+            output->getBatch(batch, 32);
+            for (const auto& item : batch) result.push_back(*item);
+        }
+    }
+    catch (const NoMoreTasks&) {}
+    finisher.join();
+
+    ASSERT_EQ(size_t(numItems), result.size());
+    for (int i = 0; i < numItems; i++) {
+        ASSERT_EQ(i, result[i]);
+    }
+    EXPECT_LE(buffer.maxItemsHeld(), 16u);
+}
@@ -0,0 +1,177 @@
+//
+//  SyncQueueTests.cpp
+//  graw-merger
+//
+
+#include "gtest/gtest.h"
+#include "SyncQueue.h"
+
+#include <thread>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+TEST(SyncQueueTests, CapacityRoundsUpToPowerOfTwo)
+{
+    EXPECT_EQ(128u, SyncQueue<int>(100).capacity());
+    EXPECT_EQ(64u, SyncQueue<int>(64).capacity());
+    EXPECT_EQ(2u, SyncQueue<int>(1).capacity());
+}
+
+TEST(SyncQueueTests, FifoOrderWithOneThread)
+{
+    SyncQueue<int> queue (8);
+    for (int i = 0; i < 8; i++) {
+        queue.put(i);
+    }
+
+    int val = -1;
+    EXPECT_FALSE(queue.tryPut(val));
+
+    for (int i = 0; i < 8; i++) {
+        queue.get(val);
+        EXPECT_EQ(i, val);
+    }
+    EXPECT_FALSE(queue.tryGet(val));
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(SyncQueueTests, MovesOnlyTypes)
+{
+    SyncQueue<std::unique_ptr<int>> queue (4);
+    queue.put(std::unique_ptr<int> {new int(42)});
+
+    std::unique_ptr<int> res;
+    queue.get(res);
+    ASSERT_NE(nullptr, res);
+    EXPECT_EQ(42, *res);
+}
+
+TEST(SyncQueueTests, GetThrowsAfterFinish)
+{
+    SyncQueue<int> queue (4);
+    queue.put(1);
+
+    std::thread consumer {[&queue] {
+        int val;
+        queue.get(val);
+        EXPECT_EQ(1, val);
+        EXPECT_THROW(queue.get(val), NoMoreTasks);
+    }};
+
+    queue.finish();
+    consumer.join();
+}
+
+TEST(SyncQueueTests, EveryItemDeliveredOnceWithManyThreads)
+{
+    const int nProducers = 4;
+    const int nConsumers = 3;
+    const int perProducer = 20000;
+
+    // A small capacity makes both sides block often
+    SyncQueue<int> queue (16);
+    std::vector<std::vector<int>> received (nConsumers);
+
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < nConsumers; c++) {
+        consumers.emplace_back([&queue, &received, c] {
+            int val;
+            while (true) {
+                try {
+                    queue.get(val);
+                }
+                catch (const NoMoreTasks&) {
+                    break;
+                }
+                received[c].push_back(val);
+            }
+        });
+    }
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < nProducers; p++) {
+        producers.emplace_back([&queue, p] {
+            for (int i = 0; i < perProducer; i++) {
+                queue.put(p*perProducer + i);
+            }
+        });
+    }
+
+    for (auto& thr : producers) thr.join();
+    queue.finish();
+    for (auto& thr : consumers) thr.join();
+
+    std::vector<int> all;
+    for (const auto& part : received) {
+        // Items from one producer must come out in the order they went in
+        for (int p = 0; p < nProducers; p++) {
+            int last = -1;
+            for (auto v : part) {
+                if (v / perProducer != p) continue;
+                EXPECT_LT(last, v);
+                last = v;
+            }
+        }
+        all.insert(all.end(), part.begin(), part.end());
+    }
+
+    std::sort(all.begin(), all.end());
+    ASSERT_EQ(size_t(nProducers*perProducer), all.size());
+    for (int i = 0; i < nProducers*perProducer; i++) {
+        ASSERT_EQ(i, all[i]);
+    }
+}
+
+TEST(SyncQueueTests, BatchesKeepOrder)
+{
+    SyncQueue<int> queue (8);
+    std::vector<int> items {0, 1, 2, 3, 4};
+    queue.putBatch(items);
+    EXPECT_TRUE(items.empty());
+
+    std::vector<int> out;
+    ASSERT_EQ(3u, queue.getBatch(out, 3));
+    EXPECT_EQ((std::vector<int> {0, 1, 2}), out);
+    ASSERT_EQ(2u, queue.getBatch(out, 10));
+    EXPECT_EQ((std::vector<int> {3, 4}), out);
+}
+
+TEST(SyncQueueTests, BatchLargerThanCapacity)
+{
+    SyncQueue<int> queue (4);
+    std::vector<int> received;
+
+    std::thread consumer {[&queue, &received] {
+        std::vector<int> out;
+        while (true) {
+            try {
+                queue.getBatch(out, 3);
+            }
+            catch (const NoMoreTasks&) {
+                break;
+            }
+            received.insert(received.end(), out.begin(), out.end());
+        }
+    }};
+
+    std::vector<int> items;
+    for (int i = 0; i < 1000; i++) items.push_back(i);
+    queue.putBatch(items);
+    queue.finish();
+    consumer.join();
+
+    ASSERT_EQ(1000u, received.size());
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(i, received[i]);
+    }
+}
+
+TEST(SyncQueueTests, GetBatchThrowsAfterFinish)
+{
+    SyncQueue<int> queue (4);
+    queue.finish();
+
+    std::vector<int> out;
+    EXPECT_THROW(queue.getBatch(out, 4), NoMoreTasks);
+}
@@ -0,0 +1,113 @@
+//
+//  TraceKernelsTests.cpp
+//  graw-merger
+//
+
+#include "gtest/gtest.h"
+#include "TraceKernels.h"
+
+#include <random>
+#include <vector>
+
+// The lengths are chosen so that some samples are left over after the vector loops.
+
+class TraceKernelsTestFixture : public testing::TestWithParam<size_t>
+{
+public:
+    virtual void SetUp();
+
+protected:
+    std::vector<sample_t> vals;
+    std::vector<sample_t> other;
+};
+
+void TraceKernelsTestFixture::SetUp()
+{
+    std::mt19937 rng (31415);
+    std::uniform_int_distribution<int> sampleDist (-32768, 32767);
+    std::bernoulli_distribution rarely (0.2);
+
+    const size_t n = GetParam();
+    vals.resize(n);
+    other.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        vals[i] = rarely(rng) ? 0 : static_cast<sample_t>(sampleDist(rng));
+        other[i] = rarely(rng) ? 0 : static_cast<sample_t>(sampleDist(rng));
+    }
+}
+
+TEST_P(TraceKernelsTestFixture, AccumulateWithCount)
+{
+    std::vector<sample_t> sum {vals};
+    std::vector<int16_t> count (vals.size(), 2);
+    TraceKernels::AccumulateWithCount(sum.data(), count.data(), other.data(), vals.size());
+
+    for (size_t i = 0; i < vals.size(); i++) {
+        EXPECT_EQ(static_cast<sample_t>(vals[i] + other[i]), sum[i]) << "at " << i;
+        EXPECT_EQ(other[i] != 0 ? 3 : 2, count[i]) << "at " << i;
+    }
+}
+
+TEST_P(TraceKernelsTestFixture, DivideByCount)
+{
+    std::vector<int16_t> count (vals.size());
+    for (size_t i = 0; i < vals.size(); i++) {
+        count[i] = static_cast<int16_t>(i % 5);
+    }
+
+    std::vector<sample_t> result {vals};
+    TraceKernels::DivideByCount(result.data(), count.data(), vals.size());
+
+    for (size_t i = 0; i < vals.size(); i++) {
+        const sample_t expected = count[i] == 0 ? vals[i] : static_cast<sample_t>(vals[i] / count[i]);
+        EXPECT_EQ(expected, result[i]) << vals[i] << " / " << count[i];
+    }
+}
+
+TEST_P(TraceKernelsTestFixture, SumNonzero)
+{
+    int64_t expectedTotal = 0;
+    int64_t expectedNonzero = 0;
+    for (auto v : vals) {
+        expectedTotal += v;
+        if (v != 0) expectedNonzero++;
+    }
+
+    int64_t total, numNonzero;
+    TraceKernels::SumNonzero(vals.data(), vals.size(), total, numNonzero);
+    EXPECT_EQ(expectedTotal, total);
+    EXPECT_EQ(expectedNonzero, numNonzero);
+}
+
+TEST_P(TraceKernelsTestFixture, SubtractWrapsAround)
+{
+    std::vector<sample_t> shifted {vals};
+    TraceKernels::SubtractScalar(shifted.data(), 20000, vals.size());
+
+    std::vector<sample_t> diff {vals};
+    TraceKernels::Subtract(diff.data(), other.data(), vals.size());
+
+    for (size_t i = 0; i < vals.size(); i++) {
+        EXPECT_EQ(static_cast<sample_t>(vals[i] - 20000), shifted[i]) << "at " << i;
+        EXPECT_EQ(static_cast<sample_t>(vals[i] - other[i]), diff[i]) << "at " << i;
+    }
+}
+
+TEST_P(TraceKernelsTestFixture, ZeroBelow)
+{
+    for (const sample_t threshold : {sample_t(-100), sample_t(0), sample_t(1), sample_t(500)}) {
+        std::vector<sample_t> result {vals};
+        if (!result.empty()) result[0] = threshold;  // a value equal to the threshold is kept
+        std::vector<sample_t> expected {result};
+        for (auto& v : expected) {
+            if (v < threshold) v = 0;
+        }
+
+        TraceKernels::ZeroBelow(result.data(), threshold, result.size());
+        for (size_t i = 0; i < vals.size(); i++) {
+            EXPECT_EQ(expected[i], result[i]) << "at " << i << " with threshold " << threshold;
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Lengths, TraceKernelsTestFixture, testing::Values(0, 5, 8, 13, 512));